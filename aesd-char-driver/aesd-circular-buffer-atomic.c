@@ -0,0 +1,203 @@
+/**
+ * @file aesd-circular-buffer-atomic.c
+ * @brief A lock-free variant of the circular buffer, for producers and a consumer in userspace threads
+ *
+ * @author Jake Uyechi
+ *
+ */
+
+#include <string.h>
+
+#include "aesd-circular-buffer-atomic.h"
+
+#define AESD_ATOMIC_BUFFER_MASK (AESD_ATOMIC_BUFFER_ENTRIES - 1)
+
+_Static_assert((AESD_ATOMIC_BUFFER_ENTRIES & AESD_ATOMIC_BUFFER_MASK) == 0,
+    "AESD_ATOMIC_BUFFER_ENTRIES must be a power of two");
+
+/**
+* Initializes the buffer described by @param buffer to an empty struct, for one producer or, if
+* @param multi_producer is set, for any number of them.
+*/
+void aesd_atomic_buffer_init(struct aesd_atomic_buffer *buffer, bool multi_producer)
+{
+    memset(buffer, 0, sizeof(struct aesd_atomic_buffer));
+    atomic_init(&buffer->in_seq, 0);
+    atomic_init(&buffer->out_seq, 0);
+    for (uint64_t index = 0; index < AESD_ATOMIC_BUFFER_ENTRIES; index++) {
+        atomic_init(&buffer->slot[index].seq, index);
+        atomic_init(&buffer->slot[index].buffptr, NULL);
+        atomic_init(&buffer->slot[index].size, 0);
+    }
+    buffer->multi_producer = multi_producer;
+}
+
+/**
+* Removes the oldest entry from @param buffer and copies it to @param removed_entry, so the caller
+* can free the memory it references; @param seq_rtn, if not NULL, is set to its sequence number.
+* Safe against producers evicting entries at the same time.
+*
+* @return true if an entry was removed, false if the buffer was empty
+*/
+bool aesd_atomic_buffer_remove_entry(struct aesd_atomic_buffer *buffer, struct aesd_buffer_entry *removed_entry,
+            uint64_t *seq_rtn)
+{
+    // guard clause to check for valid arguments
+    if (buffer == NULL || removed_entry == NULL) {
+        return false;
+    }
+
+    // claim the oldest published entry; losing the race to an evicting producer moves on to the next
+    uint64_t pos = atomic_load_explicit(&buffer->out_seq, memory_order_relaxed);
+    struct aesd_atomic_buffer_slot *slot;
+    while (1) {
+        slot = &buffer->slot[pos & AESD_ATOMIC_BUFFER_MASK];
+        int64_t diff = (int64_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&buffer->out_seq, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the oldest entry is not published yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&buffer->out_seq, memory_order_relaxed);
+        }
+    }
+
+    // copy the entry out, then hand the slot to the producer one lap later
+    removed_entry->buffptr = atomic_load_explicit(&slot->buffptr, memory_order_relaxed);
+    removed_entry->size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+    if (seq_rtn != NULL) {
+        *seq_rtn = pos;
+    }
+    atomic_store_explicit(&slot->seq, pos + AESD_ATOMIC_BUFFER_ENTRIES, memory_order_release);
+
+    return true;
+}
+
+/**
+* Adds @param add_entry to @param buffer as its newest entry; @param seq_rtn, if not NULL, is set to
+* its sequence number. If the buffer is full and @param evict is set, the oldest entry is removed
+* into @param evicted_entry to make room, as aesd_circular_buffer_add_entry() overwrites it;
+* evicted_entry->buffptr is NULL if nothing was evicted. At most one entry is evicted per call.
+* Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+*
+* @return true if the entry was added; false if the buffer was full and either evict is not set, or
+* another producer took the room made by evicting, in which case the caller releases the evicted
+* entry and tries again
+*/
+bool aesd_atomic_buffer_add_entry(struct aesd_atomic_buffer *buffer, const struct aesd_buffer_entry *add_entry,
+            bool evict, struct aesd_buffer_entry *evicted_entry, uint64_t *seq_rtn)
+{
+    // guard clause to check for valid arguments
+    if (buffer == NULL || add_entry == NULL || (evict && evicted_entry == NULL)) {
+        return false;
+    }
+    if (evicted_entry != NULL) {
+        memset(evicted_entry, 0, sizeof(struct aesd_buffer_entry));
+    }
+
+    // claim the next sequence number once its slot is free
+    uint64_t pos = atomic_load_explicit(&buffer->in_seq, memory_order_relaxed);
+    struct aesd_atomic_buffer_slot *slot;
+    while (1) {
+        slot = &buffer->slot[pos & AESD_ATOMIC_BUFFER_MASK];
+        int64_t diff = (int64_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (!buffer->multi_producer) {
+                atomic_store_explicit(&buffer->in_seq, pos + 1, memory_order_relaxed);
+                break;
+            }
+            if (atomic_compare_exchange_weak_explicit(&buffer->in_seq, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full: the slot still holds the entry one lap back
+            if (!evict || evicted_entry->buffptr != NULL) {
+                return false;
+            }
+            if (!aesd_atomic_buffer_remove_entry(buffer, evicted_entry, NULL)) {
+                // the oldest entry is still being added or removed; look again
+                memset(evicted_entry, 0, sizeof(struct aesd_buffer_entry));
+            }
+            pos = atomic_load_explicit(&buffer->in_seq, memory_order_relaxed);
+        } else {
+            // another producer claimed it
+            pos = atomic_load_explicit(&buffer->in_seq, memory_order_relaxed);
+        }
+    }
+
+    // fill the slot and publish it; the entry is stored with release so a lookup that reads it
+    // also sees the slot was reused, see aesd_atomic_buffer_find_entry_offset_for_fpos()
+    atomic_store_explicit(&slot->buffptr, add_entry->buffptr, memory_order_release);
+    atomic_store_explicit(&slot->size, add_entry->size, memory_order_release);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    if (seq_rtn != NULL) {
+        *seq_rtn = pos;
+    }
+
+    return true;
+}
+
+/**
+* @param buffer the buffer to search for corresponding offset
+* @param char_offset the position to search for in the buffer list, describing the zero referenced
+*      character index if all buffer strings were concatenated end to end, from the oldest entry
+* @param entry_rtn set to a copy of the entry holding char_offset
+* @param entry_offset_byte_rtn set to the offset of char_offset within that entry
+* The walk is restarted from the new oldest entry if one it passed is removed meanwhile. The copy's
+* buffptr stays valid only while the caller is the one removing entries; with producers evicting,
+* they may free it at any time.
+* @return true if found, false if this position is not available in the buffer
+*/
+bool aesd_atomic_buffer_find_entry_offset_for_fpos(struct aesd_atomic_buffer *buffer,
+            size_t char_offset, struct aesd_buffer_entry *entry_rtn, size_t *entry_offset_byte_rtn)
+{
+    // guard clause to check for valid arguments
+    if (buffer == NULL || entry_rtn == NULL || entry_offset_byte_rtn == NULL) {
+        return false;
+    }
+
+restart:
+    ;
+    size_t temp = char_offset;
+    uint64_t pos = atomic_load_explicit(&buffer->out_seq, memory_order_acquire);
+    for (int iterations = 0; iterations < AESD_ATOMIC_BUFFER_ENTRIES; iterations++, pos++) {
+        struct aesd_atomic_buffer_slot *slot = &buffer->slot[pos & AESD_ATOMIC_BUFFER_MASK];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != pos + 1) {
+            // the end of the published entries, unless this one was removed under the walk
+            if ((int64_t)(seq - (pos + 1)) > 0) goto restart;
+            return false;
+        }
+
+        // read the entry, then check the slot still held it; a producer refilling the slot stores
+        // the entry with release, so reading its values means reading the new sequence number too
+        const char *buffptr = atomic_load_explicit(&slot->buffptr, memory_order_relaxed);
+        size_t size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) goto restart;
+
+        if (temp < size) {
+            // case: entry found with a valid character offset
+            entry_rtn->buffptr = buffptr;
+            entry_rtn->size = size;
+            *entry_offset_byte_rtn = temp;
+            return true;
+        }
+        temp -= size;
+    }
+    return false;
+}
+
+/**
+* @return true if @param buffer has no published entry to remove
+*/
+bool aesd_atomic_buffer_is_empty(struct aesd_atomic_buffer *buffer)
+{
+    uint64_t pos = atomic_load_explicit(&buffer->out_seq, memory_order_relaxed);
+    return atomic_load_explicit(&buffer->slot[pos & AESD_ATOMIC_BUFFER_MASK].seq, memory_order_acquire) != pos + 1;
+}
@@ -0,0 +1,75 @@
+/*
+ * aesd-circular-buffer-atomic.h
+ *
+ *  @brief A userspace variant of aesd_circular_buffer that is safe to share between threads
+ *  without a lock, built on C11 atomics.
+ *
+ *  Entries have the same meaning as in aesd-circular-buffer.h: a buffptr whose memory the caller
+ *  manages, and its size. Producers add entries, optionally evicting the oldest when the buffer is
+ *  full; the consumer removes them oldest first, or looks one up by character offset.
+ *
+ *  Each slot carries a sequence number saying whose turn it is: the producer adding sequence s
+ *  waits for its slot to read s, and publishes the entry by setting it to s + 1; whoever removes
+ *  the entry sets it to s + AESD_ATOMIC_BUFFER_ENTRIES, handing the slot to the producer one lap
+ *  later. With multi_producer set, producers claim sequence numbers with a compare and swap;
+ *  otherwise a single producer claims them with a plain store. Removals always claim with a compare
+ *  and swap, since a producer evicting the oldest entry races the consumer for it.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_ATOMIC_H
+#define AESD_CIRCULAR_BUFFER_ATOMIC_H
+
+#ifdef __KERNEL__
+#error "aesd-circular-buffer-atomic.h is for userspace; the driver locks aesd_circular_buffer itself"
+#endif
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "aesd-circular-buffer.h"
+
+// entries held, a power of two so sequence numbers map to slots across their wraparound
+#ifndef AESD_ATOMIC_BUFFER_ENTRIES
+#define AESD_ATOMIC_BUFFER_ENTRIES 256
+#endif
+
+struct aesd_atomic_buffer_slot
+{
+    /**
+     * Sequence number of the entry the slot is waiting for, or holds once it is one more
+     */
+    _Atomic uint64_t seq;
+    /**
+     * The entry; atomic so lookups racing an eviction read a stale value rather than a torn one
+     */
+    _Atomic(const char *) buffptr;
+    _Atomic size_t size;
+};
+
+struct aesd_atomic_buffer
+{
+    /**
+     * Producers and the consumer work on opposite ends, so each end has its own cache line
+     */
+    _Alignas(64) _Atomic uint64_t in_seq;       /* sequence number the next add claims */
+    _Alignas(64) _Atomic uint64_t out_seq;      /* sequence number of the oldest entry */
+    _Alignas(64) struct aesd_atomic_buffer_slot slot[AESD_ATOMIC_BUFFER_ENTRIES];
+    bool multi_producer;
+};
+
+extern void aesd_atomic_buffer_init(struct aesd_atomic_buffer *buffer, bool multi_producer);
+
+extern bool aesd_atomic_buffer_add_entry(struct aesd_atomic_buffer *buffer, const struct aesd_buffer_entry *add_entry,
+            bool evict, struct aesd_buffer_entry *evicted_entry, uint64_t *seq_rtn);
+
+extern bool aesd_atomic_buffer_remove_entry(struct aesd_atomic_buffer *buffer, struct aesd_buffer_entry *removed_entry,
+            uint64_t *seq_rtn);
+
+extern bool aesd_atomic_buffer_find_entry_offset_for_fpos(struct aesd_atomic_buffer *buffer,
+            size_t char_offset, struct aesd_buffer_entry *entry_rtn, size_t *entry_offset_byte_rtn);
+
+extern bool aesd_atomic_buffer_is_empty(struct aesd_atomic_buffer *buffer);
+
+#endif /* AESD_CIRCULAR_BUFFER_ATOMIC_H */
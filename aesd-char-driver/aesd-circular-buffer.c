@@ -104,6 +104,34 @@ const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     return old_entry;
 }
 
+/**
+* Removes the oldest entry from @param buffer, advancing buffer->out_offs past it, and copies it to
+* @param removed_entry so the caller can free the memory it references.
+* Any necessary locking must be handled by the caller
+*
+* @return true if an entry was removed, false if the buffer was empty
+*/
+bool aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed_entry)
+{
+    // guard clause to check for valid arguments and an empty buffer
+    if (buffer == NULL || removed_entry == NULL) {
+        return false;
+    }
+    if (!buffer->full && buffer->in_offs == buffer->out_offs) {
+        return false;
+    }
+
+    // hand the oldest entry to the caller, leaving its slot empty
+    *removed_entry = buffer->entry[buffer->out_offs];
+    memset(&buffer->entry[buffer->out_offs], 0, sizeof(struct aesd_buffer_entry));
+
+    // advance the output offset; the buffer now has room
+    buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+
+    return true;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
 */
@@ -111,3 +139,158 @@ void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
 }
+
+#ifndef __KERNEL__   /* arena storage is only built in userspace, see aesd-circular-buffer.h */
+/**
+* Initializes the arena buffer described by @param buffer to an empty struct, storing entries in the
+* @param capacity bytes at @param arena, which the caller allocates and frees.
+*/
+void aesd_arena_buffer_init(struct aesd_arena_buffer *buffer, char *arena, size_t capacity)
+{
+    memset(buffer,0,sizeof(struct aesd_arena_buffer));
+    buffer->arena = arena;
+    buffer->capacity = capacity;
+}
+
+// copy between a linear buffer and the arena starting at arena_offset, wrapping at most once
+static void aesd_arena_copy_in(struct aesd_arena_buffer *buffer, size_t arena_offset, const char *src, size_t count)
+{
+    size_t first = buffer->capacity - arena_offset;
+    if (count <= first) {
+        memcpy(buffer->arena + arena_offset, src, count);
+    } else {
+        memcpy(buffer->arena + arena_offset, src, first);
+        memcpy(buffer->arena, src + first, count - first);
+    }
+}
+
+static void aesd_arena_copy_out(struct aesd_arena_buffer *buffer, size_t arena_offset, char *dest, size_t count)
+{
+    size_t first = buffer->capacity - arena_offset;
+    if (count <= first) {
+        memcpy(dest, buffer->arena + arena_offset, count);
+    } else {
+        memcpy(dest, buffer->arena + arena_offset, first);
+        memcpy(dest + first, buffer->arena, count - first);
+    }
+}
+
+/**
+* Removes the oldest entry from @param buffer, advancing buffer->out_offs past it, and copies it to
+* @param removed_entry. Its bytes stay in the arena until the next add overwrites them.
+* Any necessary locking must be handled by the caller
+*
+* @return true if an entry was removed, false if the buffer was empty
+*/
+bool aesd_arena_buffer_remove_entry(struct aesd_arena_buffer *buffer, struct aesd_arena_entry *removed_entry)
+{
+    // guard clause to check for valid arguments and an empty buffer
+    if (buffer == NULL || removed_entry == NULL) {
+        return false;
+    }
+    if (!buffer->full && buffer->in_offs == buffer->out_offs) {
+        return false;
+    }
+
+    // hand the oldest entry to the caller, leaving its slot empty
+    *removed_entry = buffer->entry[buffer->out_offs];
+    memset(&buffer->entry[buffer->out_offs], 0, sizeof(struct aesd_arena_entry));
+    buffer->used -= removed_entry->size;
+
+    // advance the output offset; the buffer now has room
+    buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+
+    return true;
+}
+
+/**
+* Copies @param size bytes at @param data into @param buffer as its newest entry, after the bytes of
+* the previous one. The oldest entries are evicted until there is both a free entry and room in the
+* arena, as aesd_circular_buffer_add_entry() evicts one when the entries are full.
+* Any necessary locking must be handled by the caller
+*
+* @return the number of entries evicted, or -1 if the entry is empty or larger than the arena
+*/
+int aesd_arena_buffer_add_entry(struct aesd_arena_buffer *buffer, const char *data, size_t size)
+{
+    // guard clause to check for valid arguments
+    if (buffer == NULL || data == NULL || size == 0 || size > buffer->capacity) {
+        return -1;
+    }
+
+    // the new entry's bytes start right after the newest entry's, wherever it wrapped to
+    struct aesd_arena_entry add_entry = { .offset = 0, .size = size };
+    if (buffer->used > 0) {
+        add_entry.offset = (buffer->entry[buffer->out_offs].offset + buffer->used) % buffer->capacity;
+    }
+
+    // make room, oldest first
+    int evicted = 0;
+    struct aesd_arena_entry removed;
+    while (buffer->full || buffer->used + size > buffer->capacity) {
+        aesd_arena_buffer_remove_entry(buffer, &removed);
+        evicted++;
+    }
+
+    // copy the bytes in and add the entry at the input offset
+    aesd_arena_copy_in(buffer, add_entry.offset, data, size);
+    buffer->entry[buffer->in_offs] = add_entry;
+    buffer->used += size;
+    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    // check if the buffer is full
+    if (buffer->in_offs == buffer->out_offs) {
+        buffer->full = true;
+    }
+
+    return evicted;
+}
+
+/**
+* @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
+* @param char_offset the position to search for, as for aesd_circular_buffer_find_entry_offset_for_fpos()
+* @param entry_offset_byte_rtn set to the offset of char_offset within the returned entry, when found
+* @return the entry holding char_offset, or NULL if this position is not available in the buffer
+*/
+struct aesd_arena_entry *aesd_arena_buffer_find_entry_offset_for_fpos(struct aesd_arena_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    // guard clause to check for valid arguments, and positions past the end
+    if (buffer == NULL || entry_offset_byte_rtn == NULL || char_offset >= buffer->used) {
+        return NULL;
+    }
+
+    // walk the entries from the oldest; the position is known to be in one of them
+    uint8_t index = buffer->out_offs;
+    while (char_offset >= buffer->entry[index].size) {
+        char_offset -= buffer->entry[index].size;
+        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    *entry_offset_byte_rtn = char_offset;
+    return &buffer->entry[index];
+}
+
+/**
+* Copies up to @param count bytes of @param buffer, starting at @param char_offset of the entries
+* concatenated end to end, to @param dest. The bytes held are contiguous in the arena, so this never
+* looks at the entries past the oldest, and copies in at most two pieces.
+* Any necessary locking must be handled by the caller
+*
+* @return the number of bytes copied, 0 if char_offset is at or past the end of the buffer
+*/
+size_t aesd_arena_buffer_read(struct aesd_arena_buffer *buffer, size_t char_offset, char *dest, size_t count)
+{
+    // guard clause to check for valid arguments, and positions past the end
+    if (buffer == NULL || dest == NULL || char_offset >= buffer->used) {
+        return 0;
+    }
+
+    // copy from the position up to the end of the newest entry
+    if (count > buffer->used - char_offset) {
+        count = buffer->used - char_offset;
+    }
+    aesd_arena_copy_out(buffer, (buffer->entry[buffer->out_offs].offset + char_offset) % buffer->capacity, dest, count);
+    return count;
+}
+#endif /* __KERNEL__ */
@@ -51,15 +51,75 @@ struct aesd_circular_buffer
     bool full;
 };
 
+#ifndef __KERNEL__
+/**
+ * Arena storage: instead of each entry pointing at its own allocation, the bytes of every entry
+ * live back to back in one ring of bytes supplied by the caller, and entries record where theirs
+ * start. Adding an entry copies it in, evicting the oldest entries until both a slot and the bytes
+ * are free, so nothing is allocated per entry; and since the bytes held are contiguous modulo the
+ * arena, reading the history from any offset is at most two memcpy()s.
+ *
+ * An evicted entry's bytes are reused by the next add, so readers must copy under the same lock
+ * as writers; the driver, which copies to user space without it, keeps separately allocated entries,
+ * and arena storage is only built in userspace, for aesdchar-bench to compare the two.
+ */
+struct aesd_arena_entry
+{
+    /**
+     * Offset of the entry's first byte in the arena; its bytes wrap to the start of the arena
+     */
+    size_t offset;
+    /**
+     * Number of bytes stored
+     */
+    size_t size;
+};
+
+struct aesd_arena_buffer
+{
+    /**
+     * The most recent entries, in the same order and with the same offsets as aesd_circular_buffer
+     */
+    struct aesd_arena_entry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * The bytes of the entries, and how many there are
+     */
+    char *arena;
+    size_t capacity;
+    /**
+     * Bytes held by entries, starting at entry[out_offs].offset
+     */
+    size_t used;
+    uint8_t in_offs;
+    uint8_t out_offs;
+    bool full;
+};
+#endif /* __KERNEL__ */
+
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
 extern const char *aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern bool aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed_entry);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+#ifndef __KERNEL__
+extern void aesd_arena_buffer_init(struct aesd_arena_buffer *buffer, char *arena, size_t capacity);
+
+extern int aesd_arena_buffer_add_entry(struct aesd_arena_buffer *buffer, const char *data, size_t size);
+
+extern bool aesd_arena_buffer_remove_entry(struct aesd_arena_buffer *buffer, struct aesd_arena_entry *removed_entry);
+
+extern struct aesd_arena_entry *aesd_arena_buffer_find_entry_offset_for_fpos(struct aesd_arena_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn);
+
+extern size_t aesd_arena_buffer_read(struct aesd_arena_buffer *buffer, size_t char_offset, char *dest, size_t count);
+#endif /* __KERNEL__ */
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each member of the circular buffer, or of an arena buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
@@ -0,0 +1,579 @@
+/**
+ * @file aesd-dev.c
+ * @brief The aesdchar device core: command assembly, reads, seeks and snapshots of the ring
+ *
+ * Everything here works on struct aesd_dev and struct aesd_file, and none of it knows about
+ * struct file or iov_iter, so the same code runs in the module (through main.c) and in userspace
+ * (through aesd-userspace.h).
+ *
+ * @author Jake Uyechi
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h> // u64_to_user_ptr
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/err.h>
+#include <linux/minmax.h>
+#endif
+
+#include "aesd-dev.h"
+
+// take the device lock, timing how long it is held
+static inline void aesd_lock(struct aesd_dev *dev)
+{
+    spin_lock(&dev->lock);
+#ifdef AESD_LOCK_STATS
+    dev->lock_stats.acquired_ns = ktime_get_ns();
+#endif
+}
+
+static inline void aesd_unlock(struct aesd_dev *dev)
+{
+#ifdef AESD_LOCK_STATS
+    u64 held_ns = ktime_get_ns() - dev->lock_stats.acquired_ns;
+    dev->lock_stats.acquisitions++;
+    dev->lock_stats.total_ns += held_ns;
+    if (held_ns > dev->lock_stats.max_ns) dev->lock_stats.max_ns = held_ns;
+#endif
+    spin_unlock(&dev->lock);
+}
+
+// allocate a command with a single reference, held by the ring once published
+static struct aesd_command *aesd_command_alloc(struct aesd_dev *dev, size_t size)
+{
+    struct aesd_command *command = kmalloc(sizeof(struct aesd_command) + size, GFP_KERNEL);
+    if (command == NULL) return NULL;
+    kref_init(&command->ref);
+    command->dev = dev;
+    command->size = size;
+    atomic_long_add(sizeof(struct aesd_command) + size, &dev->command_bytes);
+    return command;
+}
+
+static void aesd_command_release(struct kref *ref)
+{
+    struct aesd_command *command = container_of(ref, struct aesd_command, ref);
+    atomic_long_sub(sizeof(struct aesd_command) + command->size, &command->dev->command_bytes);
+    kfree(command);
+}
+
+// take a reference to the command holding an entry's buffptr
+static inline void aesd_command_get(const char *buffptr)
+{
+    kref_get(&container_of(buffptr, struct aesd_command, data[0])->ref);
+}
+
+// drop a reference to the command holding an entry's buffptr
+void aesd_command_put(const char *buffptr)
+{
+    if (buffptr) kref_put(&container_of(buffptr, struct aesd_command, data[0])->ref, aesd_command_release);
+}
+
+// index of the entry holding a sequence number between first_seq and next_seq
+static inline uint8_t aesd_seq_index(struct aesd_dev *dev, u64 seq)
+{
+    return (dev->circular_buffer.out_offs + (seq - dev->first_seq)) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+// find the entry holding pos, resuming from the cursor when it still describes pos; returns NULL
+// at the end of the ring, and ERR_PTR(-EPIPE) if a file following sequence numbers was overrun
+static struct aesd_buffer_entry *aesd_cursor_find(struct aesd_dev *dev, struct aesd_file *file,
+    loff_t pos, size_t *offset)
+{
+    struct aesd_circular_buffer *cb = &dev->circular_buffer;
+    struct aesd_cursor *cursor = &file->cursor;
+    struct aesd_buffer_entry *entry;
+
+    // seeking since the last read leaves sequence mode
+    if (cursor->pos != pos) file->follow_seq = false;
+
+    // evictions move every byte position, but not the entry a sequence follower reads next
+    if (cursor->pos == pos && (file->follow_seq || cursor->first_seq == dev->first_seq)) {
+        if (cursor->seq < dev->first_seq) return ERR_PTR(-EPIPE);
+        if (cursor->seq == dev->next_seq) return NULL;
+        entry = &cb->entry[aesd_seq_index(dev, cursor->seq)];
+        *offset = cursor->offset;
+        return entry;
+    }
+
+    // walk the ring and remember where pos was found
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(cb, pos, offset);
+    if (entry) {
+        cursor->pos = pos;
+        cursor->first_seq = dev->first_seq;
+        cursor->seq = dev->first_seq + (entry - cb->entry + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - cb->out_offs) %
+            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        cursor->offset = *offset;
+    }
+    return entry;
+}
+
+// move the cursor past bytes read from its entry, on to the next entry at the end of this one
+static void aesd_cursor_advance(struct aesd_cursor *cursor, struct aesd_buffer_entry *entry, size_t count)
+{
+    cursor->pos += count;
+    cursor->offset += count;
+    if (cursor->offset == entry->size) {
+        cursor->seq++;
+        cursor->offset = 0;
+    }
+}
+
+// count an overrun of a sequence follower, and move it on to the oldest entry
+static void aesd_cursor_overrun(struct aesd_dev *dev, struct aesd_file *file)
+{
+    file->overruns++;
+    dev->overruns++;
+    file->cursor.first_seq = dev->first_seq;
+    file->cursor.seq = dev->first_seq;
+    file->cursor.offset = 0;
+}
+
+void aesd_dev_init(struct aesd_dev *dev)
+{
+    memset(dev, 0, sizeof(struct aesd_dev));
+
+    // initialize device lock
+    spin_lock_init(&dev->lock);
+
+    // initialize circular buffer inside device
+    aesd_circular_buffer_init(&dev->circular_buffer);
+}
+
+void aesd_dev_destroy(struct aesd_dev *dev)
+{
+    // free each of the individual entries in the circular buffer
+    struct aesd_buffer_entry *temp;
+    uint8_t index;
+    AESD_CIRCULAR_BUFFER_FOREACH(temp, &dev->circular_buffer, index) {
+        aesd_command_put(temp->buffptr);
+        temp->buffptr = NULL;
+    }
+}
+
+void aesd_file_init(struct aesd_file *file, struct aesd_dev *dev)
+{
+    memset(file, 0, sizeof(struct aesd_file));
+    file->dev = dev;
+    mutex_init(&file->lock);
+    file->cursor.pos = -1;
+}
+
+// drop the partial command a file has staged, freeing the buffer holding it
+static void aesd_file_drop_partial(struct aesd_file *file)
+{
+    atomic_long_sub(file->partial_capacity, &file->dev->partial_bytes);
+    kfree(file->partial_buffer);
+    file->partial_buffer = NULL;
+    file->partial_size = 0;
+    file->partial_capacity = 0;
+}
+
+void aesd_file_destroy(struct aesd_file *file)
+{
+    // a partial command left by this file is dropped with it
+    aesd_file_drop_partial(file);
+    mutex_destroy(&file->lock);
+}
+
+// publish every complete command a file has staged, keeping the bytes after the last one
+static int aesd_publish_staged(struct aesd_dev *dev, struct aesd_file *file)
+{
+    int retval = 0;
+    char *cmd_break;
+    char *cmd_start = file->partial_buffer;
+    char *staged_end = file->partial_buffer + file->partial_size;
+    while ((cmd_break = memchr(cmd_start, '\n', staged_end - cmd_start))) {
+        // copy the command, newline included, into its own entry before taking the lock
+        struct aesd_buffer_entry to_add;
+        struct aesd_command *command = aesd_command_alloc(dev, cmd_break - cmd_start + 1);
+        if (command == NULL) {
+            retval = -ENOMEM;
+            break;
+        }
+        to_add.size = cmd_break - cmd_start + 1;
+        memcpy(command->data, cmd_start, to_add.size);
+        to_add.buffptr = command->data;
+
+        // only the insertion happens under the device lock; the evicted entry is released after
+        aesd_lock(dev);
+        const char *to_free = aesd_circular_buffer_add_entry(&dev->circular_buffer, &to_add);
+        dev->next_seq++;
+        if (to_free) dev->first_seq++;
+        aesd_unlock(dev);
+        aesd_command_put(to_free);
+
+        // move past the command
+        cmd_start = cmd_break + 1;
+    }
+
+    // keep the bytes after the last published command for the next write
+    file->partial_size = staged_end - cmd_start;
+    memmove(file->partial_buffer, cmd_start, file->partial_size);
+    return retval;
+}
+
+ssize_t aesd_dev_write(struct aesd_file *file, const char __user *buf, size_t count, size_t max_partial)
+{
+    ssize_t retval = -ENOMEM;
+    struct aesd_dev *dev = file->dev;
+
+    // lock only this file's staging buffer; other files keep writing
+    if (mutex_lock_interruptible(&file->lock)) return -EINTR;
+
+    // stage the incoming data in pieces no larger than the cap leaves room for, publishing the
+    // commands completed by each, so a large write of many commands never needs more than the cap
+    size_t written = 0;
+    while (written < count) {
+        size_t room = count - written;
+        if (file->discarding) {
+            // swallowing the rest of a command over the cap, a chunk at a time
+            room = min(room, (size_t)AESD_DISCARD_CHUNK);
+        } else if (max_partial != 0 && file->partial_size >= max_partial) {
+            // a command longer than the cap can never be published; drop it now, and its remaining
+            // bytes as they arrive, so the commands after it are stored as usual
+            PDEBUG("[AESD] Dropping partial command over %zu bytes.", max_partial);
+            aesd_file_drop_partial(file);
+            file->discarding = true;
+            continue;
+        } else if (max_partial != 0) {
+            room = min(room, max_partial - file->partial_size);
+        }
+
+        // grow the staging buffer, doubling up to the cap
+        size_t needed = file->partial_size + room;
+        if (needed > file->partial_capacity) {
+            size_t capacity = max(needed, file->partial_capacity * 2);
+            if (max_partial != 0) capacity = max(needed, min(capacity, max_partial));
+            char *grown = krealloc(file->partial_buffer, capacity, GFP_KERNEL);
+            if (grown == NULL) goto cleanup;
+            atomic_long_add(capacity - file->partial_capacity, &dev->partial_bytes);
+            file->partial_buffer = grown;
+            file->partial_capacity = capacity;
+        }
+
+        // copy the incoming buffer from userspace after the staged bytes
+        if (copy_from_user(file->partial_buffer + file->partial_size, buf + written, room)) {
+            retval = -EFAULT;
+            goto cleanup;
+        }
+        written += room;
+        if (file->discarding) {
+            // keep only what follows the end of the dropped command
+            char *staged = file->partial_buffer + file->partial_size;
+            char *cmd_break = memchr(staged, '\n', room);
+            if (cmd_break == NULL) continue;
+            file->partial_size = staged + room - (cmd_break + 1);
+            memmove(staged, cmd_break + 1, file->partial_size);
+            file->discarding = false;
+        } else {
+            file->partial_size += room;
+        }
+
+        // publish every complete command; on failure hand back what this piece left staged, so a
+        // retry resends it rather than publishing a command twice
+        retval = aesd_publish_staged(dev, file);
+        if (retval < 0) {
+            size_t unpublished = min(room, file->partial_size);
+            file->partial_size -= unpublished;
+            written -= unpublished;
+            goto cleanup;
+        }
+    }
+
+    // set the return value to count
+    retval = count;
+
+#if defined(AESD_DEBUG) && defined(AESD_DEBUG_RING)
+    // debug print; holds the device lock for the whole ring, so only when asked for
+    aesd_lock(dev);
+    aesd_print_cb(&dev->circular_buffer);
+    aesd_unlock(dev);
+#endif
+
+cleanup:
+    // once some of the write was consumed, an error is a short write; commands it published stay published
+    if (retval < 0 && written > 0) retval = written;
+    mutex_unlock(&file->lock);
+    return retval;
+}
+
+/**
+ * Find the bytes at a file position, holding a reference so they can be copied without the lock
+ *
+ * @param file                  the file being read
+ * @param pos                   its position
+ * @param count                 most bytes wanted
+ * @param buffptr               set to the entry holding them; release with aesd_command_put() once copied
+ * @param offset                set to where they start in it
+ * @param report_overrun        whether an overrun is returned now; a reader that already copied
+ *                              something returns that first, and sees the overrun on its next call
+ *
+ * @return bytes available at offset, up to count and to the end of the entry; 0 at the end of the
+ *         ring; -EPIPE if the file follows sequence numbers and its next command was evicted
+ */
+ssize_t aesd_dev_read(struct aesd_file *file, loff_t pos, size_t count, const char **buffptr, size_t *offset,
+    bool report_overrun)
+{
+    struct aesd_dev *dev = file->dev;
+    ssize_t retval = 0;
+
+    aesd_lock(dev);
+    struct aesd_buffer_entry *read_entry = aesd_cursor_find(dev, file, pos, offset);
+    if (IS_ERR(read_entry)) {
+        // report the overrun on its own, then carry on from the oldest; the file position is left
+        // alone, as the VFS does not store it on errors
+        if (report_overrun) {
+            aesd_cursor_overrun(dev, file);
+            retval = -EPIPE;
+        }
+    } else if (read_entry != NULL && read_entry->buffptr != NULL) {
+        size_t read_size = min(read_entry->size - *offset, count);
+        *buffptr = read_entry->buffptr;
+        aesd_command_get(read_entry->buffptr);
+
+        // the cursor moves on assuming the copy succeeds; if it falls short, the file position no
+        // longer matches it and the next read looks the position up again
+        aesd_cursor_advance(&file->cursor, read_entry, read_size);
+        retval = read_size;
+    }
+    aesd_unlock(dev);
+
+    return retval;
+}
+
+loff_t aesd_dev_size(struct aesd_dev *dev)
+{
+    aesd_lock(dev);
+    loff_t cb_size = (loff_t)aesd_size(&dev->circular_buffer);
+    aesd_unlock(dev);
+    return cb_size;
+}
+
+/**
+ * Find the file offset of the location of a write command and offset
+ *
+ * @param file                  the file being positioned
+ * @param write_cmd             the index of the write command to seek to
+ * @param write_cmd_offset      the offset within write_cmd to seek to
+ * @param pos                   set to the file offset
+ *
+ * @return 0 on success, -ERR on failure
+ */
+long aesd_dev_seekto(struct aesd_file *file, unsigned int write_cmd, unsigned int write_cmd_offset, loff_t *pos) {
+    struct aesd_dev *dev = file->dev;
+
+    // check if command exceeds the circular buffer size
+    if (!(write_cmd < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)) {
+        PDEBUG("[AESD] File offset to index %d exceeds command buffer size.", write_cmd);
+        return -EINVAL;
+    }
+
+    // check if command offset exceeds the command
+    aesd_lock(dev);
+    struct aesd_buffer_entry *selected_entry = &dev->circular_buffer.entry[write_cmd];
+    if (!(write_cmd_offset < selected_entry->size)) {
+        aesd_unlock(dev);
+        PDEBUG("[AESD] Command offset to %d exceeds command %d size.", write_cmd_offset, write_cmd);
+        return -EINVAL;
+    }
+
+    // calculate offset
+    struct aesd_buffer_entry *temp;
+    uint8_t index;
+    loff_t calculated_offset = 0;
+    AESD_CIRCULAR_BUFFER_FOREACH(temp, &dev->circular_buffer, index) {
+        if (index < write_cmd) {
+            calculated_offset += temp->size;
+        } else if (index == write_cmd) {
+            calculated_offset += write_cmd_offset;
+            break;
+        }
+    }
+    file->follow_seq = false;
+    aesd_unlock(dev);
+
+    PDEBUG("[AESD] aesd_dev_seekto New Offset: %lld", calculated_offset);
+    *pos = calculated_offset;
+    return 0;
+}
+
+/**
+ * Position a file at a command by its sequence number, following sequence numbers from then on
+ *
+ * @param file                  the file being positioned
+ * @param pos                   its current file position, which reads keep advancing
+ * @param seekseq               the sequence number to seek to, filled in with the device's range
+ *
+ * @return 0 on success, -EPIPE if the command was evicted, -EINVAL if it was not written yet
+ */
+long aesd_dev_seekseq(struct aesd_file *file, loff_t pos, struct aesd_seekseq *seekseq) {
+    struct aesd_dev *dev = file->dev;
+    long retval = 0;
+
+    aesd_lock(dev);
+    if (seekseq->seq > dev->next_seq) {
+        PDEBUG("[AESD] Sequence %llu was not written yet.", (unsigned long long)seekseq->seq);
+        retval = -EINVAL;
+    } else {
+        // an evicted command is an overrun; the file starts at the oldest one instead
+        if (seekseq->seq < dev->first_seq) {
+            file->overruns++;
+            dev->overruns++;
+            seekseq->seq = dev->first_seq;
+            retval = -EPIPE;
+        }
+
+        // the cursor describes the current file position
+        file->follow_seq = true;
+        file->cursor.pos = pos;
+        file->cursor.first_seq = dev->first_seq;
+        file->cursor.seq = seekseq->seq;
+        file->cursor.offset = 0;
+    }
+    seekseq->first_seq = dev->first_seq;
+    seekseq->next_seq = dev->next_seq;
+    seekseq->overruns = file->overruns;
+    aesd_unlock(dev);
+
+    return retval;
+}
+
+/**
+ * Copy every command held, and a header for each, to user space
+ *
+ * @param dev                   the device
+ * @param snapshot              the user buffers, filled in with the sizes of the snapshot
+ *
+ * @return 0 on success, -ENOSPC if a buffer is too small, -EFAULT if a copy fails
+ */
+long aesd_dev_snapshot(struct aesd_dev *dev, struct aesd_snapshot *snapshot) {
+    struct aesd_buffer_entry held[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_snapshot_entry headers[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int count = 0;
+    u64 total_size = 0;
+    long retval = 0;
+
+    // reference every entry in a single pass under the lock; evictions after it only drop the
+    // ring's references, so the snapshot stays whole while it is copied out
+    aesd_lock(dev);
+    for (u64 seq = dev->first_seq; seq < dev->next_seq; seq++) {
+        held[count] = dev->circular_buffer.entry[aesd_seq_index(dev, seq)];
+        aesd_command_get(held[count].buffptr);
+        headers[count].seq = seq;
+        headers[count].size = held[count].size;
+        total_size += held[count].size;
+        count++;
+    }
+    aesd_unlock(dev);
+
+    // copy the headers, then the bytes of each entry back to back
+    if (snapshot->entry_count < count || snapshot->data_size < total_size) {
+        retval = -ENOSPC;
+    } else if (copy_to_user(u64_to_user_ptr(snapshot->entries), headers, count * sizeof(headers[0]))) {
+        retval = -EFAULT;
+    } else {
+        char __user *data = u64_to_user_ptr(snapshot->data);
+        for (unsigned int i = 0; i < count; i++) {
+            if (copy_to_user(data, held[i].buffptr, held[i].size)) {
+                retval = -EFAULT;
+                break;
+            }
+            data += held[i].size;
+        }
+    }
+    snapshot->entry_count = count;
+    snapshot->data_size = total_size;
+
+    // release the snapshot
+    for (unsigned int i = 0; i < count; i++) {
+        aesd_command_put(held[i].buffptr);
+    }
+    return retval;
+}
+
+unsigned long aesd_dev_shrink_count(struct aesd_dev *dev)
+{
+    aesd_lock(dev);
+    unsigned long count = dev->next_seq - dev->first_seq;
+    aesd_unlock(dev);
+    return count;
+}
+
+// drop up to nr_to_scan of the oldest commands, as if evicted by new writes
+unsigned long aesd_dev_shrink(struct aesd_dev *dev, unsigned long nr_to_scan)
+{
+    struct aesd_buffer_entry removed[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned long freed = 0;
+
+    // unlink the oldest entries under the lock, and free them after dropping it
+    aesd_lock(dev);
+    while (freed < nr_to_scan && freed < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED &&
+        aesd_circular_buffer_remove_entry(&dev->circular_buffer, &removed[freed])) {
+        dev->first_seq++;
+        freed++;
+    }
+    aesd_unlock(dev);
+    for (unsigned long i = 0; i < freed; i++) {
+        aesd_command_put(removed[i].buffptr);
+    }
+
+    PDEBUG("[AESD] Shrinker dropped %lu commands.", freed);
+    return freed;
+}
+
+ssize_t aesd_size(struct aesd_circular_buffer *cb)
+{
+    struct aesd_buffer_entry *temp;
+    uint8_t index;
+    ssize_t bytes = 0;
+    AESD_CIRCULAR_BUFFER_FOREACH(temp, cb, index) {
+        bytes += temp->size;
+    }
+    return bytes;
+}
+
+#ifdef AESD_DEBUG
+void aesd_print_cb(struct aesd_circular_buffer *cb)
+{
+    PDEBUG("===== [CIRCULAR BUFFER] =====");
+    struct aesd_buffer_entry *temp;
+    uint8_t index;
+    AESD_CIRCULAR_BUFFER_FOREACH(temp, cb, index) {
+        if (temp->buffptr) {
+            // called under the device lock, so print the entry in place rather than allocating
+            int length = (int)temp->size;
+            if (cb->in_offs == index && cb->out_offs == index) {
+                // in/out pointers are at the same index
+                PDEBUG("[I/O %d] %.*s", index, length, temp->buffptr);
+            } else if (cb->in_offs == index) {
+                // current index is the in pointer
+                PDEBUG("[ I  %d] %.*s", index, length, temp->buffptr);
+            } else if (cb->out_offs == index) {
+                // current index is the out pointer
+                PDEBUG("[ O  %d] %.*s", index, length, temp->buffptr);
+            } else {
+                PDEBUG("[    %d] %.*s", index, length, temp->buffptr);
+            }
+        } else {
+            if (cb->in_offs == index && cb->out_offs == index) {
+                // in/out pointers are at the same index
+                PDEBUG("[I/O %d] (null)", index);
+            } else if (cb->in_offs == index) {
+                // current index is the in pointer
+                PDEBUG("[ I  %d] (null)", index);
+            } else if (cb->out_offs == index) {
+                // current index is the out pointer
+                PDEBUG("[ O  %d] (null)", index);
+            } else {
+                PDEBUG("[    %d] (null)", index);
+            }
+        }
+    }
+    PDEBUG("===== [TOTAL SIZE: %ld] =====", aesd_size(cb));
+}
+#endif
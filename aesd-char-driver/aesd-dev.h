@@ -0,0 +1,157 @@
+/*
+ * aesd-dev.h
+ *
+ *  @brief The aesdchar device core: command assembly, reads, seeks and snapshots of the ring.
+ *  main.c wraps it in file operations; it also builds in userspace (see aesd-userspace.h) so
+ *  aesdchar-bench can drive it from many threads without loading the module.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESD_DEV_H_
+#define AESD_CHAR_DRIVER_AESD_DEV_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/kref.h>
+#include <linux/atomic.h>
+#include <linux/cdev.h>
+#else
+#include "aesd-userspace.h"
+#endif
+
+#include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
+
+#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG_RING 1  //Remove comment on this line to print the ring after every write
+//#define AESD_LOCK_STATS 1  //Remove comment on this line to time how long the device lock is held
+
+#ifdef AESD_NO_DEBUG      /* the userspace benchmark builds without debug output */
+#undef AESD_DEBUG
+#endif
+
+// default for the max_partial_size module parameter: the longest command a file may stage
+#define AESD_MAX_PARTIAL_SIZE (1024 * 1024)
+
+// bytes staged at a time while swallowing the rest of a command over that cap
+#define AESD_DISCARD_CHUNK 512
+
+#undef PDEBUG             /* undef it, just in case */
+#ifdef AESD_DEBUG
+#  ifdef __KERNEL__
+     /* This one if debugging is on, and kernel space */
+#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
+#  else
+     /* This one for user space */
+#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
+#  endif
+#else
+#  define PDEBUG(fmt, args...) /* not debugging: nothing */
+#endif
+
+/*
+ * How long dev->lock has been held, in nanoseconds, collected when AESD_LOCK_STATS is defined.
+ * Updated while the lock is held, and printed when the module is unloaded.
+ */
+struct aesd_lock_stats
+{
+    u64 acquired_ns;                /* when the current holder took the lock */
+    u64 acquisitions;
+    u64 total_ns;
+    u64 max_ns;
+};
+
+/*
+ * The device lock only guards the ring itself: inserting and evicting entries, and looking one
+ * up. Nothing that can sleep or fault runs under it, so it is a spinlock; command buffers are
+ * allocated and filled before it is taken, and readers copy to user space after dropping it.
+ */
+struct aesd_dev
+{
+    struct aesd_circular_buffer circular_buffer;
+    u64 first_seq;                  /* sequence number of the oldest entry, the number evicted so far */
+    u64 next_seq;                   /* sequence number the next command will get */
+    u64 overruns;                   /* reads that found their next command already evicted */
+    atomic_long_t command_bytes;    /* allocated for commands, in the ring or still held by readers */
+    atomic_long_t partial_bytes;    /* allocated for files' staging buffers */
+    spinlock_t lock;
+    struct aesd_lock_stats lock_stats;
+#ifdef __KERNEL__
+    struct cdev cdev;     /* Char device structure      */
+#endif
+};
+
+/*
+ * A published command; entry buffptr points at data. Readers take a reference under the device
+ * lock and copy after releasing it, so a command evicted meanwhile is freed by its last reader.
+ */
+struct aesd_command
+{
+    struct kref ref;
+    struct aesd_dev *dev;           /* device whose accounting it is in */
+    size_t size;                    /* bytes of data, for accounting */
+    char data[];
+};
+
+/*
+ * Where a file's last read stopped, so the next sequential read resumes at that entry instead of
+ * walking the ring from out_offs. It is only trusted while pos is still the file position and,
+ * unless the file follows sequence numbers, no entry has been evicted since; otherwise the read
+ * falls back to a full lookup.
+ */
+struct aesd_cursor
+{
+    loff_t pos;                     /* file position described, -1 when unset */
+    u64 first_seq;                  /* dev->first_seq when it was set */
+    u64 seq;                        /* entry holding pos, dev->next_seq once the ring is read to its end */
+    size_t offset;                  /* offset of pos within that entry */
+};
+
+/*
+ * Per open file state, allocated in aesd_open() and freed in aesd_release().
+ * Each file stages its own partial command, so fragments written through different files never
+ * interleave, and the device lock is only taken to publish a completed command to the ring.
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    struct mutex lock;              /* serializes writers sharing this file */
+    char *partial_buffer;           /* bytes written since the last newline */
+    size_t partial_size;
+    size_t partial_capacity;
+    bool discarding;                /* swallowing a command over the cap, up to and including its newline */
+    struct aesd_cursor cursor;      /* guarded by dev->lock, as reads of one file may race */
+    bool follow_seq;                /* positioned by AESDCHAR_IOCSEEKSEQ, until the next seek */
+    u64 overruns;                   /* times the next command was evicted before it was read */
+};
+
+// device and file state
+void aesd_dev_init(struct aesd_dev *dev);
+void aesd_dev_destroy(struct aesd_dev *dev);
+void aesd_file_init(struct aesd_file *file, struct aesd_dev *dev);
+void aesd_file_destroy(struct aesd_file *file);
+
+// data path
+ssize_t aesd_dev_write(struct aesd_file *file, const char __user *buf, size_t count, size_t max_partial);
+ssize_t aesd_dev_read(struct aesd_file *file, loff_t pos, size_t count, const char **buffptr, size_t *offset,
+    bool report_overrun);
+void aesd_command_put(const char *buffptr);
+
+// seeks and ioctls
+loff_t aesd_dev_size(struct aesd_dev *dev);
+long aesd_dev_seekto(struct aesd_file *file, unsigned int write_cmd, unsigned int write_cmd_offset, loff_t *pos);
+long aesd_dev_seekseq(struct aesd_file *file, loff_t pos, struct aesd_seekseq *seekseq);
+long aesd_dev_snapshot(struct aesd_dev *dev, struct aesd_snapshot *snapshot);
+
+// memory pressure
+unsigned long aesd_dev_shrink_count(struct aesd_dev *dev);
+unsigned long aesd_dev_shrink(struct aesd_dev *dev, unsigned long nr_to_scan);
+
+// debugging, with the device lock held
+ssize_t aesd_size(struct aesd_circular_buffer *cb);
+#ifdef AESD_DEBUG
+void aesd_print_cb(struct aesd_circular_buffer *cb);
+#endif
+
+#endif /* AESD_CHAR_DRIVER_AESD_DEV_H_ */
@@ -0,0 +1,114 @@
+/*
+ * aesd-userspace.h
+ *
+ *  @brief Userspace stand-ins for the kernel APIs used by aesd-dev.c, so the driver core can be
+ *  built and benchmarked as an ordinary program. Locks map to pthreads, allocations to malloc,
+ *  user copies to memcpy and reference counts to C11 atomics.
+ */
+
+#ifndef AESD_USERSPACE_H
+#define AESD_USERSPACE_H
+
+#ifndef __KERNEL__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+typedef uint64_t u64;
+
+#define __user
+#define GFP_KERNEL 0
+
+#define kmalloc(size, flags)            malloc(size)
+#define kzalloc(size, flags)            calloc(1, size)
+#define krealloc(pointer, size, flags)  realloc(pointer, size)
+#define kfree(pointer)                  free((void *)(pointer))
+
+#define READ_ONCE(x)                    (*(volatile __typeof__(x) *)&(x))
+#define min(a, b)                       ((a) < (b) ? (a) : (b))
+#define max(a, b)                       ((a) > (b) ? (a) : (b))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define u64_to_user_ptr(x)              ((void *)(uintptr_t)(x))
+
+// user copies are plain copies, and never fault
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+// error pointers
+#define MAX_ERRNO 4095
+#define ERR_PTR(error)                  ((void *)(intptr_t)(error))
+#define PTR_ERR(pointer)                ((long)(intptr_t)(pointer))
+#define IS_ERR(pointer)                 ((uintptr_t)(pointer) >= (uintptr_t)-MAX_ERRNO)
+
+// locks
+typedef pthread_spinlock_t spinlock_t;
+#define spin_lock_init(lock)            pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(lock)                 pthread_spin_lock(lock)
+#define spin_unlock(lock)               pthread_spin_unlock(lock)
+
+struct mutex
+{
+    pthread_mutex_t mutex;
+};
+#define mutex_init(lock)                pthread_mutex_init(&(lock)->mutex, NULL)
+#define mutex_destroy(lock)             pthread_mutex_destroy(&(lock)->mutex)
+#define mutex_lock_interruptible(lock)  pthread_mutex_lock(&(lock)->mutex)
+#define mutex_unlock(lock)              pthread_mutex_unlock(&(lock)->mutex)
+
+// counters
+typedef _Atomic long atomic_long_t;
+#define atomic_long_read(counter)       atomic_load_explicit(counter, memory_order_relaxed)
+#define atomic_long_add(value, counter) atomic_fetch_add_explicit(counter, value, memory_order_relaxed)
+#define atomic_long_sub(value, counter) atomic_fetch_sub_explicit(counter, value, memory_order_relaxed)
+
+struct kref
+{
+    _Atomic unsigned int refcount;
+};
+
+static inline void kref_init(struct kref *kref)
+{
+    atomic_init(&kref->refcount, 1);
+}
+
+static inline void kref_get(struct kref *kref)
+{
+    atomic_fetch_add_explicit(&kref->refcount, 1, memory_order_relaxed);
+}
+
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *kref))
+{
+    if (atomic_fetch_sub_explicit(&kref->refcount, 1, memory_order_acq_rel) == 1) {
+        release(kref);
+        return 1;
+    }
+    return 0;
+}
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* AESD_USERSPACE_H */
@@ -33,14 +33,91 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * A structure passed by IOCTL to position a file at a command by its sequence number.
+ * Every command written to the device gets the next 64 bit sequence number, starting at 0, and
+ * keeps it until it is evicted. A file positioned this way reads on from command to command
+ * whatever is evicted around it, and its file position no longer means a byte offset.
+ * If the command it was about to read is evicted first, the read fails once with EPIPE, the file
+ * moves on to the oldest command still held, and overruns counts it.
+ */
+struct aesd_seekseq {
+    /**
+     * In: the command to read next, up to next_seq to wait for the next command written.
+     * Out: the command the file now reads next
+     */
+    uint64_t seq;
+    /**
+     * Out: the oldest command still held
+     */
+    uint64_t first_seq;
+    /**
+     * Out: the sequence number the next command written will get
+     */
+    uint64_t next_seq;
+    /**
+     * Out: times this file's next command was evicted before it was read
+     */
+    uint64_t overruns;
+};
+
+/**
+ * The header of one command in a snapshot
+ */
+struct aesd_snapshot_entry {
+    /**
+     * The command's sequence number, as used by AESDCHAR_IOCSEEKSEQ
+     */
+    uint64_t seq;
+    /**
+     * Number of bytes of the command in the snapshot data
+     */
+    uint64_t size;
+};
+
+/**
+ * A structure passed by IOCTL to copy every command held by the device at one instant, oldest
+ * first: their bytes back to back into data, and a header for each into entries
+ */
+struct aesd_snapshot {
+    /**
+     * In: user pointer to the buffer for the commands' bytes
+     */
+    uint64_t data;
+    /**
+     * In: size of the data buffer. Out: bytes of all the commands
+     */
+    uint64_t data_size;
+    /**
+     * In: user pointer to an array of struct aesd_snapshot_entry
+     */
+    uint64_t entries;
+    /**
+     * In: length of the entries array. Out: number of commands
+     */
+    uint32_t entry_count;
+    /**
+     * Must be zero
+     */
+    uint32_t reserved;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+
+// Seek to a command by sequence number; fails with EPIPE if it was already evicted, still filling
+// in the structure and leaving the file at the oldest command
+#define AESDCHAR_IOCSEEKSEQ _IOWR(AESD_IOC_MAGIC, 2, struct aesd_seekseq)
+
+// Copy a consistent snapshot of every command; fails with ENOSPC if either buffer is too small,
+// still filling in the sizes needed
+#define AESDCHAR_IOCSNAPSHOT _IOWR(AESD_IOC_MAGIC, 3, struct aesd_snapshot)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 3
 
 #endif /* AESD_IOCTL_H */
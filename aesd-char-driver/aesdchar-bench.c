@@ -0,0 +1,366 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Drives the aesdchar core (aesd-dev.c) from many threads in userspace, without loading the module
+ *
+ * Writer threads each open their own file and write numbered lines in fragments; reader threads
+ * follow the ring by sequence number, checking every line they get whole. At the end the ring is
+ * snapshotted and checked, and the throughput, device lock hold times and overruns are reported.
+ * Last, the whole history is read back repeatedly from a ring of separately allocated entries and
+ * from an arena buffer holding the same lines, to compare the two storage modes.
+ * Build and run with:
+ *      make bench && ./aesdchar-bench [-w writers] [-r readers] [-n lines] [-l line_length] [-f fragments]
+ *                                     [-H history_rounds]
+ *
+ * @author Jake Uyechi
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "aesd-dev.h"
+
+#define BENCH_WRITERS               4
+#define BENCH_READERS               2
+#define BENCH_LINES                 100000
+#define BENCH_LINE_LENGTH           64
+#define BENCH_FRAGMENTS             1
+#define BENCH_MAX_WRITERS           1000
+#define BENCH_READ_SIZE             4096
+#define BENCH_HISTORY_ROUNDS        200000
+
+// shared by every thread
+static struct aesd_dev device;
+static int line_length = BENCH_LINE_LENGTH;
+static int fragments = BENCH_FRAGMENTS;
+static long lines = BENCH_LINES;
+static atomic_int writers_running;
+
+// what each reader saw
+struct bench_reader
+{
+    pthread_t thread;
+    u64 bytes;
+    u64 lines;
+    u64 overruns;
+    u64 bad_lines;
+};
+
+static double now_seconds(void)
+{
+    return ktime_get_ns() / 1e9;
+}
+
+// fill in line number of a writer: "w<writer> <number> " padded with a letter picked by both
+static void bench_line(char *line, int writer, long number)
+{
+    int length = snprintf(line, line_length, "w%03d %010ld ", writer, number);
+    memset(line + length, 'a' + (writer + number) % 26, line_length - 1 - length);
+    line[line_length - 1] = '\n';
+}
+
+// check a line is one bench_line() wrote, and that each writer's lines arrive in order
+static bool bench_check_line(const char *line, size_t size, long *last_numbers)
+{
+    int writer;
+    long number;
+    char expected[BENCH_LINE_LENGTH * 64];
+    if (size != (size_t)line_length || sscanf(line, "w%d %ld ", &writer, &number) != 2) return false;
+    if (writer < 0 || writer >= BENCH_MAX_WRITERS) return false;
+    bench_line(expected, writer, number);
+    if (memcmp(line, expected, size) != 0) return false;
+    if (last_numbers) {
+        if (number <= last_numbers[writer]) return false;
+        last_numbers[writer] = number;
+    }
+    return true;
+}
+
+static void *bench_writer(void *arg)
+{
+    int writer = (int)(long)arg;
+    struct aesd_file file;
+    char line[BENCH_LINE_LENGTH * 64];
+    aesd_file_init(&file, &device);
+
+    // write every line in fragments, so commands are assembled across writes
+    for (long number = 0; number < lines; number++) {
+        bench_line(line, writer, number);
+        int written = 0;
+        for (int i = 0; i < fragments; i++) {
+            int size = (i == fragments - 1) ? line_length - written : line_length / fragments;
+            if (aesd_dev_write(&file, line + written, size, AESD_MAX_PARTIAL_SIZE) != size) {
+                printf("writer %d: write of line %ld failed\n", writer, number);
+                exit(1);
+            }
+            written += size;
+        }
+    }
+
+    aesd_file_destroy(&file);
+    atomic_fetch_sub(&writers_running, 1);
+    return NULL;
+}
+
+static void *bench_reader(void *arg)
+{
+    struct bench_reader *reader = (struct bench_reader *)arg;
+    struct aesd_file file;
+    long *last_numbers = calloc(BENCH_MAX_WRITERS, sizeof(long));
+    char line[BENCH_LINE_LENGTH * 64];
+    size_t line_size = 0;
+    loff_t pos = 0;
+    aesd_file_init(&file, &device);
+    for (int i = 0; i < BENCH_MAX_WRITERS; i++) last_numbers[i] = -1;
+
+    // follow sequence numbers from the oldest command, as a tail of the device would
+    struct aesd_seekseq seekseq = { .seq = 0 };
+    aesd_dev_seekseq(&file, pos, &seekseq);
+    while (true) {
+        bool done = atomic_load(&writers_running) == 0;
+        const char *buffptr;
+        size_t offset;
+        ssize_t size = aesd_dev_read(&file, pos, BENCH_READ_SIZE, &buffptr, &offset, true);
+        if (size == -EPIPE) {
+            // evicted before it was read; the partial line is lost, and reading goes on at the oldest
+            reader->overruns++;
+            line_size = 0;
+            continue;
+        }
+        if (size == 0) {
+            // caught up; stop once the writers have finished and everything they wrote was read
+            if (done) break;
+            sched_yield();
+            continue;
+        }
+
+        // reads stop at the end of each command, so a line is whole once it ends with its newline
+        bool fits = line_size + size <= sizeof(line);
+        if (fits) memcpy(line + line_size, buffptr + offset, size);
+        aesd_command_put(buffptr);
+        pos += size;
+        reader->bytes += size;
+        if (!fits) {
+            reader->bad_lines++;
+            line_size = 0;
+            continue;
+        }
+        line_size += size;
+        if (line[line_size - 1] == '\n') {
+            if (!bench_check_line(line, line_size, last_numbers)) reader->bad_lines++;
+            reader->lines++;
+            line_size = 0;
+        }
+    }
+
+    aesd_file_destroy(&file);
+    free(last_numbers);
+    return NULL;
+}
+
+// snapshot the ring once everything is written, and check each command
+static int bench_check_snapshot(void)
+{
+    char data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * BENCH_LINE_LENGTH * 64];
+    struct aesd_snapshot_entry entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_snapshot snapshot = {
+        .data = (u64)(uintptr_t)data,
+        .data_size = sizeof(data),
+        .entries = (u64)(uintptr_t)entries,
+        .entry_count = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+    };
+    if (aesd_dev_snapshot(&device, &snapshot) != 0) {
+        printf("snapshot failed\n");
+        return 1;
+    }
+
+    u64 total = device.next_seq;
+    u64 expected = total < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ? total : AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (snapshot.entry_count != expected) {
+        printf("snapshot holds %u commands, expected %llu\n", snapshot.entry_count, (unsigned long long)expected);
+        return 1;
+    }
+    const char *line = data;
+    for (unsigned int i = 0; i < snapshot.entry_count; i++) {
+        if (entries[i].seq != total - snapshot.entry_count + i || !bench_check_line(line, entries[i].size, NULL)) {
+            printf("snapshot command %u (seq %llu) is wrong\n", i, (unsigned long long)entries[i].seq);
+            return 1;
+        }
+        line += entries[i].size;
+    }
+    return 0;
+}
+
+// read the whole history from entries pointing at their own allocations, and from an arena
+static int bench_history(long rounds)
+{
+    struct aesd_circular_buffer ring;
+    struct aesd_arena_buffer arena_buffer;
+    // room for every entry and half a line more, so entries wrap around the end of the arena
+    size_t capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * line_length + line_length / 2;
+    char *arena = malloc(capacity);
+    char *ring_copy = malloc(capacity);
+    char *arena_copy = malloc(capacity);
+    char line[BENCH_LINE_LENGTH * 64];
+    aesd_circular_buffer_init(&ring);
+    aesd_arena_buffer_init(&arena_buffer, arena, capacity);
+
+    // the same lines into both, more than either holds
+    for (long number = 0; number < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 3 + 3; number++) {
+        bench_line(line, 0, number);
+        struct aesd_buffer_entry entry = { .buffptr = malloc(line_length), .size = line_length };
+        memcpy((char *)entry.buffptr, line, line_length);
+        free((char *)aesd_circular_buffer_add_entry(&ring, &entry));
+        aesd_arena_buffer_add_entry(&arena_buffer, line, line_length);
+    }
+
+    // entry by entry, as the driver reads
+    size_t size = 0;
+    double start = now_seconds();
+    for (long round = 0; round < rounds; round++) {
+        size_t offset;
+        struct aesd_buffer_entry *entry;
+        size = 0;
+        while ((entry = aesd_circular_buffer_find_entry_offset_for_fpos(&ring, size, &offset))) {
+            memcpy(ring_copy + size, entry->buffptr + offset, entry->size - offset);
+            size += entry->size - offset;
+        }
+    }
+    double ring_seconds = now_seconds() - start;
+
+    // in one read of the arena
+    start = now_seconds();
+    for (long round = 0; round < rounds; round++) {
+        aesd_arena_buffer_read(&arena_buffer, 0, arena_copy, capacity);
+    }
+    double arena_seconds = now_seconds() - start;
+
+    printf("history: %zu bytes, %.0f MB/s from entries, %.0f MB/s from an arena\n", size,
+        (double)size * rounds / ring_seconds / 1e6, (double)size * rounds / arena_seconds / 1e6);
+    int failed = 0;
+    if (size != arena_buffer.used || memcmp(ring_copy, arena_copy, size) != 0) {
+        printf("history read from the arena differs\n");
+        failed = 1;
+    }
+
+    // cleanup
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring, index) {
+        free((char *)entry->buffptr);
+    }
+    free(arena);
+    free(ring_copy);
+    free(arena_copy);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    int writers = BENCH_WRITERS;
+    int readers = BENCH_READERS;
+    long history_rounds = BENCH_HISTORY_ROUNDS;
+    int c;
+    while ((c = getopt(argc, argv, "w:r:n:l:f:H:h")) != -1) {
+        switch (c) {
+            case 'w':
+                writers = atoi(optarg);
+                break;
+            case 'r':
+                readers = atoi(optarg);
+                break;
+            case 'n':
+                lines = atol(optarg);
+                break;
+            case 'l':
+                line_length = atoi(optarg);
+                break;
+            case 'f':
+                fragments = atoi(optarg);
+                break;
+            case 'H':
+                history_rounds = atol(optarg);
+                break;
+            default:
+                printf("Usage: %s [-w writers] [-r readers] [-n lines] [-l line_length] [-f fragments] "
+                    "[-H history_rounds]\n", argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (writers < 1 || writers > BENCH_MAX_WRITERS || readers < 0 || lines < 1 ||
+        line_length < 20 || line_length > BENCH_LINE_LENGTH * 64 || fragments < 1 || fragments > line_length) {
+        printf("Invalid arguments\n");
+        return 1;
+    }
+
+    aesd_dev_init(&device);
+    pthread_t *writer_threads = calloc(writers, sizeof(pthread_t));
+    struct bench_reader *reader_threads = calloc(readers ? readers : 1, sizeof(struct bench_reader));
+
+    // readers first, so they are following the ring when the first lines arrive
+    atomic_store(&writers_running, writers);
+    double start = now_seconds();
+    for (int i = 0; i < readers; i++) {
+        pthread_create(&reader_threads[i].thread, NULL, bench_reader, &reader_threads[i]);
+    }
+    for (int i = 0; i < writers; i++) {
+        pthread_create(&writer_threads[i], NULL, bench_writer, (void *)(long)i);
+    }
+    for (int i = 0; i < writers; i++) {
+        pthread_join(writer_threads[i], NULL);
+    }
+    double write_seconds = now_seconds() - start;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(reader_threads[i].thread, NULL);
+    }
+    double read_seconds = now_seconds() - start;
+
+    // report
+    u64 total_lines = (u64)writers * lines;
+    printf("%d writers x %ld lines of %d bytes in %d fragments, %d readers\n", writers, lines, line_length,
+        fragments, readers);
+    printf("writes:  %.0f lines/s, %.1f MB/s\n", total_lines / write_seconds,
+        total_lines * line_length / write_seconds / 1e6);
+    int failed = 0;
+    for (int i = 0; i < readers; i++) {
+        struct bench_reader *reader = &reader_threads[i];
+        printf("reader %d: %.1f MB/s, %llu lines, %llu overruns, %llu bad lines\n", i, reader->bytes / read_seconds / 1e6,
+            (unsigned long long)reader->lines, (unsigned long long)reader->overruns,
+            (unsigned long long)reader->bad_lines);
+        if (reader->bad_lines) failed = 1;
+    }
+#ifdef AESD_LOCK_STATS
+    struct aesd_lock_stats *stats = &device.lock_stats;
+    printf("lock:    held %llu times, %llu ns average, %llu ns max\n", (unsigned long long)stats->acquisitions,
+        (unsigned long long)(stats->acquisitions ? stats->total_ns / stats->acquisitions : 0),
+        (unsigned long long)stats->max_ns);
+#endif
+    printf("device:  %llu commands, %llu overruns\n", (unsigned long long)device.next_seq,
+        (unsigned long long)device.overruns);
+
+    // everything written must be in order, and nothing may be left allocated once freed
+    if (device.next_seq != total_lines) {
+        printf("device numbered %llu commands, expected %llu\n", (unsigned long long)device.next_seq,
+            (unsigned long long)total_lines);
+        failed = 1;
+    }
+    failed |= bench_check_snapshot();
+    aesd_dev_destroy(&device);
+    if (atomic_long_read(&device.command_bytes) != 0 || atomic_long_read(&device.partial_bytes) != 0) {
+        printf("leaked %ld command bytes, %ld partial bytes\n", atomic_long_read(&device.command_bytes),
+            atomic_long_read(&device.partial_bytes));
+        failed = 1;
+    }
+
+    // the two storage modes of the circular buffer
+    if (history_rounds > 0) failed |= bench_history(history_rounds);
+
+    free(writer_threads);
+    free(reader_threads);
+    return failed;
+}
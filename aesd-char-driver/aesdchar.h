@@ -8,46 +8,18 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#include <linux/mutex.h>
-
-#include "aesd-circular-buffer.h"
-
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
-
-#undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
-     /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
-#else
-#  define PDEBUG(fmt, args...) /* not debugging: nothing */
-#endif
-
-struct aesd_dev
-{
-    struct aesd_circular_buffer circular_buffer;
-    char *incomplete_command_buffer;
-    size_t incomplete_command_size;
-    struct mutex lock;
-    struct cdev cdev;     /* Char device structure      */
-};
+#include "aesd-dev.h"
 
 // driver file operations prototypes
 int aesd_open(struct inode *inode, struct file *filp);
 int aesd_release(struct inode *inode, struct file *filp);
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to);
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence);
 long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 static int aesd_setup_cdev(struct aesd_dev *dev);
 int aesd_init_module(void);
 void aesd_cleanup_module(void);
-ssize_t aesd_size(struct aesd_circular_buffer *cb);
-void aesd_print_cb(struct aesd_circular_buffer *cb);
 
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -17,6 +17,16 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/err.h>
+#include <linux/kernel.h> // u64_to_user_ptr
+#include <linux/moduleparam.h>
+#include <linux/shrinker.h>
+#include <linux/sysfs.h>
 
 // AESD-specific includes
 #include "aesdchar.h"
@@ -32,9 +42,33 @@ MODULE_LICENSE("Dual BSD/GPL");
 // global structs
 struct aesd_dev aesd_device;
 
+// module parameters, under /sys/module/aesdchar/parameters
+static unsigned long max_partial_size = AESD_MAX_PARTIAL_SIZE;
+module_param(max_partial_size, ulong, 0644);
+MODULE_PARM_DESC(max_partial_size, "Longest command a file may stage before its newline, 0 for no limit");
+
+static int aesd_param_get_bytes(char *buffer, const struct kernel_param *kp)
+{
+    return sysfs_emit(buffer, "%ld\n", atomic_long_read((atomic_long_t *)kp->arg));
+}
+
+static const struct kernel_param_ops aesd_param_bytes_ops = {
+    .get = aesd_param_get_bytes,
+};
+
+module_param_cb(command_bytes, &aesd_param_bytes_ops, &aesd_device.command_bytes, 0444);
+MODULE_PARM_DESC(command_bytes, "Bytes held by published commands");
+module_param_cb(partial_bytes, &aesd_param_bytes_ops, &aesd_device.partial_bytes, 0444);
+MODULE_PARM_DESC(partial_bytes, "Bytes held by partial commands staged by open files");
+
 struct file_operations aesd_fops = {
     .owner =            THIS_MODULE,
-    .read =             aesd_read,
+    .read_iter =        aesd_read_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read =      copy_splice_read,
+#else
+    .splice_read =      generic_file_splice_read,
+#endif
     .write =            aesd_write,
     .open =             aesd_open,
     .release =          aesd_release,
@@ -47,10 +81,11 @@ int aesd_open(struct inode *inode, struct file *filp)
 {
     PDEBUG("[AESD] open");
 
-    // add aesd_dev struct to filp private data
-    struct aesd_dev *dev;
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    // allocate the file's own state, pointing back at the device
+    struct aesd_file *file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (file == NULL) return -ENOMEM;
+    aesd_file_init(file, container_of(inode->i_cdev, struct aesd_dev, cdev));
+    filp->private_data = file;
     filp->f_pos = 0;
 
     // return
@@ -62,56 +97,57 @@ int aesd_release(struct inode *inode, struct file *filp)
 {
     PDEBUG("[AESD] release");
     
+    // a partial command left by this file is dropped with it
+    struct aesd_file *file = (struct aesd_file *)filp->private_data;
+    aesd_file_destroy(file);
+    kfree(file);
+
     // set the private_data to NULL
     filp->private_data = NULL;
 
     return 0;
 }
 
-// read data from circular buffer to user
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+// read data from circular buffer into an iterator; read(), readv() and splice() all end up here,
+// the last through the generic splice helper copying straight from the ring into pipe pages
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     ssize_t retval = 0;
-    PDEBUG("[AESD] read %zu bytes with offset %lld",count,*f_pos);
+    PDEBUG("[AESD] read %zu bytes with offset %lld", iov_iter_count(to), iocb->ki_pos);
 
-    // check if the read requests 0 bytes, return early if needed
-    if (count == 0) return 0;
-    
     // retrieve driver data from filp
-    struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-
-    // lock mutex
-    if (mutex_lock_interruptible(&dev->lock)) return -EINTR;
-
-    // start retrieving data; call find_entry_offset function to retrieve the data needed from the circular buffer
-    size_t offset;
-    struct aesd_buffer_entry *read_entry = 
-        aesd_circular_buffer_find_entry_offset_for_fpos(&dev->circular_buffer, *f_pos, &offset);
-    if (read_entry == NULL || read_entry->buffptr == NULL) {
-        // entry data is missing; return 0
-        retval = 0;
-        goto cleanup;
-    }
-    
-    // determine the read size based on the entry size at the offset and the count limit
-    size_t read_size = min(count, read_entry->size - offset);
-
-    // copy to user, limited by the read_size
-    // this copy should start at the entry returned from the find_offset function, plus the offset within that entry
-    if (copy_to_user(buf, read_entry->buffptr + offset, read_size)) {
-        retval = -EFAULT;
-        goto cleanup;
-    }
-
-    // update the f_pos argument with the new read pointer
-    *f_pos += read_size;
+    struct aesd_file *file = (struct aesd_file *)iocb->ki_filp->private_data;
+
+    // fill the iterator entry by entry, until it is full or the ring runs out
+    while (iov_iter_count(to) > 0) {
+        // find the bytes at the position, referenced so they can be copied without the lock; an
+        // overrun is only reported by a read that has copied nothing yet
+        const char *read_buffer;
+        size_t offset;
+        ssize_t read_size = aesd_dev_read(file, iocb->ki_pos, iov_iter_count(to), &read_buffer, &offset,
+            retval == 0);
+        if (read_size < 0) {
+            retval = read_size;
+            break;
+        }
+        if (read_size == 0) {
+            // no more data
+            break;
+        }
 
-    // set return value equal to the read size
-    retval = read_size;
+        // copy the rest of the entry, or as much as fits
+        size_t copied = copy_to_iter(read_buffer + offset, read_size, to);
+        aesd_command_put(read_buffer);
+        iocb->ki_pos += copied;
+        retval += copied;
+        if (copied < read_size) {
+            // a fault part way through returns what was copied so far
+            if (retval == 0 && iov_iter_count(to) > 0) retval = -EFAULT;
+            break;
+        }
+    }
 
-cleanup:
-    mutex_unlock(&dev->lock);
+    // return
     return retval;
 }
 
@@ -119,101 +155,14 @@ cleanup:
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
                 loff_t *f_pos)
 {
-    ssize_t retval = -ENOMEM;
+    ssize_t retval;
     PDEBUG("[AESD] write %zu bytes with offset %lld",count,*f_pos);
     
-    // get the device struct from file pointer
-    struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
+    // stage the data in the file's own buffer, publishing each command it completes
+    struct aesd_file *file = (struct aesd_file *)filp->private_data;
+    retval = aesd_dev_write(file, buf, count, READ_ONCE(max_partial_size));
 
-    // lock device mutex
-    if (mutex_lock_interruptible(&dev->lock)) return -EINTR;
-
-    // kmalloc a new buffer for userspace data
-    size_t total_size = dev->incomplete_command_size + count;
-    char *to_write = kmalloc(total_size, GFP_KERNEL);
-
-    // copy the existing buffer
-    if (dev->incomplete_command_buffer != NULL) {
-        memcpy(to_write, dev->incomplete_command_buffer, dev->incomplete_command_size);
-        kfree(dev->incomplete_command_buffer);
-    }
-
-    // copy the incoming buffer from userspace
-    if (copy_from_user(to_write + dev->incomplete_command_size, buf, count)) {
-        retval = -EFAULT;
-        kfree(to_write);
-        goto cleanup;
-    }
-
-    // free the old buffer in the device struct and point it to the new buffer
-    dev->incomplete_command_buffer = to_write;
-    dev->incomplete_command_size = total_size;
-    
-    // check if there's a newline to process
-    char *cmd_break;
-    char *cmd_start = dev->incomplete_command_buffer;
-    size_t read_size = total_size;
-    while ((cmd_break = memchr(cmd_start, '\n', read_size))) {
-        // there is a newline, and cmd_break points to it
-
-        // create a new sub command for everything before the first break
-        size_t subcmd_size = (cmd_break - dev->incomplete_command_buffer) + 1;
-        char *subcmd = kmalloc(subcmd_size, GFP_KERNEL);
-        memcpy(subcmd, cmd_start, subcmd_size);
-
-        // create a new entry struct and copy the sub command to it, freeing it after copying
-        struct aesd_buffer_entry to_add;
-        to_add.size = subcmd_size;
-        to_add.buffptr = kmalloc(subcmd_size, GFP_KERNEL);
-        if (to_add.buffptr == NULL) {
-            retval = -ENOMEM;
-            kfree(subcmd);
-            goto cleanup;
-        }
-        memcpy((void *)to_add.buffptr, subcmd, subcmd_size);
-        kfree(subcmd);
-
-        // add the new entry, capturing the old one 
-        const char *to_free = aesd_circular_buffer_add_entry(&dev->circular_buffer, &to_add);
-        if (to_free) {
-            kfree(to_free);
-        }
-
-        // update the cmd_start and read_size pointers
-        cmd_start = cmd_break + 1;
-        read_size -= (subcmd_size > read_size) ? read_size : subcmd_size;
-    }
-
-    // check if there's an excess command
-    if (cmd_start < dev->incomplete_command_buffer + total_size) {
-        // create a buffer for excess command
-        size_t remaining_size = dev->incomplete_command_buffer + total_size - cmd_start;
-        char *remaining = kmalloc(remaining_size, GFP_KERNEL);
-        if (remaining == NULL) {
-            retval = -ENOMEM;
-            goto cleanup;
-        }
-        memcpy(remaining, cmd_start, remaining_size);
-
-        // free the old buffer
-        kfree(dev->incomplete_command_buffer);
-        dev->incomplete_command_buffer = remaining;
-        dev->incomplete_command_size = remaining_size;
-    } else {
-        // no excess command, set the incomplete buffer to NULL and size to 0
-        kfree(dev->incomplete_command_buffer);
-        dev->incomplete_command_buffer = NULL;
-        dev->incomplete_command_size = 0;
-    }
-
-    // set the return value to count
-    retval = count;
-
-    // debug print
-    aesd_print_cb(&dev->circular_buffer);
-
-cleanup:
-    mutex_unlock(&dev->lock);
+    // return
     return retval;
 }
 
@@ -223,8 +172,8 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence) {
     int retval;
 
     // get the device struct from file pointer
-    struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-    loff_t cb_size = (loff_t)aesd_size(&dev->circular_buffer);
+    struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+    loff_t cb_size = aesd_dev_size(dev);
 
     // use the fixed_size_llseek, immediately returning the result of the function
     mutex_lock(&filp->f_pos_lock);
@@ -235,56 +184,6 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence) {
     return retval;
 }
 
-/**
- * Adjust f_pos of the file based on the location of the write command and offset
- * 
- * @param filp                  file pointer
- * @param write_cmd             the index of the write command to seek to
- * @param write_cmd_offset      the offset within write_cmd to seek to
- * 
- * @return 0 on success, -ERR on failure
- */
-static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset) {
-    // get private data from device
-    struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-    
-    // check if command exceeds the circular buffer size
-    if (!(write_cmd < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)) {
-        PDEBUG("[AESD] File offset to index %d exceeds command buffer size.", write_cmd);
-        return -EINVAL;
-    }
-
-    // check if command offset exceeds the command
-    struct aesd_buffer_entry *selected_entry = &dev->circular_buffer.entry[write_cmd];
-    if (!(write_cmd_offset < selected_entry->size)) {
-        PDEBUG("[AESD] Command offset to %d in '%s' exceeds command size.",
-            write_cmd_offset, selected_entry->buffptr);
-        return -EINVAL;
-    }
-
-    // calculate offset
-    struct aesd_buffer_entry *temp;
-    uint8_t index;
-    loff_t calculated_offset = 0;
-    AESD_CIRCULAR_BUFFER_FOREACH(temp, &aesd_device.circular_buffer, index) {
-        if (index < write_cmd) {
-            calculated_offset += temp->size;
-        } else if (index == write_cmd) {
-            calculated_offset += write_cmd_offset;
-            break;
-        }
-    }
-
-    PDEBUG("[AESD] aesd_adjust_file_offset New Offset: %lld", calculated_offset);
-
-    // valid command offset, update f_pos with calculated offset
-    mutex_lock(&filp->f_pos_lock);
-    filp->f_pos = calculated_offset;
-    mutex_unlock(&filp->f_pos_lock);
-
-    return 0;
-}
-
 long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
     // define a return value for all ioctls 
     long retval = -ENOTTY;
@@ -294,11 +193,48 @@ long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         case AESDCHAR_IOCSEEKTO:
             PDEBUG("[AESD] Received ioctl, cmd: AESDCHAR_IOCSEEKTO.");
             struct aesd_seekto seekto;
-            if (copy_from_user(&seekto, (const void __user *)arg, sizeof(seekto)) == 0) {
-                retval = aesd_adjust_file_offset(filp, seekto.write_cmd, seekto.write_cmd_offset);
-            } else {
-                retval = EFAULT;
+            loff_t pos;
+            if (copy_from_user(&seekto, (const void __user *)arg, sizeof(seekto))) {
+                retval = -EFAULT;
+                break;
+            }
+            retval = aesd_dev_seekto((struct aesd_file *)filp->private_data, seekto.write_cmd,
+                seekto.write_cmd_offset, &pos);
+
+            // valid command offset, update f_pos with calculated offset
+            if (retval == 0) {
+                mutex_lock(&filp->f_pos_lock);
+                filp->f_pos = pos;
+                mutex_unlock(&filp->f_pos_lock);
+            }
+            break;
+        case AESDCHAR_IOCSEEKSEQ:
+            PDEBUG("[AESD] Received ioctl, cmd: AESDCHAR_IOCSEEKSEQ.");
+            struct aesd_seekseq seekseq;
+            if (copy_from_user(&seekseq, (const void __user *)arg, sizeof(seekseq))) {
+                retval = -EFAULT;
+                break;
+            }
+            retval = aesd_dev_seekseq((struct aesd_file *)filp->private_data, filp->f_pos, &seekseq);
+
+            // the range is reported on failure too, so a caller that was overrun learns where to resume
+            if (copy_to_user((void __user *)arg, &seekseq, sizeof(seekseq))) retval = -EFAULT;
+            break;
+        case AESDCHAR_IOCSNAPSHOT:
+            PDEBUG("[AESD] Received ioctl, cmd: AESDCHAR_IOCSNAPSHOT.");
+            struct aesd_snapshot snapshot;
+            if (copy_from_user(&snapshot, (const void __user *)arg, sizeof(snapshot))) {
+                retval = -EFAULT;
+                break;
             }
+            if (snapshot.reserved != 0) {
+                retval = -EINVAL;
+                break;
+            }
+            retval = aesd_dev_snapshot(((struct aesd_file *)filp->private_data)->dev, &snapshot);
+
+            // the sizes are reported on failure too, so a caller can size its buffers and retry
+            if (copy_to_user((void __user *)arg, &snapshot, sizeof(snapshot))) retval = -EFAULT;
             break;
     }
 
@@ -308,6 +244,54 @@ long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     return retval;
 }
 
+// shrinker: under memory pressure the oldest commands are dropped, as if evicted by new writes
+static unsigned long aesd_shrink_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+    unsigned long count = aesd_dev_shrink_count(&aesd_device);
+    return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long aesd_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+    unsigned long freed = aesd_dev_shrink(&aesd_device, sc->nr_to_scan);
+    return freed ? freed : SHRINK_STOP;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *aesd_shrinker;
+#else
+static struct shrinker aesd_shrinker = {
+    .count_objects =    aesd_shrink_count,
+    .scan_objects =     aesd_shrink_scan,
+    .seeks =            DEFAULT_SEEKS,
+};
+#endif
+
+static int aesd_register_shrinker(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    aesd_shrinker = shrinker_alloc(0, "aesdchar");
+    if (aesd_shrinker == NULL) return -ENOMEM;
+    aesd_shrinker->count_objects = aesd_shrink_count;
+    aesd_shrinker->scan_objects = aesd_shrink_scan;
+    shrinker_register(aesd_shrinker);
+    return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    return register_shrinker(&aesd_shrinker, "aesdchar");
+#else
+    return register_shrinker(&aesd_shrinker);
+#endif
+}
+
+static void aesd_unregister_shrinker(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    shrinker_free(aesd_shrinker);
+#else
+    unregister_shrinker(&aesd_shrinker);
+#endif
+}
+
 // module setup cdev
 static int aesd_setup_cdev(struct aesd_dev *dev)
 {
@@ -339,21 +323,20 @@ int aesd_init_module(void)
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
-
-    // initialize device mutex
-    mutex_init(&aesd_device.lock);
+    aesd_dev_init(&aesd_device);
 
-    // initialize circular buffer inside device
-    aesd_circular_buffer_init(&aesd_device.circular_buffer);
-
-    // initialize the incomplete command buffer
-    aesd_device.incomplete_command_buffer = NULL;
-    aesd_device.incomplete_command_size = 0;
+    // let memory pressure reclaim the oldest commands
+    result = aesd_register_shrinker();
+    if (result) {
+        printk(KERN_WARNING "Can't register shrinker\n");
+        unregister_chrdev_region(dev, 1);
+        return result;
+    }
 
     result = aesd_setup_cdev(&aesd_device);
 
     if( result ) {
+        aesd_unregister_shrinker();
         unregister_chrdev_region(dev, 1);
     }
     return result;
@@ -366,83 +349,24 @@ void aesd_cleanup_module(void)
     
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-    // clear the incomplete command buffer
-    if (aesd_device.incomplete_command_buffer) {
-        kfree(aesd_device.incomplete_command_buffer);
-        aesd_device.incomplete_command_buffer = NULL;
-        aesd_device.incomplete_command_size = 0;
-    }
+    // stop reclaim before the entries it would drop are freed here
+    aesd_unregister_shrinker();
 
     // free each of the individual entries in the circular buffer
-    struct aesd_buffer_entry *temp;
-    uint8_t index;
-    AESD_CIRCULAR_BUFFER_FOREACH(temp, &aesd_device.circular_buffer, index) {
-        if (temp->buffptr) {
-            kfree(temp->buffptr);
-            temp->buffptr = NULL;
-        }
-    }
+    aesd_dev_destroy(&aesd_device);
 
-    // destroy mutex
-    mutex_destroy(&aesd_device.lock);
+#ifdef AESD_LOCK_STATS
+    // report how long the device lock was held
+    struct aesd_lock_stats *stats = &aesd_device.lock_stats;
+    printk(KERN_INFO "aesdchar: lock held %llu times, %llu ns average, %llu ns max\n",
+        stats->acquisitions, stats->acquisitions ? div64_u64(stats->total_ns, stats->acquisitions) : 0,
+        stats->max_ns);
+#endif
 
     cdev_del(&aesd_device.cdev);
 
     unregister_chrdev_region(devno, 1);
 }
 
-ssize_t aesd_size(struct aesd_circular_buffer *cb)
-{
-    struct aesd_buffer_entry *temp;
-    uint8_t index;
-    ssize_t bytes = 0;
-    AESD_CIRCULAR_BUFFER_FOREACH(temp, &aesd_device.circular_buffer, index) {
-        bytes += temp->size;
-    }
-    return bytes;
-}
-
-void aesd_print_cb(struct aesd_circular_buffer *cb)
-{
-    PDEBUG("===== [CIRCULAR BUFFER] =====");
-    struct aesd_buffer_entry *temp;
-    uint8_t index;
-    AESD_CIRCULAR_BUFFER_FOREACH(temp, &aesd_device.circular_buffer, index) {
-        if (temp->buffptr) {
-            char *printbuf = kmalloc(temp->size + 1, GFP_KERNEL);
-            memcpy(printbuf, temp->buffptr, temp->size);
-            printbuf[temp->size] = '\0';
-
-            if (cb->in_offs == index && cb->out_offs == index) {
-                // in/out pointers are at the same index
-                PDEBUG("[I/O %d] %s", index, printbuf);
-            } else if (cb->in_offs == index) {
-                // current index is the in pointer
-                PDEBUG("[ I  %d] %s", index, printbuf);
-            } else if (cb->out_offs == index) {
-                // current index is the out pointer
-                PDEBUG("[ O  %d] %s", index, printbuf);
-            } else {
-                PDEBUG("[    %d] %s", index, printbuf);
-            }
-            kfree(printbuf);
-        } else {
-            if (cb->in_offs == index && cb->out_offs == index) {
-                // in/out pointers are at the same index
-                PDEBUG("[I/O %d] (null)", index);
-            } else if (cb->in_offs == index) {
-                // current index is the in pointer
-                PDEBUG("[ I  %d] (null)", index);
-            } else if (cb->out_offs == index) {
-                // current index is the out pointer
-                PDEBUG("[ O  %d] (null)", index);
-            } else {
-                PDEBUG("[    %d] (null)", index);
-            }
-        }
-    }
-    PDEBUG("===== [TOTAL SIZE: %ld] =====", aesd_size(cb));
-}
-
 module_init(aesd_init_module);
 module_exit(aesd_cleanup_module);
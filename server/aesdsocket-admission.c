@@ -0,0 +1,197 @@
+#include "aesdsocket-admission.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+// rate state of one client address
+struct admission_client_t {
+    uint8_t                         address[16];        // IPv4 or IPv6 address bytes
+    size_t                          address_length;     // 4 or 16
+    size_t                          stripe;             // address table bucket
+    size_t                          references;         // connections from the address, under the bucket lock
+    pthread_mutex_t                 lock;               // guards the token bucket
+    double                          tokens;             // bytes that may be received now, negative in debt
+    uint64_t                        refill_ns;          // when tokens were last refilled
+    admission_client_t *            next;               // next address in the bucket
+};
+
+// limits; written on configuration, read on every accept and recv
+static _Atomic int max_connections;
+static _Atomic size_t max_inflight_bytes;
+static _Atomic uint64_t rate_limit;
+static _Atomic uint64_t rate_burst;
+
+// usage
+static _Atomic int connections;
+static _Atomic size_t inflight_bytes;
+
+// addresses with open connections, hashed into buckets
+static struct {
+    pthread_mutex_t                 lock;
+    admission_client_t *            clients;
+} stripes[ADMISSION_STRIPES] = {
+    [0 ... ADMISSION_STRIPES - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL },
+};
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static size_t address_key(const struct sockaddr *address, uint8_t key[16]) {
+    // IPv4 clients of a dual-stack socket arrive as mapped IPv6 addresses; key them as IPv4
+    if (address->sa_family == AF_INET6) {
+        const struct in6_addr *address6 = &((const struct sockaddr_in6 *)address)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(address6)) {
+            memcpy(key, &address6->s6_addr[12], 4);
+            return 4;
+        }
+        memcpy(key, address6->s6_addr, 16);
+        return 16;
+    }
+    if (address->sa_family == AF_INET) {
+        memcpy(key, &((const struct sockaddr_in *)address)->sin_addr, 4);
+        return 4;
+    }
+    return 0;
+}
+
+static size_t address_stripe(const uint8_t *key, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+    return hash % ADMISSION_STRIPES;
+}
+
+static void bucket_refill(admission_client_t *client, uint64_t rate, uint64_t burst) {
+    // caller holds the client's lock
+    uint64_t now_ns = metrics_now_ns();
+    client->tokens += (double)(now_ns - client->refill_ns) * rate / 1e9;
+    if (client->tokens > burst) client->tokens = burst;
+    client->refill_ns = now_ns;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+void admission_configure(const server_config_t *new_config) {
+    atomic_store_explicit(&max_connections, new_config->max_connections, memory_order_relaxed);
+    atomic_store_explicit(&max_inflight_bytes, new_config->max_inflight_bytes, memory_order_relaxed);
+    atomic_store_explicit(&rate_limit, new_config->rate_limit, memory_order_relaxed);
+    atomic_store_explicit(&rate_burst, new_config->rate_burst, memory_order_relaxed);
+}
+
+admission_client_t *admission_accept(const struct sockaddr *address) {
+    // count the connection, backing out if it is one too many
+    int limit = atomic_load_explicit(&max_connections, memory_order_relaxed);
+    if (atomic_fetch_add_explicit(&connections, 1, memory_order_relaxed) >= limit && limit > 0) {
+        atomic_fetch_sub_explicit(&connections, 1, memory_order_relaxed);
+        metrics_count(METRIC_CONNECTIONS_REJECTED, 1);
+        return NULL;
+    }
+
+    // find the address, or start a full bucket for it
+    uint8_t key[16];
+    size_t key_length = address_key(address, key);
+    size_t stripe = address_stripe(key, key_length);
+    pthread_mutex_lock(&stripes[stripe].lock);
+    admission_client_t *client = stripes[stripe].clients;
+    while (client && (client->address_length != key_length || memcmp(client->address, key, key_length))) {
+        client = client->next;
+    }
+    if (!client) {
+        client = (admission_client_t *)calloc(1, sizeof(admission_client_t));
+        if (!client) {
+            pthread_mutex_unlock(&stripes[stripe].lock);
+            atomic_fetch_sub_explicit(&connections, 1, memory_order_relaxed);
+            return NULL;
+        }
+        memcpy(client->address, key, key_length);
+        client->address_length = key_length;
+        client->stripe = stripe;
+        pthread_mutex_init(&client->lock, NULL);
+        client->tokens = atomic_load_explicit(&rate_burst, memory_order_relaxed);
+        client->refill_ns = metrics_now_ns();
+        client->next = stripes[stripe].clients;
+        stripes[stripe].clients = client;
+    }
+    client->references++;
+    pthread_mutex_unlock(&stripes[stripe].lock);
+
+    // return
+    return client;
+}
+
+void admission_close(admission_client_t *client) {
+    // forget the address with its last connection
+    size_t stripe = client->stripe;
+    pthread_mutex_lock(&stripes[stripe].lock);
+    if (--client->references == 0) {
+        admission_client_t **link = &stripes[stripe].clients;
+        while (*link != client) link = &(*link)->next;
+        *link = client->next;
+        pthread_mutex_destroy(&client->lock);
+        free(client);
+    }
+    pthread_mutex_unlock(&stripes[stripe].lock);
+    atomic_fetch_sub_explicit(&connections, 1, memory_order_relaxed);
+}
+
+int admission_recv_delay(admission_client_t *client) {
+    // server wide limit on received data not yet handled
+    size_t inflight_limit = atomic_load_explicit(&max_inflight_bytes, memory_order_relaxed);
+    if (inflight_limit > 0 && atomic_load_explicit(&inflight_bytes, memory_order_relaxed) >= inflight_limit) {
+        metrics_count(METRIC_RECV_THROTTLED, 1);
+        return ADMISSION_BACKOFF_MS;
+    }
+
+    // the address's rate; a bucket in debt waits until it is repaid and holds a read's worth
+    uint64_t rate = atomic_load_explicit(&rate_limit, memory_order_relaxed);
+    if (rate == 0) return 0;
+    uint64_t burst = atomic_load_explicit(&rate_burst, memory_order_relaxed);
+    double wanted = burst < ADMISSION_MIN_READ ? burst : ADMISSION_MIN_READ;
+    pthread_mutex_lock(&client->lock);
+    bucket_refill(client, rate, burst);
+    double tokens = client->tokens;
+    pthread_mutex_unlock(&client->lock);
+    if (tokens >= wanted) return 0;
+    metrics_count(METRIC_RECV_THROTTLED, 1);
+    double delay_ms = 1 + (wanted - tokens) * 1000 / rate;
+    return delay_ms < ADMISSION_MAX_DELAY_MS ? (int)delay_ms : ADMISSION_MAX_DELAY_MS;
+}
+
+size_t admission_recv_limit(admission_client_t *client, size_t length) {
+    if (atomic_load_explicit(&rate_limit, memory_order_relaxed) == 0) return length;
+    pthread_mutex_lock(&client->lock);
+    double tokens = client->tokens;
+    pthread_mutex_unlock(&client->lock);
+    if (tokens >= length) return length;
+    return tokens >= 1 ? (size_t)tokens : 1;
+}
+
+void admission_received(admission_client_t *client, size_t length) {
+    atomic_fetch_add_explicit(&inflight_bytes, length, memory_order_relaxed);
+
+    // take the chunk's tokens, going into debt if it was larger than the bucket held
+    uint64_t rate = atomic_load_explicit(&rate_limit, memory_order_relaxed);
+    if (rate == 0) return;
+    pthread_mutex_lock(&client->lock);
+    bucket_refill(client, rate, atomic_load_explicit(&rate_burst, memory_order_relaxed));
+    client->tokens -= length;
+    pthread_mutex_unlock(&client->lock);
+}
+
+void admission_handled(size_t length) {
+    atomic_fetch_sub_explicit(&inflight_bytes, length, memory_order_relaxed);
+}
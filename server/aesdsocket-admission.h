@@ -0,0 +1,136 @@
+/**************************************************************************************************
+ * aesdsocket-admission.h
+ *
+ * Admission control and per address rate limiting for aesdsocket clients:
+ *  - accept    a connection over max_connections is closed straight away
+ *  - recv      a connection is not read from while its address is over its rate, or while the
+ *              server holds max_inflight_bytes of received data not yet handled
+ * A connection held back is simply not read, so the kernel's receive window pushes back on the
+ * sender instead of the server buffering its data.
+ *
+ * Rates are token buckets kept per client address, shared by every connection from it: each
+ * received byte takes a token, tokens refill at rate_limit bytes per second up to rate_burst, and
+ * a bucket in debt delays the next read until it is repaid. The recv path costs one atomic load
+ * for the in-flight limit, and one uncontended mutex per chunk when rates are limited.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_ADMISSION_H
+#define AESDSOCKET_ADMISSION_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "aesdsocket-config.h"
+
+/**************************************************************************************************
+ * CONSTANTS AND TYPES
+ **************************************************************************************************/
+
+// buckets of the address table; each has its own lock
+#define ADMISSION_STRIPES           64
+
+// time a connection waits before checking the in-flight limit again
+#define ADMISSION_BACKOFF_MS        5
+
+// tokens a limited connection waits for before reading again, or rate_burst if that is smaller,
+// so a slow rate is received in a few large reads rather than many tiny ones
+#define ADMISSION_MIN_READ          4096
+
+// longest a connection waits before checking its rate again
+#define ADMISSION_MAX_DELAY_MS      1000
+
+/**
+ * struct admission_client_t
+ *
+ * @brief rate state of one client address, opaque to callers
+ */
+typedef struct admission_client_t admission_client_t;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * admission_configure()
+ *
+ * Applies the limits of a configuration; takes effect immediately, for existing connections too
+ *
+ * @param new_config                Configuration with max_connections, max_inflight_bytes,
+ *                                  rate_limit and rate_burst
+ *
+ * @return none
+ */
+void admission_configure(const server_config_t *new_config);
+
+/**
+ * admission_accept()
+ *
+ * Admits a new connection, counting it against max_connections and attaching it to the rate
+ * state of its address
+ *
+ * @param address                   Client address from accept()
+ *
+ * @return rate state to pass to the other calls, NULL if the connection is refused
+ */
+admission_client_t *admission_accept(const struct sockaddr *address);
+
+/**
+ * admission_close()
+ *
+ * Releases a connection admitted by admission_accept()
+ *
+ * @param client                    Rate state of the connection's address
+ *
+ * @return none
+ */
+void admission_close(admission_client_t *client);
+
+/**
+ * admission_recv_delay()
+ *
+ * Checks whether a connection may be read from now
+ *
+ * @param client                    Rate state of the connection's address
+ *
+ * @return 0 to read now, otherwise the milliseconds to wait before checking again
+ */
+int admission_recv_delay(admission_client_t *client);
+
+/**
+ * admission_recv_limit()
+ *
+ * Caps a read to the tokens its address has, so one recv cannot take far more than the rate allows
+ *
+ * @param client                    Rate state of the connection's address
+ * @param length                    Bytes the caller has room for
+ *
+ * @return bytes to read, at least 1 and at most length
+ */
+size_t admission_recv_limit(admission_client_t *client, size_t length);
+
+/**
+ * admission_received()
+ *
+ * Accounts for a received chunk: takes its tokens and counts it in flight until handled
+ *
+ * @param client                    Rate state of the connection's address
+ * @param length                    Bytes received
+ *
+ * @return none
+ */
+void admission_received(admission_client_t *client, size_t length);
+
+/**
+ * admission_handled()
+ *
+ * Ends the in-flight accounting of a chunk counted by admission_received()
+ *
+ * @param length                    Bytes handled
+ *
+ * @return none
+ */
+void admission_handled(size_t length);
+
+#endif /* AESDSOCKET_ADMISSION_H */
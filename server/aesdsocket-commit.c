@@ -0,0 +1,177 @@
+#include "aesdsocket-commit.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+
+#include <errno.h>
+#include <time.h>
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static void deadline_after(struct timespec *deadline, long delay_us) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += delay_us / 1000000L;
+    deadline->tv_nsec += (delay_us % 1000000L) * 1000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static int commit_lead(commit_group_t *group, bool delay) {
+    // caller holds the mutex; hold the sync open for more appenders, unless the batch is already full
+    group->syncing = true;
+    if (delay && group->max_delay_us > 0) {
+        struct timespec deadline;
+        deadline_after(&deadline, group->max_delay_us);
+        while (group->waiting < group->max_batch &&
+            pthread_cond_timedwait(&group->batch_cond, &group->mutex, &deadline) != ETIMEDOUT);
+    }
+
+    // sync everything recorded so far, outside the lock so appenders keep writing
+    uint64_t target = group->written;
+    size_t batch = group->waiting;
+    pthread_mutex_unlock(&group->mutex);
+    uint64_t sync_start_ns = metrics_now_ns();
+    int rc = group->sync(group->arg);
+    metrics_observe(METRIC_SYNC_TIME, metrics_now_ns() - sync_start_ns);
+    metrics_observe(METRIC_SYNC_BATCH, batch);
+    pthread_mutex_lock(&group->mutex);
+
+    // release the appenders it covered
+    group->syncing = false;
+    if (rc == 0 && target > group->synced) group->synced = target;
+    pthread_cond_broadcast(&group->synced_cond);
+    if (rc != 0) AESD_LOG(LOG_ERR, "[COMMIT] Sync failed. (errno %d)", errno);
+    return rc == 0 ? 0 : -1;
+}
+
+static void *commit_interval(void *arg) {
+    commit_group_t *group = (commit_group_t *)arg;
+
+    pthread_mutex_lock(&group->mutex);
+    while (!group->interval_stop) {
+        // sleep for one interval, or until stopped
+        struct timespec deadline;
+        deadline_after(&deadline, (long)group->interval_ms * 1000L);
+        pthread_cond_timedwait(&group->interval_cond, &group->mutex, &deadline);
+        if (group->interval_stop) break;
+
+        // sync unless an appender is already doing it
+        if (!group->syncing && group->synced < group->written) commit_lead(group, false);
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return NULL;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+void commit_init(commit_group_t *group, commit_sync_t sync, void *arg, int max_delay_us, size_t max_batch,
+    uint64_t synced) {
+    // timed waits use the monotonic clock, so wall clock changes never stretch a delay
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->synced_cond, NULL);
+    pthread_cond_init(&group->batch_cond, &attr);
+    pthread_cond_init(&group->interval_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // settings
+    group->sync = sync;
+    group->arg = arg;
+    group->max_delay_us = max_delay_us;
+    group->max_batch = max_batch > 0 ? max_batch : 1;
+    group->written = synced;
+    group->synced = synced;
+    group->waiting = 0;
+    group->syncing = false;
+    group->interval_running = false;
+    group->interval_stop = false;
+}
+
+void commit_destroy(commit_group_t *group) {
+    // stop interval syncs
+    if (group->interval_running) {
+        pthread_mutex_lock(&group->mutex);
+        group->interval_stop = true;
+        pthread_cond_signal(&group->interval_cond);
+        pthread_mutex_unlock(&group->mutex);
+        pthread_join(group->interval_thread, NULL);
+        group->interval_running = false;
+    }
+
+    // release
+    pthread_cond_destroy(&group->interval_cond);
+    pthread_cond_destroy(&group->batch_cond);
+    pthread_cond_destroy(&group->synced_cond);
+    pthread_mutex_destroy(&group->mutex);
+}
+
+int commit_wait(commit_group_t *group, uint64_t position) {
+    int rc = 0;
+
+    pthread_mutex_lock(&group->mutex);
+    if (position > group->written) group->written = position;
+
+    // join the batch, closing it if it is full
+    group->waiting++;
+    if (group->waiting >= group->max_batch) pthread_cond_signal(&group->batch_cond);
+
+    // wait for a sync that covers position, leading one if nobody else is
+    while (group->synced < position) {
+        if (group->syncing) {
+            pthread_cond_wait(&group->synced_cond, &group->mutex);
+        } else if (commit_lead(group, true) == -1) {
+            rc = -1;
+            break;
+        }
+    }
+    group->waiting--;
+    pthread_mutex_unlock(&group->mutex);
+
+    // return
+    return rc;
+}
+
+int commit_sync(commit_group_t *group) {
+    int rc = 0;
+
+    pthread_mutex_lock(&group->mutex);
+    uint64_t position = group->written;
+    while (rc == 0 && group->synced < position) {
+        if (group->syncing) {
+            pthread_cond_wait(&group->synced_cond, &group->mutex);
+        } else {
+            rc = commit_lead(group, false);
+        }
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    // return
+    return rc;
+}
+
+void commit_written(commit_group_t *group, uint64_t position) {
+    pthread_mutex_lock(&group->mutex);
+    if (position > group->written) group->written = position;
+    pthread_mutex_unlock(&group->mutex);
+}
+
+void commit_mark_synced(commit_group_t *group, uint64_t position) {
+    pthread_mutex_lock(&group->mutex);
+    if (position > group->written) group->written = position;
+    if (position > group->synced) group->synced = position;
+    pthread_cond_broadcast(&group->synced_cond);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+int commit_start_interval(commit_group_t *group, int interval_ms) {
+    group->interval_ms = interval_ms;
+    group->interval_stop = false;
+    if (pthread_create(&group->interval_thread, NULL, commit_interval, group) != 0) return -1;
+    group->interval_running = true;
+    return 0;
+}
@@ -0,0 +1,152 @@
+/**************************************************************************************************
+ * aesdsocket-commit.h
+ *
+ * Group commit for durable appends. Appenders write, then wait in commit_wait() until their data
+ * is synced. The first waiter to find no sync in progress becomes the leader: it holds the sync
+ * open for up to max_delay_us, or until max_batch appenders are waiting, then calls the sync
+ * function once on behalf of everyone whose write it covers. Appenders arriving during a sync wait
+ * for the next one, so under load every sync covers a full batch and an idle appender waits at
+ * most one delay plus one sync.
+ *
+ * Positions are monotonically increasing offsets supplied by the caller, typically the end of the
+ * store after the append; a sync started after a write reached a position covers that position.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_COMMIT_H
+#define AESDSOCKET_COMMIT_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**************************************************************************************************
+ * TYPES
+ **************************************************************************************************/
+
+/**
+ * commit_sync_t
+ *
+ * @brief makes every write issued so far durable, typically with fdatasync(); 0 on success
+ */
+typedef int (*commit_sync_t)(void *arg);
+
+/**
+ * struct commit_group_t
+ *
+ * @brief a group commit coordinator for one store
+ */
+typedef struct commit_group_t {
+    pthread_mutex_t                 mutex;
+    pthread_cond_t                  synced_cond;        // signalled when a sync completes
+    pthread_cond_t                  batch_cond;         // signalled when a batch fills up
+    commit_sync_t                   sync;               // sync function
+    void *                          arg;                // sync function argument
+    int                             max_delay_us;       // longest a leader holds a sync open
+    size_t                          max_batch;          // waiters that close a batch early
+    uint64_t                        written;            // highest position handed to commit_wait()
+    uint64_t                        synced;             // position up to which the store is synced
+    size_t                          waiting;            // appenders waiting in commit_wait()
+    bool                            syncing;            // a sync is in progress
+
+    // interval syncs
+    pthread_t                       interval_thread;
+    pthread_cond_t                  interval_cond;      // signalled to stop the interval thread
+    int                             interval_ms;
+    bool                            interval_running;
+    bool                            interval_stop;
+} commit_group_t;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * commit_init()
+ *
+ * Initializes a coordinator
+ *
+ * @param group                     Coordinator to initialize
+ * @param sync                      Sync function
+ * @param arg                       Sync function argument
+ * @param max_delay_us              Longest time a sync waits for more appenders to join
+ * @param max_batch                 Waiting appenders that start the sync without further delay
+ * @param synced                    Position the store is already synced to
+ *
+ * @return none
+ */
+void commit_init(commit_group_t *group, commit_sync_t sync, void *arg, int max_delay_us, size_t max_batch,
+    uint64_t synced);
+
+/**
+ * commit_destroy()
+ *
+ * Stops interval syncs and releases a coordinator; no appender may be waiting
+ *
+ * @param group                     Coordinator to release
+ *
+ * @return none
+ */
+void commit_destroy(commit_group_t *group);
+
+/**
+ * commit_wait()
+ *
+ * Waits until a write ending at position is synced, leading the sync if none is in progress
+ *
+ * @param group                     Coordinator
+ * @param position                  Position the caller's write reached
+ *
+ * @return 0 once synced, -1 if the sync failed
+ */
+int commit_wait(commit_group_t *group, uint64_t position);
+
+/**
+ * commit_sync()
+ *
+ * Syncs every position handed to commit_wait() or commit_written() so far, without delay
+ *
+ * @param group                     Coordinator
+ *
+ * @return 0 on success, -1 on failure
+ */
+int commit_sync(commit_group_t *group);
+
+/**
+ * commit_written()
+ *
+ * Records a write that does not wait for its sync, so the next sync covers it
+ *
+ * @param group                     Coordinator
+ * @param position                  Position the write reached
+ *
+ * @return none
+ */
+void commit_written(commit_group_t *group, uint64_t position);
+
+/**
+ * commit_mark_synced()
+ *
+ * Records a sync made outside the coordinator, releasing appenders it covers
+ *
+ * @param group                     Coordinator
+ * @param position                  Position the store is synced to
+ *
+ * @return none
+ */
+void commit_mark_synced(commit_group_t *group, uint64_t position);
+
+/**
+ * commit_start_interval()
+ *
+ * Starts a thread that calls commit_sync() every interval_ms
+ *
+ * @param group                     Coordinator
+ * @param interval_ms               Sync interval
+ *
+ * @return 0 on success, -1 on failure
+ */
+int commit_start_interval(commit_group_t *group, int interval_ms);
+
+#endif /* AESDSOCKET_COMMIT_H */
@@ -0,0 +1,350 @@
+#include "aesdsocket-config.h"
+#include "aesdsocket-log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+/**************************************************************************************************
+ * GLOBALS
+ **************************************************************************************************/
+server_config_t config;
+pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// log level names, indexed by syslog level
+static const char *log_level_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug",
+};
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static void config_defaults(server_config_t *new_config) {
+    memset(new_config, 0, sizeof(*new_config));
+    snprintf(new_config->config_path, sizeof(new_config->config_path), "%s", CONFIG_PATH);
+    snprintf(new_config->port, sizeof(new_config->port), "%s", PORT);
+    new_config->backlog = LISTEN_BACKLOG;
+    new_config->workers = USE_REUSEPORT_LISTENERS ? NUM_LISTENERS : 1;
+    new_config->reuseport = USE_REUSEPORT_LISTENERS;
+    new_config->buffer_size = BUFFER_SIZE;
+    new_config->max_line_size = MAX_LINE_SIZE;
+    new_config->timer_interval_s = TIMER_FREQ_S;
+    new_config->backend = USE_AESD_CHAR_DEVICE ? BACKEND_AESDCHAR : BACKEND_FILE;
+    new_config->segment_size = SEGMENT_SIZE;
+    new_config->fsync_policy = FSYNC_DEFAULT;
+    new_config->fsync_interval_ms = FSYNC_INTERVAL_MS;
+    new_config->commit_delay_us = COMMIT_DELAY_US;
+    new_config->commit_batch = COMMIT_BATCH;
+    new_config->retention_bytes = RETENTION_BYTES;
+    new_config->retention_s = RETENTION_S;
+    new_config->compress_segments = COMPRESS_SEGMENTS;
+    new_config->log_level = LOG_LEVEL;
+    snprintf(new_config->metrics_port, sizeof(new_config->metrics_port), "%s", METRICS_PORT);
+    new_config->binary_framing = BINARY_FRAMING;
+    new_config->pipelining = PIPELINING;
+    new_config->mmap_reads = MMAP_READS;
+    new_config->line_queue = LINE_QUEUE;
+    new_config->max_connections = MAX_CONNECTIONS;
+    new_config->max_inflight_bytes = MAX_INFLIGHT_BYTES;
+    new_config->rate_limit = RATE_LIMIT;
+    new_config->rate_burst = RATE_BURST;
+}
+
+static int parse_int(const char *value, long min, long max, long *result) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0' || parsed < min || parsed > max) return -1;
+    *result = parsed;
+    return 0;
+}
+
+static int parse_bool(const char *value, bool *result) {
+    if (!strcasecmp(value, "1") || !strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcasecmp(value, "on")) {
+        *result = true;
+    } else if (!strcasecmp(value, "0") || !strcasecmp(value, "no") || !strcasecmp(value, "false") || !strcasecmp(value, "off")) {
+        *result = false;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_log_level(const char *value, int *result) {
+    // accept syslog level names or numbers
+    for (int i = 0; i < (int)(sizeof(log_level_names) / sizeof(log_level_names[0])); i++) {
+        if (!strcasecmp(value, log_level_names[i])) {
+            *result = i;
+            return 0;
+        }
+    }
+    long level;
+    if (parse_int(value, LOG_EMERG, LOG_DEBUG, &level) == -1) return -1;
+    *result = (int)level;
+    return 0;
+}
+
+static int parse_backend(const char *value, storage_backend_t *result) {
+    if (!strcasecmp(value, "aesdchar")) {
+        *result = BACKEND_AESDCHAR;
+    } else if (!strcasecmp(value, "file")) {
+        *result = BACKEND_FILE;
+    } else if (!strcasecmp(value, "seglog")) {
+        *result = BACKEND_SEGLOG;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_fsync_policy(const char *value, fsync_policy_t *result) {
+    if (!strcasecmp(value, "none")) {
+        *result = FSYNC_NONE;
+    } else if (!strcasecmp(value, "interval")) {
+        *result = FSYNC_INTERVAL;
+    } else if (!strcasecmp(value, "group")) {
+        *result = FSYNC_GROUP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int config_set(server_config_t *new_config, const char *key, const char *value) {
+    long number;
+
+    // match the key; the command line options map onto the same keys
+    if (!strcmp(key, "port")) {
+        if (parse_int(value, 1, 65535, &number) == -1) return -1;
+        snprintf(new_config->port, sizeof(new_config->port), "%ld", number);
+    } else if (!strcmp(key, "backlog")) {
+        if (parse_int(value, 1, INT_MAX, &number) == -1) return -1;
+        new_config->backlog = (int)number;
+    } else if (!strcmp(key, "workers")) {
+        if (parse_int(value, 0, 4096, &number) == -1) return -1;
+        new_config->workers = (int)number;
+    } else if (!strcmp(key, "reuseport")) {
+        if (parse_bool(value, &new_config->reuseport) == -1) return -1;
+    } else if (!strcmp(key, "buffer_size")) {
+        if (parse_int(value, 64, LONG_MAX, &number) == -1) return -1;
+        new_config->buffer_size = (size_t)number;
+    } else if (!strcmp(key, "max_line_size")) {
+        if (parse_int(value, 1, LONG_MAX, &number) == -1) return -1;
+        new_config->max_line_size = (size_t)number;
+    } else if (!strcmp(key, "timer_interval")) {
+        if (parse_int(value, 0, INT_MAX, &number) == -1) return -1;
+        new_config->timer_interval_s = (int)number;
+    } else if (!strcmp(key, "backend")) {
+        if (parse_backend(value, &new_config->backend) == -1) return -1;
+    } else if (!strcmp(key, "data_path")) {
+        snprintf(new_config->data_path, sizeof(new_config->data_path), "%s", value);
+    } else if (!strcmp(key, "segment_size")) {
+        if (parse_int(value, 4096, LONG_MAX, &number) == -1) return -1;
+        new_config->segment_size = (size_t)number;
+    } else if (!strcmp(key, "fsync")) {
+        if (parse_fsync_policy(value, &new_config->fsync_policy) == -1) return -1;
+    } else if (!strcmp(key, "fsync_interval_ms")) {
+        if (parse_int(value, 1, INT_MAX, &number) == -1) return -1;
+        new_config->fsync_interval_ms = (int)number;
+    } else if (!strcmp(key, "commit_delay_us")) {
+        if (parse_int(value, 0, 1000000, &number) == -1) return -1;
+        new_config->commit_delay_us = (int)number;
+    } else if (!strcmp(key, "commit_batch")) {
+        if (parse_int(value, 1, INT_MAX, &number) == -1) return -1;
+        new_config->commit_batch = (size_t)number;
+    } else if (!strcmp(key, "retention_bytes")) {
+        if (parse_int(value, 0, LONG_MAX, &number) == -1) return -1;
+        new_config->retention_bytes = (uint64_t)number;
+    } else if (!strcmp(key, "retention_s")) {
+        if (parse_int(value, 0, INT_MAX, &number) == -1) return -1;
+        new_config->retention_s = (int)number;
+    } else if (!strcmp(key, "compress_segments")) {
+        if (parse_bool(value, &new_config->compress_segments) == -1) return -1;
+    } else if (!strcmp(key, "log_level")) {
+        if (parse_log_level(value, &new_config->log_level) == -1) return -1;
+    } else if (!strcmp(key, "metrics_port")) {
+        if (parse_int(value, 0, 65535, &number) == -1) return -1;
+        snprintf(new_config->metrics_port, sizeof(new_config->metrics_port), "%ld", number);
+    } else if (!strcmp(key, "binary_framing")) {
+        if (parse_bool(value, &new_config->binary_framing) == -1) return -1;
+    } else if (!strcmp(key, "pipelining")) {
+        if (parse_bool(value, &new_config->pipelining) == -1) return -1;
+    } else if (!strcmp(key, "mmap_reads")) {
+        if (parse_bool(value, &new_config->mmap_reads) == -1) return -1;
+    } else if (!strcmp(key, "line_queue")) {
+        if (parse_bool(value, &new_config->line_queue) == -1) return -1;
+    } else if (!strcmp(key, "max_connections")) {
+        if (parse_int(value, 0, INT_MAX, &number) == -1) return -1;
+        new_config->max_connections = (int)number;
+    } else if (!strcmp(key, "max_inflight_bytes")) {
+        if (parse_int(value, 0, LONG_MAX, &number) == -1) return -1;
+        new_config->max_inflight_bytes = (size_t)number;
+    } else if (!strcmp(key, "rate_limit")) {
+        if (parse_int(value, 0, LONG_MAX, &number) == -1) return -1;
+        new_config->rate_limit = (uint64_t)number;
+    } else if (!strcmp(key, "rate_burst")) {
+        if (parse_int(value, 1, LONG_MAX, &number) == -1) return -1;
+        new_config->rate_burst = (uint64_t)number;
+    } else {
+        AESD_LOG(LOG_WARNING, "[CONFIG] Unknown key '%s'", key);
+        return -1;
+    }
+
+    // return
+    return 0;
+}
+
+static char *trim(char *str) {
+    // skip leading whitespace, cut trailing whitespace
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static int config_load_file(server_config_t *new_config, const char *path, bool required) {
+    // a missing default config file is not an error
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (!required && errno == ENOENT) return 0;
+        AESD_LOG(LOG_ERR, "[CONFIG] Error opening %s. (errno %d)", path, errno);
+        return -1;
+    }
+
+    // parse "key = value" lines, ignoring blank lines and # comments
+    char line[PATH_MAX + 64];
+    int line_number = 0;
+    int rc = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char *key = trim(line);
+        if (*key == '\0') continue;
+
+        char *separator = strchr(key, '=');
+        if (separator == NULL) {
+            AESD_LOG(LOG_ERR, "[CONFIG] %s:%d: expected key = value", path, line_number);
+            rc = -1;
+            continue;
+        }
+        *separator = '\0';
+        key = trim(key);
+        char *value = trim(separator + 1);
+
+        if (config_set(new_config, key, value) == -1) {
+            AESD_LOG(LOG_ERR, "[CONFIG] %s:%d: invalid value '%s' for '%s'", path, line_number, value, key);
+            rc = -1;
+        }
+    }
+
+    // close file
+    fclose(file);
+    return rc;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+int config_load(server_config_t *new_config, int argc, char **argv) {
+    // command line options, mapped onto config keys
+    static const struct {
+        char                        option;
+        const char *                key;
+    } options[] = {
+        { 'p', "port" }, { 'b', "backlog" }, { 'w', "workers" }, { 'r', "reuseport" },
+        { 'B', "buffer_size" }, { 'L', "max_line_size" }, { 't', "timer_interval" },
+        { 's', "backend" }, { 'f', "data_path" }, { 'l', "log_level" }, { 'm', "metrics_port" },
+        { 'F', "binary_framing" }, { 'P', "pipelining" }, { 'M', "mmap_reads" }, { 'Q', "line_queue" },
+    };
+    const char *optstring = "dc:p:b:w:r:B:L:t:s:f:l:m:F:P:M:Q:h";
+
+    // start from defaults
+    config_defaults(new_config);
+
+    // first pass finds the config file, so the command line can override it
+    // https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
+    int c;
+    bool config_path_given = false;
+    optind = 1;
+    opterr = 0;
+    while ((c = getopt(argc, argv, optstring)) != -1) {
+        if (c == 'c') {
+            snprintf(new_config->config_path, sizeof(new_config->config_path), "%s", optarg);
+            config_path_given = true;
+        }
+    }
+    if (config_load_file(new_config, new_config->config_path, config_path_given) == -1) return -1;
+
+    // second pass applies the command line
+    optind = 1;
+    while ((c = getopt(argc, argv, optstring)) != -1) {
+        switch (c) {
+            case 'd':
+                new_config->daemon = true;
+                break;
+            case 'c':
+                break;
+            case 'h':
+            case '?':
+                if (c == '?') printf("Unknown option `-%c'.\n", optopt);
+                config_usage(argv[0]);
+                return -1;
+            default:
+                for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+                    if (options[i].option == c && config_set(new_config, options[i].key, optarg) == -1) {
+                        printf("Invalid value '%s' for `-%c'.\n", optarg, c);
+                        return -1;
+                    }
+                }
+                break;
+        }
+    }
+
+    // the data path defaults to the backend's own
+    if (new_config->data_path[0] == '\0') {
+        snprintf(new_config->data_path, sizeof(new_config->data_path), "%s",
+            new_config->backend == BACKEND_SEGLOG ? SEGLOG_PATH : TMPDATA_PATH);
+    }
+
+    // so does the fsync policy; the file backend keeps its historical unsynced behaviour
+    if (new_config->fsync_policy == FSYNC_DEFAULT) {
+        new_config->fsync_policy = new_config->backend == BACKEND_SEGLOG ? FSYNC_INTERVAL : FSYNC_NONE;
+    }
+
+    // return
+    return 0;
+}
+
+void config_snapshot(server_config_t *snapshot) {
+    pthread_mutex_lock(&config_mutex);
+    *snapshot = config;
+    pthread_mutex_unlock(&config_mutex);
+}
+
+bool config_is_reloadable(const server_config_t *old_config, const server_config_t *new_config) {
+    return old_config->backend == new_config->backend &&
+        !strcmp(old_config->data_path, new_config->data_path) &&
+        old_config->segment_size == new_config->segment_size &&
+        old_config->fsync_policy == new_config->fsync_policy &&
+        old_config->fsync_interval_ms == new_config->fsync_interval_ms &&
+        old_config->commit_delay_us == new_config->commit_delay_us &&
+        old_config->commit_batch == new_config->commit_batch &&
+        old_config->retention_bytes == new_config->retention_bytes &&
+        old_config->retention_s == new_config->retention_s &&
+        old_config->compress_segments == new_config->compress_segments &&
+        old_config->mmap_reads == new_config->mmap_reads &&
+        old_config->line_queue == new_config->line_queue;
+}
+
+void config_usage(const char *program) {
+    printf("Usage: %s [-d] [-c config] [-p port] [-b backlog] [-w workers] [-r reuseport]\n"
+        "       [-B buffer_size] [-L max_line_size] [-t timer_interval] [-s aesdchar|file|seglog]\n"
+        "       [-f data_path] [-l log_level] [-m metrics_port]\n"
+        "       [-F binary_framing] [-P pipelining] [-M mmap_reads] [-Q line_queue]\n", program);
+}
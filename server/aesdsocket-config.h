@@ -0,0 +1,192 @@
+/**************************************************************************************************
+ * aesdsocket-config.h
+ *
+ * Runtime configuration for aesdsocket. Settings are layered, each layer overriding the last:
+ *  1. the compile time defaults below
+ *  2. the config file (CONFIG_PATH, or -c <path>), with one "key = value" per line
+ *  3. command line options
+ * The layers are re-read on SIGHUP; see config_is_reloadable() for what takes effect without
+ * a restart.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_CONFIG_H
+#define AESDSOCKET_CONFIG_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <syslog.h>
+
+/**************************************************************************************************
+ * DEFAULTS
+ **************************************************************************************************/
+
+// build switch - either use a char device or a file in filesystem by default
+#define USE_AESD_CHAR_DEVICE 1
+#if USE_AESD_CHAR_DEVICE
+    #define TMPDATA_PATH        "/dev/aesdchar"
+#else
+    #define TMPDATA_PATH        "/var/tmp/aesdsocketdata"
+#endif
+#define SEGLOG_PATH         "/var/tmp/aesdsocketlog"    // default directory of the segmented log backend
+
+// define constants
+#define CONFIG_PATH         "/etc/aesdsocket.conf"
+#define PORT                "9000"
+#define LISTEN_BACKLOG      128
+#define BUFFER_SIZE         1024 * 1024
+#define MAX_LINE_SIZE       1024 * 1024
+#define TIMER_FREQ_S        10
+#define LOG_LEVEL           LOG_INFO    // runtime log level, see aesdsocket-log.h for the compile time level
+#define METRICS_PORT        "0"         // loopback port serving metrics, "0" disables the endpoint
+#define BINARY_FRAMING      1           // accept the binary framing preamble, see aesdsocket-protocol.h
+#define PIPELINING          0           // batch the lines of each received chunk, see client_process_text()
+#define MMAP_READS          1           // file backend: reply from a mapping of the data file, see aesdsocket-filemap.h
+#define LINE_QUEUE          0           // hand appends to a single storage writer, see aesdsocket-queue.h
+
+// admission control, see aesdsocket-admission.h
+#define MAX_CONNECTIONS     1024                        // 0 = no limit
+#define MAX_INFLIGHT_BYTES  64 * 1024 * 1024            // received bytes not yet handled, 0 = no limit
+#define RATE_LIMIT          0                           // bytes per second per client address, 0 = no limit
+#define RATE_BURST          1024 * 1024                 // bytes a client address may send at once
+
+// durability of the file and segmented log backends, and the segmented log, see aesdsocket-seglog.h
+#define SEGMENT_SIZE        16 * 1024 * 1024
+#define FSYNC_INTERVAL_MS   1000
+#define COMMIT_DELAY_US     200                         // longest a group commit waits for more appends
+#define COMMIT_BATCH        64                          // appends that start a group commit without waiting
+#define RETENTION_BYTES     1024ULL * 1024 * 1024       // 0 = no size limit
+#define RETENTION_S         0                           // 0 = no age limit
+#define COMPRESS_SEGMENTS   0                           // compress sealed segments in the background
+
+// build switch - create one SO_REUSEPORT listening socket per worker, each with its own accept loop
+// pinned to a core, so the kernel spreads incoming connections instead of funneling them through
+// a single accept queue
+#define USE_REUSEPORT_LISTENERS     1
+#define NUM_LISTENERS               0       // 0 = one listener per online CPU
+#define USE_REUSEPORT_CBPF          1       // steer connections to the listener pinned to the receiving CPU
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+/**
+ * enum storage_backend_t
+ *
+ * @brief where client lines are stored
+ */
+typedef enum storage_backend_t {
+    BACKEND_AESDCHAR,                                   // aesdchar device, supports seek commands
+    BACKEND_FILE,                                       // regular file, with periodic timestamps
+    BACKEND_SEGLOG,                                     // segmented log directory, with periodic timestamps
+} storage_backend_t;
+
+/**
+ * enum fsync_policy_t
+ *
+ * @brief when the file and segmented log backends sync appends to disk
+ */
+typedef enum fsync_policy_t {
+    FSYNC_DEFAULT,                                      // resolved on load: interval for seglog, otherwise none
+    FSYNC_NONE,                                         // never; the page cache decides
+    FSYNC_INTERVAL,                                     // every fsync_interval_ms
+    FSYNC_GROUP,                                        // before acknowledging, batching concurrent appends
+} fsync_policy_t;
+
+/**
+ * struct server_config_t
+ *
+ * @brief every runtime setting of the server
+ */
+typedef struct server_config_t {
+    char                            config_path[PATH_MAX];  // config file to load
+    bool                            daemon;             // fork into the background
+    char                            port[16];           // listening port
+    int                             backlog;            // listen() backlog
+    int                             workers;            // listeners, 0 = one per online CPU
+    bool                            reuseport;          // one SO_REUSEPORT listener per worker
+    size_t                          buffer_size;        // per connection receive and reply buffers
+    size_t                          max_line_size;      // longest line accepted from a client
+    int                             timer_interval_s;   // timestamp interval, 0 disables timestamps
+    storage_backend_t               backend;            // storage backend
+    char                            data_path[PATH_MAX];    // backend data path, or log directory
+    size_t                          segment_size;       // segmented log: size at which segments roll
+    fsync_policy_t                  fsync_policy;       // file and segmented log: when appends are synced
+    int                             fsync_interval_ms;  // interval policy period
+    int                             commit_delay_us;    // group policy: longest wait for a batch to fill
+    size_t                          commit_batch;       // group policy: appends that fill a batch
+    uint64_t                        retention_bytes;    // segmented log: most bytes kept, 0 for no limit
+    int                             retention_s;        // segmented log: oldest segment age kept, 0 for no limit
+    bool                            compress_segments;  // segmented log: compress sealed segments
+    int                             log_level;          // runtime syslog level
+    char                            metrics_port[16];   // loopback metrics port, "0" to disable
+    bool                            binary_framing;     // accept binary framed connections
+    bool                            pipelining;         // one append and one reply per received chunk
+    bool                            mmap_reads;         // file backend: read the data file through a mapping
+    bool                            line_queue;         // appends go through the line queue's writer
+    int                             max_connections;    // open connections, 0 for no limit
+    size_t                          max_inflight_bytes; // received bytes not yet handled, 0 for no limit
+    uint64_t                        rate_limit;         // bytes per second per client address, 0 for no limit
+    uint64_t                        rate_burst;         // token bucket size of each client address
+} server_config_t;
+
+// active configuration; written by the main thread on reload while holding config_mutex
+extern server_config_t config;
+extern pthread_mutex_t config_mutex;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * config_load()
+ *
+ * Builds a configuration from the defaults, the config file and the command line
+ *
+ * @param new_config                Configuration to fill in
+ * @param argc                      Number of command line arguments, passed through main()
+ * @param argv                      String array of command line arguments, passed through main()
+ *
+ * @return 0 on success, -1 on failure
+ */
+int config_load(server_config_t *new_config, int argc, char **argv);
+
+/**
+ * config_snapshot()
+ *
+ * Copies the active configuration while holding config_mutex
+ *
+ * @param snapshot                  Configuration to copy into
+ *
+ * @return none
+ */
+void config_snapshot(server_config_t *snapshot);
+
+/**
+ * config_is_reloadable()
+ *
+ * Checks whether a new configuration can be applied to a running server. The backend, its data
+ * path and the storage settings are fixed at startup; everything else is applied on reload.
+ *
+ * @param old_config                Active configuration
+ * @param new_config                Configuration being loaded
+ *
+ * @return true if every changed setting can be applied without a restart
+ */
+bool config_is_reloadable(const server_config_t *old_config, const server_config_t *new_config);
+
+/**
+ * config_usage()
+ *
+ * Prints command line usage
+ *
+ * @param program                   Program name
+ *
+ * @return none
+ */
+void config_usage(const char *program);
+
+#endif /* AESDSOCKET_CONFIG_H */
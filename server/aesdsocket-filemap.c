@@ -0,0 +1,146 @@
+#include "aesdsocket-filemap.h"
+#include "aesdsocket-log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+/**
+ * struct filemap_region_t
+ *
+ * @brief one mapping of the data file, from its first byte
+ */
+typedef struct filemap_region_t {
+    char *                          base;               // start of the mapping
+    size_t                          length;             // bytes mapped
+} filemap_region_t;
+
+// mapping state; regions are only added by filemap_publish(), whose callers are serialized
+static struct {
+    int                             fd;                 // data file, read only
+    filemap_region_t                regions[FILEMAP_MAX_REGIONS];
+    size_t                          count;              // regions mapped
+    _Atomic(filemap_region_t *)     current;            // largest region, published before the size it covers
+    _Atomic uint64_t                published;          // bytes readers may access
+} filemap = { .fd = -1 };
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static int filemap_grow(uint64_t end) {
+    // double the largest mapping until it covers end
+    filemap_region_t *current = atomic_load_explicit(&filemap.current, memory_order_relaxed);
+    uint64_t length = current ? current->length : FILEMAP_RESERVE;
+    while (length < end) length *= 2;
+    if (filemap.count == FILEMAP_MAX_REGIONS || length > SIZE_MAX) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // map read only and without reserving swap; pages past the end of the file are never touched
+    void *base = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED | MAP_NORESERVE, filemap.fd, 0);
+    if (base == MAP_FAILED) return -1;
+
+    // earlier regions stay mapped for readers still using them
+    filemap_region_t *region = &filemap.regions[filemap.count++];
+    region->base = base;
+    region->length = (size_t)length;
+    atomic_store_explicit(&filemap.current, region, memory_order_release);
+    AESD_LOG(LOG_DEBUG, "[FILEMAP] Mapped %zu bytes.", region->length);
+    return 0;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+int filemap_open(const char *path) {
+    // open the data file, creating it so it can be mapped before the first append
+    filemap.fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (filemap.fd == -1) {
+        AESD_LOG(LOG_ERR, "[FILEMAP] Opening %s failed. (errno %d)", path, errno);
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(filemap.fd, &file_stat) == -1) {
+        AESD_LOG(LOG_ERR, "[FILEMAP] Reading the size of %s failed. (errno %d)", path, errno);
+        goto exit_filemap_open;
+    }
+
+    // map the reservation and publish what the file already holds
+    atomic_store_explicit(&filemap.published, 0, memory_order_relaxed);
+    if (filemap_grow((uint64_t)file_stat.st_size) == -1) {
+        AESD_LOG(LOG_ERR, "[FILEMAP] Mapping %s failed. (errno %d)", path, errno);
+        goto exit_filemap_open;
+    }
+    atomic_store_explicit(&filemap.published, (uint64_t)file_stat.st_size, memory_order_release);
+
+    // return
+    return 0;
+
+exit_filemap_open:
+    close(filemap.fd);
+    filemap.fd = -1;
+    return -1;
+}
+
+void filemap_close() {
+    // unmap every region
+    for (size_t i = 0; i < filemap.count; i++) {
+        munmap(filemap.regions[i].base, filemap.regions[i].length);
+    }
+    filemap.count = 0;
+    atomic_store(&filemap.current, NULL);
+    atomic_store(&filemap.published, 0);
+
+    // close data file
+    if (filemap.fd != -1) {
+        close(filemap.fd);
+        filemap.fd = -1;
+    }
+}
+
+bool filemap_is_open() {
+    return filemap.fd != -1;
+}
+
+int filemap_publish(uint64_t end) {
+    // sizes only move forward
+    if (end <= atomic_load_explicit(&filemap.published, memory_order_relaxed)) return 0;
+
+    // the mapping must cover the new size before readers can see it
+    filemap_region_t *current = atomic_load_explicit(&filemap.current, memory_order_relaxed);
+    if (end > current->length && filemap_grow(end) == -1) {
+        AESD_LOG(LOG_ERR, "[FILEMAP] Growing the mapping to %llu bytes failed. (errno %d)",
+            (unsigned long long)end, errno);
+        return -1;
+    }
+    atomic_store_explicit(&filemap.published, end, memory_order_release);
+
+    // return
+    return 0;
+}
+
+uint64_t filemap_size() {
+    return atomic_load_explicit(&filemap.published, memory_order_acquire);
+}
+
+const char *filemap_data(uint64_t offset, size_t *length) {
+    // load the size before the region; the region published with it covers it
+    uint64_t published = atomic_load_explicit(&filemap.published, memory_order_acquire);
+    if (offset >= published) {
+        *length = 0;
+        return NULL;
+    }
+    filemap_region_t *current = atomic_load_explicit(&filemap.current, memory_order_acquire);
+
+    // clamp to the published bytes
+    if (*length > published - offset) *length = (size_t)(published - offset);
+    return current->base + offset;
+}
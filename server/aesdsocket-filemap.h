@@ -0,0 +1,103 @@
+/**************************************************************************************************
+ * aesdsocket-filemap.h
+ *
+ * Memory mapped read path of the file backend. The data file is mapped read only into a
+ * reservation much larger than the file, so it grows into the mapping instead of being remapped
+ * on every append. Readers only touch bytes below the published size, which appenders advance once
+ * their write is complete; bytes past the end of the file are never accessed.
+ *
+ * When the file outgrows the reservation, a mapping twice the size is created and becomes the
+ * current one. Earlier mappings are not unmapped until filemap_close(), so a reader still sending
+ * from one never needs a lock, at the cost of address space that is at most the size of the
+ * current mapping.
+ *
+ * The data file must only be appended to while it is mapped; truncating it would turn reads of the
+ * published bytes into SIGBUS.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_FILEMAP_H
+#define AESDSOCKET_FILEMAP_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************************************************************************************************
+ * CONSTANTS
+ **************************************************************************************************/
+
+// initial reservation; address space only, nothing is committed until the file grows into it
+#if UINTPTR_MAX > 0xFFFFFFFFu
+    #define FILEMAP_RESERVE         (64ULL * 1024 * 1024 * 1024)
+#else
+    #define FILEMAP_RESERVE         (256ULL * 1024 * 1024)
+#endif
+
+// mappings kept alive at once; each doubles the last, so this bounds the file size, not memory
+#define FILEMAP_MAX_REGIONS         16
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * filemap_open()
+ *
+ * Maps the data file, creating it if needed, and publishes its current size
+ *
+ * @param path                      Data file to map
+ *
+ * @return 0 on success, -1 on failure
+ */
+int filemap_open(const char *path);
+
+/**
+ * filemap_close()
+ *
+ * Unmaps every mapping and closes the data file; no reader may still hold a pointer into them
+ *
+ * @return none
+ */
+void filemap_close();
+
+/**
+ * filemap_is_open()
+ *
+ * @return true if the data file is mapped
+ */
+bool filemap_is_open();
+
+/**
+ * filemap_publish()
+ *
+ * Makes the file up to end visible to readers, growing the mapping first if needed. Calls must be
+ * serialized with each other, and end must already be written to the file.
+ *
+ * @param end                       Size of the file after the last complete append
+ *
+ * @return 0 on success, -1 if the mapping could not grow; the size is then left unpublished
+ */
+int filemap_publish(uint64_t end);
+
+/**
+ * filemap_size()
+ *
+ * @return published size of the file
+ */
+uint64_t filemap_size();
+
+/**
+ * filemap_data()
+ *
+ * Gets a pointer to the published bytes at an offset. The pointer stays valid until
+ * filemap_close(), even if the mapping grows meanwhile.
+ *
+ * @param offset                    Byte offset
+ * @param length                    Most bytes wanted; set to the bytes available, 0 past the end
+ *
+ * @return pointer to the byte at offset, NULL past the end
+ */
+const char *filemap_data(uint64_t offset, size_t *length);
+
+#endif /* AESDSOCKET_FILEMAP_H */
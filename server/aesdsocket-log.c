@@ -0,0 +1,245 @@
+#include "aesdsocket-log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+/**
+ * struct log_record_t
+ *
+ * @brief a single formatted message waiting to be drained
+ */
+typedef struct log_record_t {
+    int                             level;              // syslog level
+    char                            message[AESD_LOG_MSG_SIZE];
+} log_record_t;
+
+/**
+ * struct log_ring_t
+ *
+ * @brief a thread's single-producer/single-consumer message ring
+ */
+typedef struct log_ring_t {
+    _Atomic uint32_t                head;               // next slot to write, owned by the producer
+    _Atomic uint32_t                tail;               // next slot to drain, owned by the drain thread
+    _Atomic uint32_t                dropped;            // messages dropped because the ring was full
+    _Atomic bool                    orphaned;           // producer thread has exited
+    struct log_ring_t *             next;               // next ring in the registry
+    log_record_t                    records[AESD_LOG_RING_SLOTS];
+} log_ring_t;
+
+// runtime level
+_Atomic int aesd_log_level = LOG_INFO;
+
+// registry of every thread's ring, only locked when a thread logs for the first time and when draining
+static log_ring_t *ring_registry = NULL;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// calling thread's ring, and the key used to orphan it when the thread exits
+static __thread log_ring_t *thread_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// drain thread
+static pthread_t drain_thread_id;
+static _Atomic bool drain_running = false;
+static _Atomic bool drain_stop = false;
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static void ring_orphan(void *arg) {
+    // the drain thread frees the ring once it has been emptied
+    log_ring_t *ring = (log_ring_t *)arg;
+    atomic_store_explicit(&ring->orphaned, true, memory_order_release);
+}
+
+static void ring_key_create() {
+    pthread_key_create(&ring_key, ring_orphan);
+}
+
+static log_ring_t *ring_get() {
+    // fast path; the ring already exists
+    if (thread_ring != NULL) return thread_ring;
+
+    // allocate and register a ring for this thread
+    pthread_once(&ring_key_once, ring_key_create);
+    log_ring_t *ring = (log_ring_t *)calloc(1, sizeof(log_ring_t));
+    if (!ring) return NULL;
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&registry_mutex);
+    ring->next = ring_registry;
+    ring_registry = ring;
+    pthread_mutex_unlock(&registry_mutex);
+
+    thread_ring = ring;
+    return ring;
+}
+
+static bool ratelimit_allow(aesd_log_ratelimit_t *ratelimit, uint32_t *suppressed) {
+    // coarse clock is read from the vDSO, so this never enters the kernel
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t window = (uint64_t)now.tv_sec;
+
+    // start a new window
+    uint64_t current = atomic_load_explicit(&ratelimit->window, memory_order_relaxed);
+    if (current != window &&
+        atomic_compare_exchange_strong_explicit(&ratelimit->window, &current, window,
+            memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&ratelimit->count, 0, memory_order_relaxed);
+    }
+
+    // allow up to the burst per window
+    if (atomic_fetch_add_explicit(&ratelimit->count, 1, memory_order_relaxed) >= AESD_LOG_RATELIMIT_BURST) {
+        atomic_fetch_add_explicit(&ratelimit->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    *suppressed = atomic_exchange_explicit(&ratelimit->suppressed, 0, memory_order_relaxed);
+    return true;
+}
+
+static void ring_drain(log_ring_t *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    // write out every published record
+    while (tail != head) {
+        log_record_t *record = &ring->records[tail & (AESD_LOG_RING_SLOTS - 1)];
+        syslog(record->level, "%s", record->message);
+        tail++;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    // report drops
+    uint32_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        syslog(LOG_WARNING, "[LOG] %u messages dropped, log ring full", dropped);
+    }
+}
+
+static void drain_all() {
+    pthread_mutex_lock(&registry_mutex);
+    log_ring_t **link = &ring_registry;
+    while (*link != NULL) {
+        log_ring_t *ring = *link;
+
+        // check orphaned before draining, so nothing published after the check is lost
+        bool orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        ring_drain(ring);
+
+        // free rings of exited threads
+        if (orphaned) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void *drain_thread(void *arg) {
+    struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = AESD_LOG_DRAIN_INTERVAL_MS * 1000000L,
+    };
+
+    // drain periodically; producers never wake this thread
+    while (!atomic_load(&drain_stop)) {
+        drain_all();
+        nanosleep(&interval, NULL);
+    }
+
+    // final drain
+    drain_all();
+    return NULL;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+void aesd_log_init(int level) {
+    // open syslog
+    openlog(NULL, LOG_PID | LOG_CONS | LOG_NDELAY, LOG_USER);
+
+    // set runtime level
+    aesd_log_set_level(level);
+}
+
+int aesd_log_start() {
+    // start the drain thread
+    atomic_store(&drain_stop, false);
+    if (pthread_create(&drain_thread_id, NULL, drain_thread, NULL) != 0) {
+        syslog(LOG_ERR, "[LOG] Error creating log drain thread, logging synchronously");
+        return -1;
+    }
+
+    // switch writers over to their rings
+    atomic_store(&drain_running, true);
+    return 0;
+}
+
+void aesd_log_shutdown() {
+    // stop the drain thread, which flushes every ring before exiting
+    if (atomic_exchange(&drain_running, false)) {
+        atomic_store(&drain_stop, true);
+        pthread_join(drain_thread_id, NULL);
+    }
+
+    // close syslog
+    closelog();
+}
+
+void aesd_log_set_level(int level) {
+    atomic_store_explicit(&aesd_log_level, level, memory_order_relaxed);
+}
+
+void aesd_log_write(aesd_log_ratelimit_t *ratelimit, int level, const char *format, ...) {
+    // apply call site rate limit
+    uint32_t suppressed = 0;
+    if (!ratelimit_allow(ratelimit, &suppressed)) return;
+
+    // note suppressed messages ahead of this one
+    if (suppressed > 0) {
+        aesd_log_ratelimit_t unlimited = {0};
+        aesd_log_write(&unlimited, LOG_WARNING, "[LOG] %u messages suppressed by rate limit", suppressed);
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    // log synchronously until the drain thread is running
+    log_ring_t *ring = atomic_load_explicit(&drain_running, memory_order_acquire) ? ring_get() : NULL;
+    if (ring == NULL) {
+        vsyslog(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    // drop the message if the ring is full
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= AESD_LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    // format into the slot, then publish it
+    log_record_t *record = &ring->records[head & (AESD_LOG_RING_SLOTS - 1)];
+    record->level = level;
+    vsnprintf(record->message, sizeof(record->message), format, args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    va_end(args);
+}
@@ -0,0 +1,146 @@
+/**************************************************************************************************
+ * aesdsocket-log.h
+ *
+ * Asynchronous logging for aesdsocket. Each thread formats its messages into its own lock-free
+ * single-producer/single-consumer ring, and a background thread drains every ring into syslog,
+ * so logging on the hot path never takes a lock or makes a syscall.
+ *
+ * Messages are filtered twice:
+ *  - at compile time, AESD_LOG() calls above AESD_LOG_COMPILE_LEVEL compile to nothing
+ *  - at run time, calls above the level set with aesd_log_set_level() cost one relaxed load
+ * and each call site is rate limited to AESD_LOG_RATELIMIT_BURST messages per second.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_LOG_H
+#define AESDSOCKET_LOG_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <syslog.h>
+
+/**************************************************************************************************
+ * CONSTANTS
+ **************************************************************************************************/
+
+// highest syslog level compiled in; override with -DAESD_LOG_COMPILE_LEVEL=LOG_INFO for release builds
+#ifndef AESD_LOG_COMPILE_LEVEL
+    #define AESD_LOG_COMPILE_LEVEL      LOG_DEBUG
+#endif
+
+// ring and message sizing
+#define AESD_LOG_RING_SLOTS             256         // per-thread ring capacity, must be a power of 2
+#define AESD_LOG_MSG_SIZE               240         // formatted messages are truncated to this size
+
+// drain thread wakeup interval
+#define AESD_LOG_DRAIN_INTERVAL_MS      10
+
+// per call site rate limit
+#define AESD_LOG_RATELIMIT_BURST        100         // messages allowed per call site per second
+
+/**************************************************************************************************
+ * TYPES
+ **************************************************************************************************/
+
+/**
+ * struct aesd_log_ratelimit_t
+ *
+ * @brief per call site rate limiting state, allocated statically by AESD_LOG()
+ */
+typedef struct aesd_log_ratelimit_t {
+    _Atomic uint64_t                window;             // current one second window
+    _Atomic uint32_t                count;              // messages logged in the current window
+    _Atomic uint32_t                suppressed;         // messages dropped since the last one logged
+} aesd_log_ratelimit_t;
+
+// runtime level, read by AESD_LOG_ENABLED()
+extern _Atomic int aesd_log_level;
+
+/**************************************************************************************************
+ * MACROS
+ **************************************************************************************************/
+
+/**
+ * AESD_LOG_ENABLED()
+ *
+ * Evaluates to true if a message at level would be logged; use it to guard work done only to
+ * produce log messages
+ */
+#define AESD_LOG_ENABLED(level) \
+    ((level) <= AESD_LOG_COMPILE_LEVEL && \
+        (level) <= atomic_load_explicit(&aesd_log_level, memory_order_relaxed))
+
+/**
+ * AESD_LOG()
+ *
+ * Logs a printf-style message at a syslog level
+ */
+#define AESD_LOG(level, ...) \
+    do { \
+        if (AESD_LOG_ENABLED(level)) { \
+            static aesd_log_ratelimit_t aesd_log_ratelimit_; \
+            aesd_log_write(&aesd_log_ratelimit_, (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * aesd_log_init()
+ *
+ * Opens syslog and sets the runtime level. Until aesd_log_start() is called, messages are written
+ * to syslog synchronously.
+ *
+ * @param level                     Initial runtime level
+ *
+ * @return none
+ */
+void aesd_log_init(int level);
+
+/**
+ * aesd_log_start()
+ *
+ * Starts the background drain thread; call after daemonizing, since threads do not survive fork()
+ *
+ * @return 0 on success, -1 on failure
+ */
+int aesd_log_start();
+
+/**
+ * aesd_log_shutdown()
+ *
+ * Stops the drain thread, flushes every ring and closes syslog
+ *
+ * @return none
+ */
+void aesd_log_shutdown();
+
+/**
+ * aesd_log_set_level()
+ *
+ * Sets the runtime level; messages above it are discarded before they are formatted
+ *
+ * @param level                     New runtime level
+ *
+ * @return none
+ */
+void aesd_log_set_level(int level);
+
+/**
+ * aesd_log_write()
+ *
+ * Formats a message into the calling thread's ring; use AESD_LOG() instead of calling this directly
+ *
+ * @param ratelimit                 Rate limiting state of the call site
+ * @param level                     Syslog level of the message
+ * @param format                    printf-style format string
+ *
+ * @return none
+ */
+void aesd_log_write(aesd_log_ratelimit_t *ratelimit, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* AESDSOCKET_LOG_H */
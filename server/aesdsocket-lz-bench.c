@@ -0,0 +1,177 @@
+/**************************************************************************************************
+ * aesdsocket-lz-bench.c
+ *
+ * Measures the CPU cost and the bytes saved by aesdsocket-lz.h on line mixes like the ones clients
+ * store, block by block as compressed segments and replies use it. Build and run with:
+ *      make bench && ./aesdsocket-lz-bench [-s size_mb] [-b block_size]
+ **************************************************************************************************/
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "aesdsocket-lz.h"
+
+/**************************************************************************************************
+ * CONSTANTS AND TYPES
+ **************************************************************************************************/
+
+#define BENCH_SIZE_MB               16
+#define BENCH_BLOCK_SIZE            65536
+
+/**
+ * struct bench_mix_t
+ *
+ * @brief a line mix; fill writes one line into buffer and returns its length
+ */
+typedef struct bench_mix_t {
+    const char *                    name;
+    size_t                          (*fill)(char *buffer, size_t size);
+} bench_mix_t;
+
+/**************************************************************************************************
+ * LINE MIXES
+ **************************************************************************************************/
+static const char *words[] = {
+    "the", "sensor", "reading", "is", "within", "range", "and", "reported", "to", "server", "after",
+    "calibration", "of", "device", "temperature", "pressure", "door", "opened", "closed", "alarm",
+};
+
+static size_t fill_sensor_log(char *buffer, size_t size) {
+    // structured log lines: fixed field names, a few distinct values
+    return snprintf(buffer, size, "2026-10-19T10:%02d:%02d sensor=%d value=%d status=%s\n",
+        rand() % 60, rand() % 60, rand() % 32, rand() % 1000, rand() % 10 ? "ok" : "warn");
+}
+
+static size_t fill_timestamps(char *buffer, size_t size) {
+    // what the timer appends every interval
+    static int second = 0;
+    second += 10;
+    return snprintf(buffer, size, "timestamp:Mon, 19 Oct 2026 %02d:%02d:%02d +0000\n",
+        (second / 3600) % 24, (second / 60) % 60, second % 60);
+}
+
+static size_t fill_text(char *buffer, size_t size) {
+    // free text from a small vocabulary
+    size_t length = 0;
+    int count = 3 + rand() % 12;
+    for (int i = 0; i < count && length + 16 < size; i++) {
+        length += snprintf(buffer + length, size - length, "%s%s", i ? " " : "", words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    }
+    buffer[length++] = '\n';
+    return length;
+}
+
+static size_t fill_random(char *buffer, size_t size) {
+    // printable noise, close to incompressible
+    size_t length = 16 + rand() % 64;
+    for (size_t i = 0; i < length; i++) buffer[i] = 33 + rand() % 94;
+    buffer[length++] = '\n';
+    return length;
+}
+
+static const bench_mix_t mixes[] = {
+    { "sensor log", fill_sensor_log },
+    { "timestamps", fill_timestamps },
+    { "free text", fill_text },
+    { "random", fill_random },
+};
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+static double cpu_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = (size_t)BENCH_SIZE_MB * 1024 * 1024;
+    size_t block_size = BENCH_BLOCK_SIZE;
+    int c;
+    while ((c = getopt(argc, argv, "s:b:h")) != -1) {
+        switch (c) {
+            case 's':
+                size = (size_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'b':
+                block_size = (size_t)atoi(optarg);
+                break;
+            default:
+                printf("Usage: %s [-s size_mb] [-b block_size]\n", argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (size == 0 || block_size == 0) return 1;
+
+    // buffers for the input, each block compressed, and the round trip
+    char *input = (char *)malloc(size);
+    char *packed = (char *)malloc(lz_bound(block_size) * (size / block_size + 1));
+    size_t *packed_lengths = (size_t *)malloc((size / block_size + 1) * sizeof(size_t));
+    char *output = (char *)malloc(size);
+    if (!input || !packed || !packed_lengths || !output) {
+        printf("Error allocating %zu MiB buffers\n", size >> 20);
+        return 1;
+    }
+
+    printf("%-12s %10s %10s %8s %12s %12s %14s\n", "mix", "bytes", "stored", "ratio", "comp MB/s", "decomp MB/s", "CPU ns/saved B");
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        // whole lines up to size
+        srand(42);
+        size_t length = 0;
+        char line[256];
+        while (1) {
+            size_t line_length = mixes[m].fill(line, sizeof(line));
+            if (length + line_length > size) break;
+            memcpy(input + length, line, line_length);
+            length += line_length;
+        }
+
+        // compress block by block, storing incompressible blocks raw as segments do
+        size_t blocks = (length + block_size - 1) / block_size;
+        size_t stored = 0;
+        double start = cpu_seconds();
+        for (size_t i = 0; i < blocks; i++) {
+            size_t block_length = (i == blocks - 1) ? length - i * block_size : block_size;
+            packed_lengths[i] = lz_compress(input + i * block_size, block_length, packed + i * lz_bound(block_size), block_length - 1);
+            stored += packed_lengths[i] ? packed_lengths[i] : block_length;
+        }
+        double compress_s = cpu_seconds() - start;
+
+        // decompress and check the round trip
+        start = cpu_seconds();
+        for (size_t i = 0; i < blocks; i++) {
+            size_t block_length = (i == blocks - 1) ? length - i * block_size : block_size;
+            if (packed_lengths[i] == 0) {
+                memcpy(output + i * block_size, input + i * block_size, block_length);
+            } else if (lz_decompress(packed + i * lz_bound(block_size), packed_lengths[i], output + i * block_size, block_length) != (ssize_t)block_length) {
+                printf("%s: block %zu failed to decompress\n", mixes[m].name, i);
+                return 1;
+            }
+        }
+        double decompress_s = cpu_seconds() - start;
+        if (memcmp(input, output, length)) {
+            printf("%s: round trip mismatch\n", mixes[m].name);
+            return 1;
+        }
+
+        // report
+        size_t saved = length - stored;
+        printf("%-12s %10zu %10zu %7.2fx %12.0f %12.0f %14.2f\n", mixes[m].name, length, stored,
+            (double)length / stored, length / compress_s / 1e6, length / decompress_s / 1e6,
+            saved ? compress_s * 1e9 / saved : 0.0);
+    }
+
+    // cleanup
+    free(input);
+    free(packed);
+    free(packed_lengths);
+    free(output);
+    return 0;
+}
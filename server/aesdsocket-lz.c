@@ -0,0 +1,176 @@
+#include "aesdsocket-lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**************************************************************************************************
+ * CONSTANTS
+ **************************************************************************************************/
+
+// as in LZ4, a block ends with at least LZ_LAST_LITERALS literals, and no match starts in its last
+// LZ_MATCH_LIMIT bytes
+#define LZ_LAST_LITERALS            5
+#define LZ_MATCH_LIMIT              12
+
+// a nibble of 15 continues the length in the following bytes
+#define LZ_NIBBLE_MAX               15
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash32(uint32_t sequence) {
+    // multiplicative hash, keeping the high bits
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *write_length(unsigned char *op, size_t length) {
+    // the part of a length past its nibble, in bytes of 255 and a final byte below 255
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char *emit_sequence(unsigned char *op, const unsigned char *oend, const unsigned char *literals,
+    size_t literal_length, size_t offset, size_t match_length) {
+    // check the worst case size of the sequence up front
+    size_t needed = 1 + literal_length / 255 + 1 + literal_length + (match_length ? 2 + match_length / 255 + 1 : 0);
+    if (needed > (size_t)(oend - op)) return NULL;
+
+    // token and literals
+    unsigned char *token = op++;
+    if (literal_length >= LZ_NIBBLE_MAX) {
+        *token = LZ_NIBBLE_MAX << 4;
+        op = write_length(op, literal_length - LZ_NIBBLE_MAX);
+    } else {
+        *token = (unsigned char)(literal_length << 4);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    // the final sequence has no match
+    if (match_length == 0) return op;
+
+    // offset and match length
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    match_length -= LZ_MIN_MATCH;
+    if (match_length >= LZ_NIBBLE_MAX) {
+        *token |= LZ_NIBBLE_MAX;
+        op = write_length(op, match_length - LZ_NIBBLE_MAX);
+    } else {
+        *token |= (unsigned char)match_length;
+    }
+    return op;
+}
+
+static int read_length(const unsigned char **ip, const unsigned char *iend, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= iend) return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+size_t lz_bound(size_t length) {
+    return LZ_BOUND(length);
+}
+
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity) {
+    const unsigned char *base = (const unsigned char *)src;
+    const unsigned char *end = base + length;
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base;
+    unsigned char *op = (unsigned char *)dst;
+    const unsigned char *oend = op + capacity;
+
+    // positions of recent 4 byte sequences, by hash; stale or colliding entries are checked below
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    // find matches, stepping faster through data that does not match
+    if (length > LZ_MATCH_LIMIT) {
+        const unsigned char *match_limit = end - LZ_MATCH_LIMIT;
+        const unsigned char *extend_limit = end - LZ_LAST_LITERALS;
+        while (ip < match_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t hash = hash32(sequence);
+            const unsigned char *candidate = base + table[hash];
+            table[hash] = (uint32_t)(ip - base);
+            if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || read32(candidate) != sequence) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // extend the match as far as it goes
+            size_t match_length = LZ_MIN_MATCH;
+            while (ip + match_length < extend_limit && ip[match_length] == candidate[match_length]) match_length++;
+            op = emit_sequence(op, oend, anchor, ip - anchor, ip - candidate, match_length);
+            if (!op) return 0;
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    // the rest is literals
+    op = emit_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) return 0;
+
+    // return
+    return op - (unsigned char *)dst;
+}
+
+ssize_t lz_decompress(const char *src, size_t length, char *dst, size_t capacity) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + length;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + capacity;
+
+    while (ip < iend) {
+        // literals
+        unsigned char token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == LZ_NIBBLE_MAX && read_length(&ip, iend, &literal_length) == -1) return -1;
+        if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        // the final sequence has no match
+        if (ip == iend) break;
+
+        // match, which may overlap the bytes it produces
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match_length = token & LZ_NIBBLE_MAX;
+        if (match_length == LZ_NIBBLE_MAX && read_length(&ip, iend, &match_length) == -1) return -1;
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst) || match_length > (size_t)(oend - op)) {
+            return -1;
+        }
+        const unsigned char *match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            for (size_t i = 0; i < match_length; i++) *op++ = match[i];
+        }
+    }
+
+    // return
+    return op - (unsigned char *)dst;
+}
@@ -0,0 +1,74 @@
+/**************************************************************************************************
+ * aesdsocket-lz.h
+ *
+ * Built-in fast block compressor, LZ4 style: a greedy LZ77 match finder over a hash of 4 byte
+ * sequences, emitting the LZ4 block format:
+ *      token           high nibble literal length, low nibble match length - LZ_MIN_MATCH;
+ *                      a nibble of 15 continues in following bytes, each added until one is < 255
+ *      literals        literal length bytes, copied verbatim
+ *      offset          2 bytes, little endian, distance back to the match (absent after the last literals)
+ * A block is self contained and carries no length; callers store the decompressed size beside it.
+ * Text made of repeated lines and field names compresses well; random data grows by at most
+ * lz_bound() - length bytes, so callers store such blocks raw instead.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_LZ_H
+#define AESDSOCKET_LZ_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stddef.h>
+#include <sys/types.h>
+
+/**************************************************************************************************
+ * CONSTANTS
+ **************************************************************************************************/
+
+#define LZ_MIN_MATCH                4
+#define LZ_MAX_OFFSET               65535
+#define LZ_HASH_BITS                14          // 16K entry match table, 64 KiB on the compressor's stack
+
+// largest compressed size of length bytes, for sizing buffers at compile time
+#define LZ_BOUND(length)            ((length) + (length) / 255 + 16)
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * lz_bound()
+ *
+ * @param length                    Bytes to compress
+ *
+ * @return largest compressed size of length bytes
+ */
+size_t lz_bound(size_t length);
+
+/**
+ * lz_compress()
+ *
+ * Compresses a block
+ *
+ * @param src                       Bytes to compress
+ * @param length                    Number of bytes in src
+ * @param dst                       Buffer for the compressed block
+ * @param capacity                  Size of dst; lz_bound(length) always suffices
+ *
+ * @return compressed size, 0 if it would not fit in capacity
+ */
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity);
+
+/**
+ * lz_decompress()
+ *
+ * Decompresses a block, checking every length and offset against both buffers
+ *
+ * @param src                       Compressed block
+ * @param length                    Number of bytes in src
+ * @param dst                       Buffer for the decompressed bytes
+ * @param capacity                  Size of dst
+ *
+ * @return decompressed size, -1 if the block is malformed or does not fit in capacity
+ */
+ssize_t lz_decompress(const char *src, size_t length, char *dst, size_t capacity);
+
+#endif /* AESDSOCKET_LZ_H */
@@ -0,0 +1,256 @@
+#include "aesdsocket-metrics.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+/**
+ * struct metrics_histogram_data_t
+ *
+ * @brief bucket counts of a single histogram; bucket i counts values <= base << i
+ */
+typedef struct metrics_histogram_data_t {
+    _Atomic uint64_t                buckets[METRICS_HISTOGRAM_BUCKETS + 1]; // last bucket is +Inf
+    _Atomic uint64_t                sum;                // sum of every recorded value
+} metrics_histogram_data_t;
+
+/**
+ * struct metrics_block_t
+ *
+ * @brief one thread's metrics; only the owning thread writes to it
+ */
+typedef struct metrics_block_t {
+    _Atomic uint64_t                counters[METRIC_COUNTER_COUNT];
+    metrics_histogram_data_t        histograms[METRIC_HISTOGRAM_COUNT];
+    struct metrics_block_t *        next;               // next block in the registry
+} metrics_block_t;
+
+// exposition names and help text
+static const struct {
+    const char *                    name;
+    const char *                    help;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_CONNECTIONS_ACCEPTED] = { "aesdsocket_connections_accepted_total", "Connections accepted." },
+    [METRIC_CONNECTIONS_CLOSED] = { "aesdsocket_connections_closed_total", "Connections closed." },
+    [METRIC_LINES_RECEIVED] = { "aesdsocket_lines_received_total", "Complete lines received from clients." },
+    [METRIC_FRAMES_RECEIVED] = { "aesdsocket_frames_received_total", "Complete binary frames received from clients." },
+    [METRIC_BYTES_RECEIVED] = { "aesdsocket_bytes_received_total", "Bytes received from clients." },
+    [METRIC_BYTES_SENT] = { "aesdsocket_bytes_sent_total", "Bytes sent to clients." },
+    [METRIC_REPLIES_SENT] = { "aesdsocket_replies_total", "Replies sent to clients." },
+    [METRIC_CONNECTIONS_REJECTED] = { "aesdsocket_connections_rejected_total", "Connections refused over max_connections." },
+    [METRIC_RECV_THROTTLED] = { "aesdsocket_recv_throttled_total", "Reads deferred by the per address rate or the in-flight limit." },
+    [METRIC_COMPRESSION_SAVED] = { "aesdsocket_compression_saved_bytes_total", "Bytes saved by compressing replies and sealed segments." },
+};
+
+static const struct {
+    const char *                    name;
+    const char *                    help;
+} gauge_info[METRIC_GAUGE_COUNT] = {
+    [METRIC_ACTIVE_CONNECTIONS] = { "aesdsocket_connections_active", "Client threads in the thread manager." },
+};
+
+static const struct {
+    const char *                    name;
+    const char *                    help;
+    uint64_t                        base;               // upper bound of the first bucket
+    double                          scale;              // converts recorded values to exposition units
+} histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_FILE_LOCK_WAIT] = { "aesdsocket_file_lock_wait_seconds",
+        "Time spent waiting to acquire the data file mutex.", 1000, 1e-9 },
+    [METRIC_RECV_TO_PERSIST] = { "aesdsocket_recv_to_persist_seconds",
+        "Time from receiving a line to writing it to storage.", 1000, 1e-9 },
+    [METRIC_PERSIST_TO_REPLY] = { "aesdsocket_persist_to_reply_seconds",
+        "Time from writing a line to storage to sending the reply.", 1000, 1e-9 },
+    [METRIC_REPLY_SIZE] = { "aesdsocket_reply_size_bytes",
+        "Bytes sent per reply.", 64, 1.0 },
+    [METRIC_SYNC_TIME] = { "aesdsocket_sync_seconds",
+        "Time spent syncing the store to disk.", 1000, 1e-9 },
+    [METRIC_SYNC_BATCH] = { "aesdsocket_sync_batch_appends",
+        "Appends waiting on each sync of the store.", 1, 1.0 },
+    [METRIC_QUEUE_BATCH] = { "aesdsocket_queue_batch_appends",
+        "Appends stored by each write of the line queue.", 1, 1.0 },
+};
+
+// process-wide gauges
+static _Atomic int64_t gauges[METRIC_GAUGE_COUNT];
+
+// registry of live blocks, plus the totals of blocks whose threads have exited
+static metrics_block_t *block_registry = NULL;
+static metrics_block_t retired_block;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// calling thread's block, and the key used to retire it when the thread exits
+static __thread metrics_block_t *thread_block = NULL;
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static inline void owner_add(_Atomic uint64_t *value, uint64_t delta) {
+    // only the owning thread writes, so a relaxed load and store is enough and avoids a locked add
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static void block_accumulate(metrics_block_t *total, metrics_block_t *block) {
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        total->counters[i] += atomic_load_explicit(&block->counters[i], memory_order_relaxed);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        for (int b = 0; b <= METRICS_HISTOGRAM_BUCKETS; b++) {
+            total->histograms[h].buckets[b] +=
+                atomic_load_explicit(&block->histograms[h].buckets[b], memory_order_relaxed);
+        }
+        total->histograms[h].sum += atomic_load_explicit(&block->histograms[h].sum, memory_order_relaxed);
+    }
+}
+
+static void block_retire(void *arg) {
+    // fold the exiting thread's totals into the retired block, under the lock scrapes hold
+    metrics_block_t *block = (metrics_block_t *)arg;
+    pthread_mutex_lock(&registry_mutex);
+    block_accumulate(&retired_block, block);
+    metrics_block_t **link = &block_registry;
+    while (*link != NULL && *link != block) link = &(*link)->next;
+    if (*link != NULL) *link = block->next;
+    pthread_mutex_unlock(&registry_mutex);
+    free(block);
+}
+
+static void block_key_create() {
+    pthread_key_create(&block_key, block_retire);
+}
+
+static metrics_block_t *block_get() {
+    // fast path; the block already exists
+    if (thread_block != NULL) return thread_block;
+
+    // allocate and register a block for this thread
+    pthread_once(&block_key_once, block_key_create);
+    metrics_block_t *block = (metrics_block_t *)calloc(1, sizeof(metrics_block_t));
+    if (!block) return NULL;
+    pthread_setspecific(block_key, block);
+
+    pthread_mutex_lock(&registry_mutex);
+    block->next = block_registry;
+    block_registry = block;
+    pthread_mutex_unlock(&registry_mutex);
+
+    thread_block = block;
+    return block;
+}
+
+static int text_append(char **text, size_t *length, size_t *capacity, const char *format, ...) {
+    va_list args;
+    while (1) {
+        // try to format into the remaining space
+        va_start(args, format);
+        int written = vsnprintf(*text + *length, *capacity - *length, format, args);
+        va_end(args);
+        if (written < 0) return -1;
+        if ((size_t)written < *capacity - *length) {
+            *length += written;
+            return 0;
+        }
+
+        // grow and retry
+        char *new_text = (char *)realloc(*text, *capacity * 2);
+        if (!new_text) return -1;
+        *text = new_text;
+        *capacity *= 2;
+    }
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+void metrics_count(metrics_counter_t counter, uint64_t value) {
+    metrics_block_t *block = block_get();
+    if (block) owner_add(&block->counters[counter], value);
+}
+
+void metrics_gauge_add(metrics_gauge_t gauge, int64_t delta) {
+    atomic_fetch_add_explicit(&gauges[gauge], delta, memory_order_relaxed);
+}
+
+void metrics_observe(metrics_histogram_t histogram, uint64_t value) {
+    metrics_block_t *block = block_get();
+    if (!block) return;
+
+    // find the first bucket whose upper bound holds the value
+    int bucket = 0;
+    uint64_t bound = histogram_info[histogram].base;
+    while (bucket < METRICS_HISTOGRAM_BUCKETS && value > bound) {
+        bound <<= 1;
+        bucket++;
+    }
+
+    owner_add(&block->histograms[histogram].buckets[bucket], 1);
+    owner_add(&block->histograms[histogram].sum, value);
+}
+
+char *metrics_render(size_t *length) {
+    size_t capacity = 8192;
+    char *text = (char *)malloc(capacity);
+    if (!text) return NULL;
+    *length = 0;
+
+    // aggregate every block
+    metrics_block_t total;
+    memset(&total, 0, sizeof(total));
+    pthread_mutex_lock(&registry_mutex);
+    block_accumulate(&total, &retired_block);
+    for (metrics_block_t *block = block_registry; block != NULL; block = block->next) {
+        block_accumulate(&total, block);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    // counters
+    int rc = 0;
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        rc |= text_append(&text, length, &capacity, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+            counter_info[i].name, counter_info[i].help, counter_info[i].name, counter_info[i].name,
+            (unsigned long long)total.counters[i]);
+    }
+
+    // gauges
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        rc |= text_append(&text, length, &capacity, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n",
+            gauge_info[i].name, gauge_info[i].help, gauge_info[i].name, gauge_info[i].name,
+            (long long)atomic_load_explicit(&gauges[i], memory_order_relaxed));
+    }
+
+    // histograms, with cumulative buckets
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char *name = histogram_info[h].name;
+        double scale = histogram_info[h].scale;
+        rc |= text_append(&text, length, &capacity, "# HELP %s %s\n# TYPE %s histogram\n",
+            name, histogram_info[h].help, name);
+
+        uint64_t cumulative = 0;
+        uint64_t bound = histogram_info[h].base;
+        for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++, bound <<= 1) {
+            cumulative += total.histograms[h].buckets[b];
+            rc |= text_append(&text, length, &capacity, "%s_bucket{le=\"%g\"} %llu\n",
+                name, (double)bound * scale, (unsigned long long)cumulative);
+        }
+        cumulative += total.histograms[h].buckets[METRICS_HISTOGRAM_BUCKETS];
+        rc |= text_append(&text, length, &capacity, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n",
+            name, (unsigned long long)cumulative, name, (double)total.histograms[h].sum * scale,
+            name, (unsigned long long)cumulative);
+    }
+
+    // return
+    if (rc != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
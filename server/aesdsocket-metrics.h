@@ -0,0 +1,136 @@
+/**************************************************************************************************
+ * aesdsocket-metrics.h
+ *
+ * Instrumentation for aesdsocket. Every thread counts into its own block of counters and
+ * histograms, written only by that thread, so recording a metric never takes a lock or bounces a
+ * cache line between cores. A scrape sums every live block plus the totals folded in from threads
+ * that have exited, and renders them in the Prometheus text exposition format.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_METRICS_H
+#define AESDSOCKET_METRICS_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**************************************************************************************************
+ * CONSTANTS AND TYPES
+ **************************************************************************************************/
+
+// histogram buckets; each bucket's upper bound is twice the previous one
+#define METRICS_HISTOGRAM_BUCKETS       24
+
+/**
+ * enum metrics_counter_t
+ *
+ * @brief monotonically increasing counters
+ */
+typedef enum metrics_counter_t {
+    METRIC_CONNECTIONS_ACCEPTED,                        // connections accepted
+    METRIC_CONNECTIONS_CLOSED,                          // connections closed
+    METRIC_LINES_RECEIVED,                              // complete lines received from clients
+    METRIC_FRAMES_RECEIVED,                             // complete binary frames received from clients
+    METRIC_BYTES_RECEIVED,                              // bytes received from clients
+    METRIC_BYTES_SENT,                                  // bytes sent to clients
+    METRIC_REPLIES_SENT,                                // replies sent to clients
+    METRIC_COMPRESSION_SAVED,                           // bytes saved by compressing replies and segments
+    METRIC_CONNECTIONS_REJECTED,                        // connections refused by admission control
+    METRIC_RECV_THROTTLED,                              // reads deferred by rate or in-flight limits
+    METRIC_COUNTER_COUNT,
+} metrics_counter_t;
+
+/**
+ * enum metrics_gauge_t
+ *
+ * @brief values that go up and down
+ */
+typedef enum metrics_gauge_t {
+    METRIC_ACTIVE_CONNECTIONS,                          // entries in the thread manager
+    METRIC_GAUGE_COUNT,
+} metrics_gauge_t;
+
+/**
+ * enum metrics_histogram_t
+ *
+ * @brief distributions, recorded in nanoseconds or bytes
+ */
+typedef enum metrics_histogram_t {
+    METRIC_FILE_LOCK_WAIT,                              // time spent waiting for file_mutex (ns)
+    METRIC_RECV_TO_PERSIST,                             // line received to line written (ns)
+    METRIC_PERSIST_TO_REPLY,                            // line written to reply sent (ns)
+    METRIC_REPLY_SIZE,                                  // bytes per reply
+    METRIC_SYNC_TIME,                                   // time spent in a group commit sync (ns)
+    METRIC_SYNC_BATCH,                                  // appenders waiting on a group commit sync
+    METRIC_QUEUE_BATCH,                                 // appends stored by one line queue write
+    METRIC_HISTOGRAM_COUNT,
+} metrics_histogram_t;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * metrics_now_ns()
+ *
+ * Reads the monotonic clock used for latency histograms
+ *
+ * @return current time in nanoseconds
+ */
+static inline uint64_t metrics_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * metrics_count()
+ *
+ * Adds to a counter in the calling thread's block
+ *
+ * @param counter                   Counter to add to
+ * @param value                     Amount to add
+ *
+ * @return none
+ */
+void metrics_count(metrics_counter_t counter, uint64_t value);
+
+/**
+ * metrics_gauge_add()
+ *
+ * Adds to a process-wide gauge
+ *
+ * @param gauge                     Gauge to update
+ * @param delta                     Amount to add, negative to subtract
+ *
+ * @return none
+ */
+void metrics_gauge_add(metrics_gauge_t gauge, int64_t delta);
+
+/**
+ * metrics_observe()
+ *
+ * Records a value into a histogram in the calling thread's block
+ *
+ * @param histogram                 Histogram to record into
+ * @param value                     Value in the histogram's unit (nanoseconds or bytes)
+ *
+ * @return none
+ */
+void metrics_observe(metrics_histogram_t histogram, uint64_t value);
+
+/**
+ * metrics_render()
+ *
+ * Aggregates every thread's block and renders the result in Prometheus text format
+ *
+ * @note caller must free() the returned buffer
+ *
+ * @param length                    Set to the length of the rendered text
+ *
+ * @return the malloc'd text, or NULL on failure
+ */
+char *metrics_render(size_t *length);
+
+#endif /* AESDSOCKET_METRICS_H */
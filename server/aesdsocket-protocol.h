@@ -0,0 +1,90 @@
+/**************************************************************************************************
+ * aesdsocket-protocol.h
+ *
+ * Binary framing protocol for aesdsocket clients. A connection opts in by sending
+ * AESD_BINARY_PREAMBLE as its first bytes; a text client never starts with a NUL byte, so the
+ * newline protocol is unaffected. After the preamble, every request and reply is a frame:
+ *
+ *      struct aesd_frame_header    8 bytes, all fields in network byte order
+ *      payload                     header.length bytes
+ *
+ * Request payloads by opcode:
+ *  - AESD_OP_APPEND    the bytes to append, stored verbatim (may contain '\n')
+ *  - AESD_OP_SEEKTO    struct aesd_frame_seekto
+ *  - AESD_OP_READ      struct aesd_frame_read
+ *  - AESD_OP_STATS     empty
+ * Replies carry the request's opcode with AESD_OP_REPLY set, a status of 0 or an errno value, and:
+ *  - AESD_OP_APPEND    uint64_t size of the store after the append
+ *  - AESD_OP_SEEKTO    uint64_t byte offset the command/offset pair resolved to
+ *  - AESD_OP_READ      the bytes read, at most the requested length
+ *  - AESD_OP_STATS     struct aesd_frame_stats
+ *
+ * A READ request with AESD_FLAG_COMPRESS set accepts a compressed reply. The server sets the flag
+ * on the reply when it compressed the payload, which then holds a uint32_t decompressed length in
+ * network byte order followed by one aesdsocket-lz.h block; otherwise the reply is sent as is.
+ * Servers without compression ignore the flag, so a client can always set it.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_PROTOCOL_H
+#define AESDSOCKET_PROTOCOL_H
+
+#include <stdint.h>
+
+// sent by a client to switch its connection to binary framing
+#define AESD_BINARY_PREAMBLE        "\0AB1"
+#define AESD_BINARY_PREAMBLE_SIZE   4
+
+// opcodes
+#define AESD_OP_APPEND              0x01
+#define AESD_OP_SEEKTO              0x02
+#define AESD_OP_READ                0x03
+#define AESD_OP_STATS               0x04
+#define AESD_OP_REPLY               0x80
+
+// flags
+#define AESD_FLAG_COMPRESS          0x01        // READ: a compressed reply is accepted, or was sent
+
+/**
+ * struct aesd_frame_header
+ *
+ * @brief precedes every frame payload
+ */
+struct aesd_frame_header {
+    uint8_t                         opcode;             // AESD_OP_*, with AESD_OP_REPLY set on replies
+    uint8_t                         flags;              // AESD_FLAG_*, 0 unless negotiating an option
+    uint16_t                        status;             // replies only; 0 on success, errno otherwise
+    uint32_t                        length;             // payload bytes following the header
+} __attribute__((packed));
+
+/**
+ * struct aesd_frame_seekto
+ *
+ * @brief AESD_OP_SEEKTO payload, the same pair as AESDCHAR_IOCSEEKTO
+ */
+struct aesd_frame_seekto {
+    uint32_t                        write_cmd;          // zero referenced write command
+    uint32_t                        write_cmd_offset;   // zero referenced offset within the command
+} __attribute__((packed));
+
+/**
+ * struct aesd_frame_read
+ *
+ * @brief AESD_OP_READ payload
+ */
+struct aesd_frame_read {
+    uint64_t                        offset;             // byte offset to read from
+    uint64_t                        length;             // bytes to read, at most one buffer_size; 0 for one buffer_size
+} __attribute__((packed));
+
+/**
+ * struct aesd_frame_stats
+ *
+ * @brief AESD_OP_STATS reply payload
+ */
+struct aesd_frame_stats {
+    uint64_t                        store_size;         // bytes in the store
+    uint64_t                        frames_received;    // frames received on this connection
+    uint64_t                        bytes_received;     // bytes received on this connection
+    uint64_t                        bytes_sent;         // bytes sent on this connection
+} __attribute__((packed));
+
+#endif /* AESDSOCKET_PROTOCOL_H */
@@ -0,0 +1,146 @@
+#include "aesdsocket-queue.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+
+#include <errno.h>
+
+/**************************************************************************************************
+ * TYPES
+ **************************************************************************************************/
+
+// one append, on the appender's stack; ring entries point at it, with the length of its data
+typedef struct queue_request_t {
+    const char *                    data;
+    size_t                          length;
+    ssize_t                         result;             // under the queue mutex, once done
+    bool                            done;               // under the queue mutex
+} queue_request_t;
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS
+ **************************************************************************************************/
+static void *queue_writer(void *arg) {
+    line_queue_t *queue = (line_queue_t *)arg;
+    queue_request_t *batch[QUEUE_MAX_BATCH];
+    struct iovec iov[QUEUE_MAX_BATCH];
+
+    while (1) {
+        // take everything queued, up to a batch
+        int count = 0;
+        struct aesd_buffer_entry entry;
+        while (count < QUEUE_MAX_BATCH && aesd_atomic_buffer_remove_entry(&queue->buffer, &entry, NULL)) {
+            batch[count] = (queue_request_t *)entry.buffptr;
+            iov[count].iov_base = (void *)batch[count]->data;
+            iov[count].iov_len = batch[count]->length;
+            count++;
+        }
+
+        if (count == 0) {
+            // sleep until an appender queues something, or exit once stopped and drained; the ring is
+            // checked again after announcing the sleep, as appenders check for it after queueing
+            pthread_mutex_lock(&queue->mutex);
+            if (queue->stop) {
+                pthread_mutex_unlock(&queue->mutex);
+                break;
+            }
+            atomic_store_explicit(&queue->sleeping, true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (aesd_atomic_buffer_is_empty(&queue->buffer)) {
+                pthread_cond_wait(&queue->queued_cond, &queue->mutex);
+            }
+            atomic_store_explicit(&queue->sleeping, false, memory_order_relaxed);
+            pthread_mutex_unlock(&queue->mutex);
+            continue;
+        }
+
+        // store the batch with one write
+        ssize_t rc = queue->write(queue->arg, iov, count);
+        if (rc == -1) AESD_LOG(LOG_ERR, "[QUEUE] Writing %d appends failed. (errno %d)", count, errno);
+        metrics_observe(METRIC_QUEUE_BATCH, count);
+
+        // release the appenders; a request is not touched once done, as its appender may return
+        pthread_mutex_lock(&queue->mutex);
+        for (int i = 0; i < count; i++) {
+            batch[i]->result = rc == -1 ? -1 : (ssize_t)batch[i]->length;
+            batch[i]->done = true;
+        }
+        pthread_cond_broadcast(&queue->written_cond);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+    return NULL;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+int queue_start(line_queue_t *queue, queue_write_t write, void *arg) {
+    // any client thread may append
+    aesd_atomic_buffer_init(&queue->buffer, true);
+    queue->write = write;
+    queue->arg = arg;
+    atomic_init(&queue->sleeping, false);
+    queue->stop = false;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->queued_cond, NULL);
+    pthread_cond_init(&queue->written_cond, NULL);
+
+    // start the writer
+    if (pthread_create(&queue->thread, NULL, queue_writer, queue) != 0) {
+        pthread_cond_destroy(&queue->written_cond);
+        pthread_cond_destroy(&queue->queued_cond);
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    queue->running = true;
+    return 0;
+}
+
+void queue_stop(line_queue_t *queue) {
+    if (!queue->running) return;
+
+    // let the writer drain the ring and exit
+    pthread_mutex_lock(&queue->mutex);
+    queue->stop = true;
+    pthread_cond_signal(&queue->queued_cond);
+    pthread_mutex_unlock(&queue->mutex);
+    pthread_join(queue->thread, NULL);
+    queue->running = false;
+
+    // release
+    pthread_cond_destroy(&queue->written_cond);
+    pthread_cond_destroy(&queue->queued_cond);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+ssize_t queue_append(line_queue_t *queue, const char *data, size_t length) {
+    queue_request_t request = { .data = data, .length = length, .result = -1, .done = false };
+    struct aesd_buffer_entry entry = { .buffptr = (const char *)&request, .size = length };
+
+    // queue the request; a full ring waits for the writer to store a batch, which it is busy doing
+    if (!aesd_atomic_buffer_add_entry(&queue->buffer, &entry, false, NULL, NULL)) {
+        pthread_mutex_lock(&queue->mutex);
+        while (!aesd_atomic_buffer_add_entry(&queue->buffer, &entry, false, NULL, NULL)) {
+            pthread_cond_wait(&queue->written_cond, &queue->mutex);
+        }
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    // wake the writer if it went to sleep on an empty ring
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cond_signal(&queue->queued_cond);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    // wait until it is stored
+    pthread_mutex_lock(&queue->mutex);
+    while (!request.done) {
+        pthread_cond_wait(&queue->written_cond, &queue->mutex);
+    }
+    ssize_t result = request.result;
+    pthread_mutex_unlock(&queue->mutex);
+
+    // return
+    return result;
+}
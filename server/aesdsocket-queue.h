@@ -0,0 +1,103 @@
+/**************************************************************************************************
+ * aesdsocket-queue.h
+ *
+ * Optional in-process line queue between the client threads and storage (line_queue = 1). Client
+ * threads hand each append to a lock-free multi-producer ring, the variant of the driver's
+ * circular buffer in aesd-circular-buffer-atomic.h, and wait for it to be written; a single writer
+ * thread drains the ring and stores everything queued with one append. Under load this replaces
+ * one file_mutex acquisition and one writev() per line with one per batch, and appends from
+ * different connections never contend with each other.
+ *
+ * Appends keep their meaning: queue_append() returns once its data is in storage, so the reply
+ * that follows includes it. A full ring makes producers wait for the writer rather than evict.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_QUEUE_H
+#define AESDSOCKET_QUEUE_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "../aesd-char-driver/aesd-circular-buffer-atomic.h"
+
+/**************************************************************************************************
+ * CONSTANTS AND TYPES
+ **************************************************************************************************/
+
+// most appends the writer stores at once
+#define QUEUE_MAX_BATCH             64
+
+/**
+ * queue_write_t
+ *
+ * @brief stores a batch of appends, typically with writev(); bytes written, or -1 on failure
+ */
+typedef ssize_t (*queue_write_t)(void *arg, const struct iovec *iov, int iovcnt);
+
+/**
+ * struct line_queue_t
+ *
+ * @brief the ring and the writer thread draining it
+ */
+typedef struct line_queue_t {
+    struct aesd_atomic_buffer       buffer;             // appends waiting for the writer
+    queue_write_t                   write;              // write function
+    void *                          arg;                // write function argument
+    pthread_t                       thread;
+    pthread_mutex_t                 mutex;
+    pthread_cond_t                  queued_cond;        // signalled to wake a sleeping writer
+    pthread_cond_t                  written_cond;       // broadcast after each batch is stored
+    _Atomic bool                    sleeping;           // the writer found the ring empty
+    bool                            stop;               // under mutex; the writer drains and exits
+    bool                            running;
+} line_queue_t;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * queue_start()
+ *
+ * Initializes a queue and starts its writer thread
+ *
+ * @param queue                     Queue to start
+ * @param write                     Write function, called only from the writer thread
+ * @param arg                       Write function argument
+ *
+ * @return 0 on success, -1 on failure
+ */
+int queue_start(line_queue_t *queue, queue_write_t write, void *arg);
+
+/**
+ * queue_stop()
+ *
+ * Stores everything queued, stops the writer thread and releases the queue; no appender may be
+ * waiting
+ *
+ * @param queue                     Queue to stop
+ *
+ * @return none
+ */
+void queue_stop(line_queue_t *queue);
+
+/**
+ * queue_append()
+ *
+ * Queues data for the writer and waits until it is stored
+ *
+ * @param queue                     Queue
+ * @param data                      Data to append, whole lines; left untouched until this returns
+ * @param length                    Bytes of data
+ *
+ * @return length once stored, -1 if the write failed
+ */
+ssize_t queue_append(line_queue_t *queue, const char *data, size_t length);
+
+#endif /* AESDSOCKET_QUEUE_H */
@@ -0,0 +1,1090 @@
+#include "aesdsocket-seglog.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-commit.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-lz.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/**************************************************************************************************
+ * TYPES AND GLOBALS
+ **************************************************************************************************/
+
+/**
+ * struct seglog_segment_t
+ *
+ * @brief one segment file and its index
+ */
+typedef struct seglog_segment_t {
+    uint64_t                        base_offset;        // absolute offset of the first byte
+    uint64_t                        base_entry;         // entry number of the line holding the first byte
+    bool                            continues_line;     // the first byte continues a line begun in the previous segment
+    int                             fd;                 // segment data
+    int                             index_fd;           // segment index
+    _Atomic uint64_t                size;               // bytes in the segment, published after each write
+    seglog_index_entry_t *          index;              // sparse index, grown while holding the list write lock
+    _Atomic size_t                  index_count;        // entries in index, published after each addition
+    size_t                          index_capacity;     // allocated entries in index
+    time_t                          modified;           // time of the last append, for age retention
+    uint64_t *                      blocks;             // compressed: file offset of each block and of the end, NULL if raw
+    uint32_t                        block_count;        // compressed: blocks in the segment
+    bool                            compress_failed;    // compression failed; left raw until the next open
+} seglog_segment_t;
+
+/**
+ * struct seglog_file_t
+ *
+ * @brief a segment found in the log directory on recovery
+ */
+typedef struct seglog_file_t {
+    uint64_t                        base_offset;        // absolute offset of the first byte
+    bool                            compressed;         // found as a .lz rather than a .log
+} seglog_file_t;
+
+/**
+ * struct seglog_block_cache_t
+ *
+ * @brief the block of a compressed segment a thread decompressed last
+ */
+typedef struct seglog_block_cache_t {
+    uint64_t                        base_offset;        // segment holding the block; offsets are never reused
+    uint32_t                        block;              // block number within the segment
+    bool                            valid;              // data holds a block
+    size_t                          length;             // bytes in data
+    char                            stored[LZ_BOUND(SEGLOG_BLOCK_SIZE)];    // block as stored
+    char                            data[SEGLOG_BLOCK_SIZE];    // block decompressed
+} seglog_block_cache_t;
+
+// per thread block caches, freed when their thread exits
+static __thread seglog_block_cache_t *thread_cache = NULL;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+// log state; the newest segment is the one being appended to
+static struct {
+    char                            path[PATH_MAX];     // log directory
+    size_t                          segment_size;       // size at which segments roll
+    fsync_policy_t                  fsync_policy;       // when appends are synced
+    int                             fsync_interval_ms;  // sync interval of the interval policy
+    uint64_t                        retention_bytes;    // most bytes retained, 0 for no limit
+    int                             retention_s;        // oldest segment age retained, 0 for no limit
+    bool                            compress;           // compress sealed segments
+
+    // segment list; readers hold the read lock, rolling and retention hold the write lock
+    pthread_rwlock_t                list_lock;
+    seglog_segment_t **             segments;
+    size_t                          count;
+    size_t                          capacity;
+
+    // append state, owned by whoever holds append_mutex
+    pthread_mutex_t                 append_mutex;
+    seglog_segment_t *              active;             // newest segment; set under append_mutex and the write lock
+    uint64_t                        end_entry;          // entry number of the next line
+    _Atomic uint64_t                line_end;           // offset just past the last complete line, published before the size
+
+    // offset up to which a partial line is known to be synced, kept in the committed file
+    int                             committed_fd;
+
+    // syncs, by offset
+    commit_group_t                  commit;
+    bool                            open;               // commit is initialized
+
+    // maintenance thread
+    pthread_t                       maintenance_thread;
+    pthread_mutex_t                 maintenance_mutex;
+    pthread_cond_t                  maintenance_cond;
+    bool                            maintenance_running;
+    bool                            maintenance_stop;
+} seglog = {
+    .list_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .append_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .maintenance_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .maintenance_cond = PTHREAD_COND_INITIALIZER,
+    .committed_fd = -1,
+};
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS - SEGMENTS
+ **************************************************************************************************/
+static void segment_path(char *path, size_t size, uint64_t base_offset, const char *extension) {
+    snprintf(path, size, "%s/%020" PRIu64 ".%s", seglog.path, base_offset, extension);
+}
+
+static int segment_load_blocks(seglog_segment_t *segment) {
+    // header, checked against the block layout this build reads
+    seglog_lz_header_t header;
+    struct stat file_stat;
+    if (pread(segment->fd, &header, sizeof(header), 0) != sizeof(header) || fstat(segment->fd, &file_stat) == -1 ||
+        memcmp(header.magic, SEGLOG_LZ_MAGIC, sizeof(header.magic)) || header.block_size != SEGLOG_BLOCK_SIZE ||
+        header.block_count != (header.size + SEGLOG_BLOCK_SIZE - 1) / SEGLOG_BLOCK_SIZE) {
+        return -1;
+    }
+
+    // block table; blocks follow it in order, none larger than a compressed block can be, up to the end of the file
+    size_t table_size = ((size_t)header.block_count + 1) * sizeof(uint64_t);
+    segment->blocks = (uint64_t *)malloc(table_size);
+    if (!segment->blocks || pread(segment->fd, segment->blocks, table_size, sizeof(header)) != (ssize_t)table_size) {
+        return -1;
+    }
+    if (segment->blocks[0] != sizeof(header) + table_size || segment->blocks[header.block_count] != (uint64_t)file_stat.st_size) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < header.block_count; i++) {
+        if (segment->blocks[i + 1] < segment->blocks[i] ||
+            segment->blocks[i + 1] - segment->blocks[i] > LZ_BOUND(SEGLOG_BLOCK_SIZE)) return -1;
+    }
+
+    // size and age as they were when the segment was sealed
+    segment->block_count = header.block_count;
+    atomic_store(&segment->size, header.size);
+    segment->modified = (time_t)header.modified;
+    return 0;
+}
+
+static seglog_segment_t *segment_open(uint64_t base_offset, bool compressed) {
+    char path[PATH_MAX + 32];
+
+    // allocate
+    seglog_segment_t *segment = (seglog_segment_t *)calloc(1, sizeof(seglog_segment_t));
+    if (!segment) return NULL;
+    segment->base_offset = base_offset;
+    segment->index_fd = -1;
+
+    // compressed segments are sealed, so only read
+    if (compressed) {
+        segment_path(path, sizeof(path), base_offset, "lz");
+        segment->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (segment->fd == -1 || segment_load_blocks(segment) == -1) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Error loading %s. (errno %d)", path, errno);
+            if (segment->fd != -1) close(segment->fd);
+            free(segment->blocks);
+            free(segment);
+            return NULL;
+        }
+    }
+
+    // open or create the data and index files
+    segment_path(path, sizeof(path), base_offset, "log");
+    if (!compressed) segment->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (segment->fd == -1) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error opening %s. (errno %d)", path, errno);
+        free(segment);
+        return NULL;
+    }
+    segment_path(path, sizeof(path), base_offset, "idx");
+    segment->index_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (segment->index_fd == -1) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error opening %s. (errno %d)", path, errno);
+        close(segment->fd);
+        free(segment->blocks);
+        free(segment);
+        return NULL;
+    }
+
+    // current size and age; a compressed segment has them from its header
+    struct stat file_stat;
+    if (!compressed) {
+        if (fstat(segment->fd, &file_stat) == 0) {
+            atomic_store(&segment->size, (uint64_t)file_stat.st_size);
+            segment->modified = file_stat.st_mtime;
+        } else {
+            segment->modified = time(NULL);
+        }
+    }
+
+    // return
+    return segment;
+}
+
+static void segment_free(seglog_segment_t *segment, bool remove_files) {
+    char path[PATH_MAX + 32];
+
+    // close
+    close(segment->fd);
+    close(segment->index_fd);
+
+    // remove files
+    if (remove_files) {
+        segment_path(path, sizeof(path), segment->base_offset, "log");
+        unlink(path);
+        segment_path(path, sizeof(path), segment->base_offset, "idx");
+        unlink(path);
+        segment_path(path, sizeof(path), segment->base_offset, "lz");
+        unlink(path);
+    }
+
+    // free
+    free(segment->blocks);
+    free(segment->index);
+    free(segment);
+}
+
+static void block_cache_free(void *cache) {
+    free(cache);
+}
+
+static void block_cache_key_create() {
+    pthread_key_create(&cache_key, block_cache_free);
+}
+
+static seglog_block_cache_t *block_cache_get() {
+    // allocated on a thread's first compressed read
+    if (!thread_cache) {
+        pthread_once(&cache_once, block_cache_key_create);
+        thread_cache = (seglog_block_cache_t *)malloc(sizeof(seglog_block_cache_t));
+        if (!thread_cache) return NULL;
+        thread_cache->valid = false;
+        pthread_setspecific(cache_key, thread_cache);
+    }
+    return thread_cache;
+}
+
+static int segment_load_block(seglog_segment_t *segment, uint32_t block, seglog_block_cache_t *cache) {
+    // blocks are full except the last; a block stored at its full length was stored raw
+    uint64_t block_start = (uint64_t)block * SEGLOG_BLOCK_SIZE;
+    uint64_t size = atomic_load_explicit(&segment->size, memory_order_relaxed);
+    size_t length = size - block_start < SEGLOG_BLOCK_SIZE ? size - block_start : SEGLOG_BLOCK_SIZE;
+    size_t stored = segment->blocks[block + 1] - segment->blocks[block];
+    cache->valid = false;
+    if (stored == length) {
+        if (pread(segment->fd, cache->data, length, segment->blocks[block]) != (ssize_t)length) goto exit_damaged;
+    } else if (pread(segment->fd, cache->stored, stored, segment->blocks[block]) != (ssize_t)stored ||
+        lz_decompress(cache->stored, stored, cache->data, length) != (ssize_t)length) {
+        goto exit_damaged;
+    }
+
+    // cache
+    cache->base_offset = segment->base_offset;
+    cache->block = block;
+    cache->length = length;
+    cache->valid = true;
+    return 0;
+
+exit_damaged:
+    AESD_LOG(LOG_ERR, "[SEGLOG] Block %u of segment %" PRIu64 " is damaged.", block, segment->base_offset);
+    errno = EIO;
+    return -1;
+}
+
+static ssize_t segment_pread(seglog_segment_t *segment, char *buffer, size_t length, uint64_t position) {
+    // raw segments are read directly
+    if (!segment->blocks) return pread(segment->fd, buffer, length, position);
+
+    // compressed segments from the block holding position, decompressed into this thread's cache
+    uint32_t block = position / SEGLOG_BLOCK_SIZE;
+    if (block >= segment->block_count) return 0;
+    seglog_block_cache_t *cache = block_cache_get();
+    if (!cache) return -1;
+    if (!cache->valid || cache->base_offset != segment->base_offset || cache->block != block) {
+        if (segment_load_block(segment, block, cache) == -1) return -1;
+    }
+
+    // copy up to the end of the block
+    size_t within = position - (uint64_t)block * SEGLOG_BLOCK_SIZE;
+    if (within >= cache->length) return 0;
+    if (length > cache->length - within) length = cache->length - within;
+    memcpy(buffer, cache->data + within, length);
+    return length;
+}
+
+static uint64_t segment_end(seglog_segment_t *segment) {
+    return segment->base_offset + atomic_load_explicit(&segment->size, memory_order_acquire);
+}
+
+static int segment_index_add(seglog_segment_t *segment, uint64_t entry, uint64_t offset, bool persist) {
+    // grow the index; readers search it while holding the read lock, so it only moves under the write lock
+    size_t count = atomic_load_explicit(&segment->index_count, memory_order_relaxed);
+    if (count == segment->index_capacity) {
+        size_t new_capacity = segment->index_capacity ? segment->index_capacity * 2 : 64;
+        pthread_rwlock_wrlock(&seglog.list_lock);
+        seglog_index_entry_t *new_index = (seglog_index_entry_t *)realloc(segment->index,
+            new_capacity * sizeof(seglog_index_entry_t));
+        if (new_index) {
+            segment->index = new_index;
+            segment->index_capacity = new_capacity;
+        }
+        pthread_rwlock_unlock(&seglog.list_lock);
+        if (!new_index) return -1;
+    }
+
+    // record the entry, then publish it
+    segment->index[count].entry = entry;
+    segment->index[count].offset = offset;
+    atomic_store_explicit(&segment->index_count, count + 1, memory_order_release);
+
+    // the index is rebuilt on recovery if this write is lost
+    if (persist && write(segment->index_fd, &segment->index[count], sizeof(seglog_index_entry_t)) == -1) {
+        AESD_LOG(LOG_WARNING, "[SEGLOG] Error writing index entry. (errno %d)", errno);
+    }
+
+    // return
+    return 0;
+}
+
+static seglog_index_entry_t *segment_index_last(seglog_segment_t *segment) {
+    return &segment->index[atomic_load_explicit(&segment->index_count, memory_order_acquire) - 1];
+}
+
+static int segment_scan(seglog_segment_t *segment, uint64_t *end_entry, uint64_t *last_line_end) {
+    char chunk[SEGLOG_SCAN_CHUNK];
+
+    // count lines from the last index entry to the end of the segment, indexing them as appends would
+    seglog_index_entry_t last = *segment_index_last(segment);
+    uint64_t entry = last.entry;
+    uint64_t offset = last.offset;
+    uint64_t index_offset = last.offset;
+    uint64_t end = segment_end(segment);
+    if (last.offset != segment->base_offset || !segment->continues_line) *last_line_end = last.offset;
+    while (offset < end) {
+        size_t wanted = end - offset < sizeof(chunk) ? end - offset : sizeof(chunk);
+        ssize_t bytes_read = segment_pread(segment, chunk, wanted, offset - segment->base_offset);
+        if (bytes_read <= 0) return -1;
+        for (ssize_t i = 0; i < bytes_read; i++) {
+            if (chunk[i] != '\n') continue;
+            entry++;
+            *last_line_end = offset + i + 1;
+            if (*last_line_end < end && *last_line_end - index_offset >= SEGLOG_INDEX_INTERVAL) {
+                if (segment_index_add(segment, entry, *last_line_end, true) == -1) return -1;
+                index_offset = *last_line_end;
+            }
+        }
+        offset += bytes_read;
+    }
+    *end_entry = entry;
+
+    // return
+    return 0;
+}
+
+static int segment_recover(seglog_segment_t *segment, bool first, uint64_t base_entry, uint64_t *end_entry,
+    uint64_t *last_line_end) {
+    // load the index, keeping the prefix that is consistent with the segment
+    struct stat index_stat;
+    size_t stored = 0;
+    if (fstat(segment->index_fd, &index_stat) == 0) stored = index_stat.st_size / sizeof(seglog_index_entry_t);
+    uint64_t end = segment_end(segment);
+    size_t valid = 0;
+    seglog_index_entry_t entry, previous = { 0, 0 };
+    char preceding;
+    for (size_t i = 0; i < stored; i++) {
+        if (pread(segment->index_fd, &entry, sizeof(entry), i * sizeof(entry)) != sizeof(entry)) break;
+        bool consistent = (i == 0) ?
+            (entry.offset == segment->base_offset && (first || entry.entry == base_entry)) :
+            (entry.offset > previous.offset && entry.offset <= end && entry.entry > previous.entry &&
+            segment_pread(segment, &preceding, 1, entry.offset - 1 - segment->base_offset) == 1 && preceding == '\n');
+        if (!consistent) break;
+        if (segment_index_add(segment, entry.entry, entry.offset, false) == -1) return -1;
+        previous = entry;
+        valid++;
+    }
+    if (valid < stored) {
+        AESD_LOG(LOG_WARNING, "[SEGLOG] Dropping %zu damaged index entries of segment %" PRIu64 ".",
+            stored - valid, segment->base_offset);
+        if (ftruncate(segment->index_fd, valid * sizeof(seglog_index_entry_t)) == -1) return -1;
+    }
+    if (valid == 0) {
+        AESD_LOG(LOG_WARNING, "[SEGLOG] Rebuilding the index of segment %" PRIu64 ".", segment->base_offset);
+        if (segment_index_add(segment, first ? 0 : base_entry, segment->base_offset, true) == -1) return -1;
+    }
+    segment->base_entry = segment->index[0].entry;
+    segment->continues_line = !first && *last_line_end != segment->base_offset;
+
+    // count the lines after the last index entry, rebuilding any index entries that were lost
+    return segment_scan(segment, end_entry, last_line_end);
+}
+
+static int segment_truncate(seglog_segment_t *segment, uint64_t end) {
+    // drop the bytes and the index entries past the new end
+    if (ftruncate(segment->fd, end - segment->base_offset) == -1) return -1;
+    atomic_store(&segment->size, end - segment->base_offset);
+    size_t count = atomic_load(&segment->index_count);
+    while (count > 1 && segment->index[count - 1].offset > end) count--;
+    atomic_store(&segment->index_count, count);
+    return ftruncate(segment->index_fd, count * sizeof(seglog_index_entry_t));
+}
+
+static int segment_list_add(seglog_segment_t *segment) {
+    // grow the list under the write lock
+    pthread_rwlock_wrlock(&seglog.list_lock);
+    if (seglog.count == seglog.capacity) {
+        size_t new_capacity = seglog.capacity ? seglog.capacity * 2 : 16;
+        seglog_segment_t **new_segments = (seglog_segment_t **)realloc(seglog.segments,
+            new_capacity * sizeof(seglog_segment_t *));
+        if (!new_segments) {
+            pthread_rwlock_unlock(&seglog.list_lock);
+            return -1;
+        }
+        seglog.segments = new_segments;
+        seglog.capacity = new_capacity;
+    }
+    seglog.segments[seglog.count++] = segment;
+    seglog.active = segment;
+    pthread_rwlock_unlock(&seglog.list_lock);
+
+    // return
+    return 0;
+}
+
+static seglog_segment_t *segment_find_offset(uint64_t offset) {
+    // newest segment whose base is at or before offset; caller holds the read lock
+    size_t low = 0, high = seglog.count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (seglog.segments[middle]->base_offset <= offset) low = middle;
+        else high = middle;
+    }
+    return seglog.segments[low];
+}
+
+static uint64_t entry_offset(uint64_t entry) {
+    // entries before the oldest segment start at the oldest segment; caller holds the read lock
+    if (entry <= seglog.segments[0]->base_entry) return seglog.segments[0]->base_offset;
+
+    // newest segment holding the start of the entry; one continuing the entry holds only its end
+    size_t low = 0, high = seglog.count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        seglog_segment_t *candidate = seglog.segments[middle];
+        if (candidate->base_entry < entry || (candidate->base_entry == entry && !candidate->continues_line)) low = middle;
+        else high = middle;
+    }
+    seglog_segment_t *segment = seglog.segments[low];
+
+    // nearest index entry at or before the entry
+    size_t count = atomic_load_explicit(&segment->index_count, memory_order_acquire);
+    size_t index_low = 0, index_high = count;
+    while (index_high - index_low > 1) {
+        size_t middle = (index_low + index_high) / 2;
+        if (segment->index[middle].entry <= entry) index_low = middle;
+        else index_high = middle;
+    }
+
+    // scan forward to the entry, stopping at the end of the segment
+    char chunk[SEGLOG_SCAN_CHUNK];
+    uint64_t current = segment->index[index_low].entry;
+    uint64_t offset = segment->index[index_low].offset;
+    uint64_t end = segment_end(segment);
+    while (current < entry && offset < end) {
+        size_t wanted = end - offset < sizeof(chunk) ? end - offset : sizeof(chunk);
+        ssize_t bytes_read = segment_pread(segment, chunk, wanted, offset - segment->base_offset);
+        if (bytes_read <= 0) break;
+        ssize_t i;
+        for (i = 0; i < bytes_read && current < entry; i++) {
+            if (chunk[i] == '\n') current++;
+        }
+        offset += i;
+    }
+
+    // return
+    return offset < end ? offset : end;
+}
+
+/**************************************************************************************************
+ * PRIVATE FUNCTIONS - SYNC AND MAINTENANCE
+ **************************************************************************************************/
+static int seglog_mark_committed(uint64_t end, bool sync) {
+    // recovery keeps a partial line up to the mark rather than dropping it as a torn append
+    if (pwrite(seglog.committed_fd, &end, sizeof(end), 0) != sizeof(end)) return -1;
+    return sync ? fdatasync(seglog.committed_fd) : 0;
+}
+
+static int seglog_sync_active(void *arg) {
+    // sync the active segment; sealed segments were synced when they rolled
+    pthread_rwlock_rdlock(&seglog.list_lock);
+    seglog_segment_t *active = seglog.segments[seglog.count - 1];
+    uint64_t end = segment_end(active);
+    int rc = fdatasync(active->fd);
+    pthread_rwlock_unlock(&seglog.list_lock);
+
+    // a log synced inside a line, by a binary append, needs the mark; one ending on a line does not
+    if (rc == 0 && atomic_load_explicit(&seglog.line_end, memory_order_relaxed) != end) {
+        rc = seglog_mark_committed(end, true);
+    }
+    return rc;
+}
+
+static void seglog_apply_retention() {
+    time_t now = time(NULL);
+
+    // drop the oldest segments while the log is too big or they are too old; never the active one
+    pthread_rwlock_wrlock(&seglog.list_lock);
+    uint64_t total = segment_end(seglog.segments[seglog.count - 1]) - seglog.segments[0]->base_offset;
+    size_t removed = 0;
+    while (seglog.count - removed > 1) {
+        seglog_segment_t *segment = seglog.segments[removed];
+        uint64_t size = atomic_load(&segment->size);
+        bool too_big = seglog.retention_bytes && total > seglog.retention_bytes;
+        bool too_old = seglog.retention_s && now - segment->modified > seglog.retention_s;
+        if (!too_big && !too_old) break;
+        AESD_LOG(LOG_INFO, "[SEGLOG] Retention removing segment %" PRIu64 ".", segment->base_offset);
+        total -= size;
+        segment_free(segment, true);
+        removed++;
+    }
+    if (removed > 0) {
+        memmove(seglog.segments, seglog.segments + removed, (seglog.count - removed) * sizeof(seglog_segment_t *));
+        seglog.count -= removed;
+    }
+    pthread_rwlock_unlock(&seglog.list_lock);
+}
+
+static int seglog_roll() {
+    // caller holds append_mutex; seal the active segment
+    seglog_segment_t *active = seglog.active;
+    uint64_t end = segment_end(active);
+    if (seglog.fsync_policy != FSYNC_NONE) {
+        if (fdatasync(active->fd) == -1) return -1;
+        fdatasync(active->index_fd);
+        commit_mark_synced(&seglog.commit, end);
+    }
+
+    // start the next segment where the active one ends
+    seglog_segment_t *segment = segment_open(end, false);
+    if (!segment) return -1;
+    segment->base_entry = seglog.end_entry;
+    segment->continues_line = atomic_load_explicit(&seglog.line_end, memory_order_relaxed) != end;
+    if (segment_index_add(segment, seglog.end_entry, end, true) == -1 || segment_list_add(segment) == -1) {
+        segment_free(segment, true);
+        return -1;
+    }
+    AESD_LOG(LOG_DEBUG, "[SEGLOG] Rolled to segment %" PRIu64 ".", end);
+
+    // the log grew by a segment
+    seglog_apply_retention();
+
+    // compress the sealed segment in the background
+    if (seglog.compress) {
+        pthread_mutex_lock(&seglog.maintenance_mutex);
+        pthread_cond_signal(&seglog.maintenance_cond);
+        pthread_mutex_unlock(&seglog.maintenance_mutex);
+    }
+    return 0;
+}
+
+static int seglog_sync_directory() {
+    // makes renames and unlinks in the log directory durable
+    int fd = open(seglog.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int segment_compress(uint64_t base_offset, int source_fd, uint64_t size, time_t modified,
+    uint64_t **blocks, uint64_t *stored_size) {
+    char path[PATH_MAX + 32], temporary[PATH_MAX + 40];
+    uint32_t block_count = (size + SEGLOG_BLOCK_SIZE - 1) / SEGLOG_BLOCK_SIZE;
+    size_t table_size = ((size_t)block_count + 1) * sizeof(uint64_t);
+    int fd = -1;
+
+    // staging buffers; a block is only stored compressed if that makes it smaller
+    char *raw = (char *)malloc(SEGLOG_BLOCK_SIZE);
+    char *packed = (char *)malloc(SEGLOG_BLOCK_SIZE);
+    *blocks = (uint64_t *)malloc(table_size);
+    if (!raw || !packed || !*blocks) goto exit_segment_compress;
+
+    // write the blocks to a temporary file, after room for the header and table
+    segment_path(path, sizeof(path), base_offset, "lz");
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1) goto exit_segment_compress;
+    uint64_t position = sizeof(seglog_lz_header_t) + table_size;
+    for (uint32_t i = 0; i < block_count; i++) {
+        uint64_t block_start = (uint64_t)i * SEGLOG_BLOCK_SIZE;
+        size_t length = size - block_start < SEGLOG_BLOCK_SIZE ? size - block_start : SEGLOG_BLOCK_SIZE;
+        if (pread(source_fd, raw, length, block_start) != (ssize_t)length) goto exit_segment_compress;
+        size_t packed_length = lz_compress(raw, length, packed, length - 1);
+        const char *data = packed_length ? packed : raw;
+        size_t data_length = packed_length ? packed_length : length;
+        (*blocks)[i] = position;
+        if (pwrite(fd, data, data_length, position) != (ssize_t)data_length) goto exit_segment_compress;
+        position += data_length;
+    }
+    (*blocks)[block_count] = position;
+
+    // header and table
+    seglog_lz_header_t header = {
+        .block_size = SEGLOG_BLOCK_SIZE,
+        .size = size,
+        .modified = (int64_t)modified,
+        .block_count = block_count,
+        .reserved = 0,
+    };
+    memcpy(header.magic, SEGLOG_LZ_MAGIC, sizeof(header.magic));
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        pwrite(fd, *blocks, table_size, sizeof(header)) != (ssize_t)table_size) {
+        goto exit_segment_compress;
+    }
+
+    // the compressed file must be complete on disk before it can replace the segment
+    if (seglog.fsync_policy != FSYNC_NONE && fdatasync(fd) == -1) goto exit_segment_compress;
+    if (rename(temporary, path) == -1) goto exit_segment_compress;
+    if (seglog.fsync_policy != FSYNC_NONE) seglog_sync_directory();
+
+    // return
+    free(raw);
+    free(packed);
+    *stored_size = position;
+    return fd;
+
+exit_segment_compress:
+    AESD_LOG(LOG_ERR, "[SEGLOG] Error compressing segment %" PRIu64 ". (errno %d)", base_offset, errno);
+    if (fd != -1) {
+        close(fd);
+        unlink(temporary);
+    }
+    free(raw);
+    free(packed);
+    free(*blocks);
+    *blocks = NULL;
+    return -1;
+}
+
+static bool seglog_maintenance_stopping() {
+    pthread_mutex_lock(&seglog.maintenance_mutex);
+    bool stopping = seglog.maintenance_stop;
+    pthread_mutex_unlock(&seglog.maintenance_mutex);
+    return stopping;
+}
+
+static void seglog_compress_sealed() {
+    while (!seglog_maintenance_stopping()) {
+        // oldest sealed segment still stored raw; its file stays readable through a duplicate descriptor
+        // even if retention removes it meanwhile
+        pthread_rwlock_rdlock(&seglog.list_lock);
+        seglog_segment_t *candidate = NULL;
+        for (size_t i = 0; i + 1 < seglog.count && !candidate; i++) {
+            if (!seglog.segments[i]->blocks && !seglog.segments[i]->compress_failed) candidate = seglog.segments[i];
+        }
+        uint64_t base_offset = 0, size = 0;
+        time_t modified = 0;
+        int source_fd = -1;
+        if (candidate) {
+            base_offset = candidate->base_offset;
+            size = atomic_load(&candidate->size);
+            modified = candidate->modified;
+            source_fd = dup(candidate->fd);
+        }
+        pthread_rwlock_unlock(&seglog.list_lock);
+        if (!candidate || source_fd == -1) return;
+
+        // compress without holding any lock
+        uint64_t *blocks;
+        uint64_t stored_size = 0;
+        int fd = segment_compress(base_offset, source_fd, size, modified, &blocks, &stored_size);
+        close(source_fd);
+
+        // switch the segment over to the compressed file, unless retention removed it
+        pthread_rwlock_wrlock(&seglog.list_lock);
+        seglog_segment_t *segment = NULL;
+        if (base_offset >= seglog.segments[0]->base_offset) {
+            segment = segment_find_offset(base_offset);
+            if (segment->base_offset != base_offset) segment = NULL;
+        }
+        if (segment && fd == -1) {
+            segment->compress_failed = true;
+        } else if (segment) {
+            close(segment->fd);
+            segment->fd = fd;
+            segment->blocks = blocks;
+            segment->block_count = (size + SEGLOG_BLOCK_SIZE - 1) / SEGLOG_BLOCK_SIZE;
+        }
+        pthread_rwlock_unlock(&seglog.list_lock);
+        if (fd == -1) continue;
+
+        // drop whichever copy is no longer used
+        char path[PATH_MAX + 32];
+        segment_path(path, sizeof(path), base_offset, segment ? "log" : "lz");
+        unlink(path);
+        if (!segment) {
+            close(fd);
+            free(blocks);
+            continue;
+        }
+        if (stored_size < size) metrics_count(METRIC_COMPRESSION_SAVED, size - stored_size);
+        AESD_LOG(LOG_DEBUG, "[SEGLOG] Compressed segment %" PRIu64 " from %" PRIu64 " to %" PRIu64 " bytes.",
+            base_offset, size, stored_size);
+    }
+}
+
+static void *seglog_maintenance(void *arg) {
+
+    pthread_mutex_lock(&seglog.maintenance_mutex);
+    while (!seglog.maintenance_stop) {
+        // sleep for one period, or until stopped
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SEGLOG_MAINTENANCE_MS / 1000;
+        deadline.tv_nsec += (long)(SEGLOG_MAINTENANCE_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&seglog.maintenance_cond, &seglog.maintenance_mutex, &deadline);
+        if (seglog.maintenance_stop) break;
+        pthread_mutex_unlock(&seglog.maintenance_mutex);
+
+        // age retention, then the segments sealed since the last pass
+        if (seglog.retention_s) seglog_apply_retention();
+        if (seglog.compress) seglog_compress_sealed();
+
+        pthread_mutex_lock(&seglog.maintenance_mutex);
+    }
+    pthread_mutex_unlock(&seglog.maintenance_mutex);
+    return NULL;
+}
+
+static int compare_files(const void *a, const void *b) {
+    // by offset, a .log before the .lz of the same segment
+    const seglog_file_t *first = (const seglog_file_t *)a, *second = (const seglog_file_t *)b;
+    if (first->base_offset != second->base_offset) return (first->base_offset > second->base_offset) ? 1 : -1;
+    return (int)first->compressed - (int)second->compressed;
+}
+
+static int seglog_recover() {
+    // find the segments in the log directory
+    DIR *directory = opendir(seglog.path);
+    if (directory == NULL) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error opening %s. (errno %d)", seglog.path, errno);
+        return -1;
+    }
+    seglog_file_t *files = NULL;
+    size_t num_files = 0, files_capacity = 0;
+    struct dirent *directory_entry;
+    char path[PATH_MAX + 32];
+    while ((directory_entry = readdir(directory)) != NULL) {
+        uint64_t base;
+        char extension[8];
+        if (sscanf(directory_entry->d_name, "%20" SCNu64 ".%7s", &base, extension) != 2) continue;
+
+        // a compressed segment that was never finished
+        if (!strcmp(extension, "lz.tmp")) {
+            segment_path(path, sizeof(path), base, "lz.tmp");
+            unlink(path);
+            continue;
+        }
+        if (strcmp(extension, "log") && strcmp(extension, "lz")) continue;
+        if (num_files == files_capacity) {
+            files_capacity = files_capacity ? files_capacity * 2 : 16;
+            seglog_file_t *new_files = (seglog_file_t *)realloc(files, files_capacity * sizeof(seglog_file_t));
+            if (!new_files) {
+                free(files);
+                closedir(directory);
+                return -1;
+            }
+            files = new_files;
+        }
+        files[num_files].base_offset = base;
+        files[num_files].compressed = !strcmp(extension, "lz");
+        num_files++;
+    }
+    closedir(directory);
+    qsort(files, num_files, sizeof(seglog_file_t), compare_files);
+
+    // a .lz beside its .log is left by a compression interrupted before the .log was removed
+    size_t kept = 0;
+    for (size_t i = 0; i < num_files; i++) {
+        if (kept > 0 && files[kept - 1].base_offset == files[i].base_offset) {
+            segment_path(path, sizeof(path), files[i].base_offset, "lz");
+            unlink(path);
+            continue;
+        }
+        files[kept++] = files[i];
+    }
+    num_files = kept;
+
+    // recover each segment in order; a gap between segments ends the log
+    int rc = 0;
+    uint64_t end_entry = 0, last_line_end = 0;
+    for (size_t i = 0; i < num_files; i++) {
+        if (seglog.count > 0 && files[i].base_offset != segment_end(seglog.segments[seglog.count - 1])) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Segment %" PRIu64 " does not follow the previous segment; "
+                "dropping it and every later segment.", files[i].base_offset);
+            for (size_t j = i; j < num_files; j++) {
+                segment_path(path, sizeof(path), files[j].base_offset, "log");
+                unlink(path);
+                segment_path(path, sizeof(path), files[j].base_offset, "lz");
+                unlink(path);
+                segment_path(path, sizeof(path), files[j].base_offset, "idx");
+                unlink(path);
+            }
+            break;
+        }
+        seglog_segment_t *segment = segment_open(files[i].base_offset, files[i].compressed);
+        if (!segment || segment_recover(segment, i == 0, end_entry, &end_entry, &last_line_end) == -1 ||
+            segment_list_add(segment) == -1) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Error recovering segment %" PRIu64 ".", files[i].base_offset);
+            if (segment) segment_free(segment, false);
+            rc = -1;
+            break;
+        }
+    }
+    free(files);
+    if (rc == -1) return -1;
+
+    // the committed mark, left by the last sync that ended inside a line
+    snprintf(path, sizeof(path), "%s/committed", seglog.path);
+    seglog.committed_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (seglog.committed_fd == -1) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error opening %s. (errno %d)", path, errno);
+        return -1;
+    }
+    uint64_t committed;
+    if (pread(seglog.committed_fd, &committed, sizeof(committed), 0) != sizeof(committed)) committed = 0;
+
+    // a trailing partial line in the newest segment past the committed mark is an append torn by a
+    // crash; sealed segments were synced when they rolled, so only ever end on whole appends
+    if (seglog.count > 0) {
+        seglog_segment_t *newest = seglog.segments[seglog.count - 1];
+        uint64_t end = segment_end(newest);
+        uint64_t keep = last_line_end > committed ? last_line_end : committed;
+        if (keep < newest->base_offset) keep = newest->base_offset;
+        if (keep < end && !newest->blocks) {
+            AESD_LOG(LOG_WARNING, "[SEGLOG] Dropping %" PRIu64 " bytes of a torn append in segment %" PRIu64 ".",
+                end - keep, newest->base_offset);
+            if (segment_truncate(newest, keep) == -1) return -1;
+        }
+    }
+
+    // appends need a raw segment; start an empty log, or a new segment after a compressed one
+    if (seglog.count == 0 || seglog.segments[seglog.count - 1]->blocks) {
+        uint64_t base = seglog.count ? segment_end(seglog.segments[seglog.count - 1]) : 0;
+        seglog_segment_t *segment = segment_open(base, false);
+        if (!segment) return -1;
+        segment->base_entry = end_entry;
+        segment->continues_line = last_line_end != base;
+        if (segment_index_add(segment, end_entry, base, true) == -1 || segment_list_add(segment) == -1) {
+            segment_free(segment, true);
+            return -1;
+        }
+    }
+    seglog.end_entry = end_entry;
+    atomic_store(&seglog.line_end, last_line_end);
+
+    // return
+    AESD_LOG(LOG_INFO, "[SEGLOG] Opened %s: %zu segments, offsets %" PRIu64 " to %" PRIu64 ", %" PRIu64 " entries.",
+        seglog.path, seglog.count, seglog_start(), seglog_end(), end_entry);
+    return 0;
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS
+ **************************************************************************************************/
+int seglog_open(const server_config_t *new_config) {
+    // settings are fixed while the log is open
+    snprintf(seglog.path, sizeof(seglog.path), "%s", new_config->data_path);
+    seglog.segment_size = new_config->segment_size;
+    seglog.fsync_policy = new_config->fsync_policy;
+    seglog.fsync_interval_ms = new_config->fsync_interval_ms;
+    seglog.retention_bytes = new_config->retention_bytes;
+    seglog.retention_s = new_config->retention_s;
+    seglog.compress = new_config->compress_segments;
+    commit_init(&seglog.commit, seglog_sync_active, NULL, new_config->commit_delay_us, new_config->commit_batch, 0);
+    seglog.open = true;
+
+    // create the log directory on first use
+    if (mkdir(seglog.path, S_IRWXU | S_IRGRP | S_IXGRP) == -1 && errno != EEXIST) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error creating %s. (errno %d)", seglog.path, errno);
+        return -1;
+    }
+
+    // recover the segments left by the previous run, then apply retention to them
+    if (seglog_recover() == -1) {
+        seglog_close();
+        return -1;
+    }
+    seglog_apply_retention();
+    commit_mark_synced(&seglog.commit, seglog_end());
+
+    // start periodic syncs
+    if (seglog.fsync_policy == FSYNC_INTERVAL && commit_start_interval(&seglog.commit, seglog.fsync_interval_ms) == -1) {
+        AESD_LOG(LOG_ERR, "[SEGLOG] Error creating sync thread.");
+        seglog_close();
+        return -1;
+    }
+
+    // start age retention and segment compression
+    if (seglog.retention_s || seglog.compress) {
+        seglog.maintenance_stop = false;
+        if (pthread_create(&seglog.maintenance_thread, NULL, seglog_maintenance, NULL) != 0) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Error creating maintenance thread.");
+            seglog_close();
+            return -1;
+        }
+        seglog.maintenance_running = true;
+    }
+
+    // return
+    return 0;
+}
+
+void seglog_close() {
+    if (!seglog.open) return;
+
+    // stop the maintenance thread
+    if (seglog.maintenance_running) {
+        pthread_mutex_lock(&seglog.maintenance_mutex);
+        seglog.maintenance_stop = true;
+        pthread_cond_signal(&seglog.maintenance_cond);
+        pthread_mutex_unlock(&seglog.maintenance_mutex);
+        pthread_join(seglog.maintenance_thread, NULL);
+        seglog.maintenance_running = false;
+    }
+
+    // leave a clean log behind, then stop syncing; unsynced, a log ending inside a line still needs the mark
+    if (seglog.count > 0 && seglog.fsync_policy != FSYNC_NONE) {
+        commit_written(&seglog.commit, seglog_end());
+        commit_sync(&seglog.commit);
+    } else if (seglog.count > 0 && seglog.committed_fd != -1 && atomic_load(&seglog.line_end) != seglog_end()) {
+        seglog_mark_committed(seglog_end(), false);
+    }
+    if (seglog.committed_fd != -1) {
+        close(seglog.committed_fd);
+        seglog.committed_fd = -1;
+    }
+    commit_destroy(&seglog.commit);
+    seglog.open = false;
+
+    // close every segment
+    for (size_t i = 0; i < seglog.count; i++) {
+        segment_free(seglog.segments[i], false);
+    }
+    free(seglog.segments);
+    seglog.segments = NULL;
+    seglog.active = NULL;
+    seglog.count = 0;
+    seglog.capacity = 0;
+}
+
+ssize_t seglog_append(const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (total == 0) return 0;
+
+    pthread_mutex_lock(&seglog.append_mutex);
+
+    // roll once the active segment is full, on a line boundary unless a line has already filled it;
+    // the active field, not the list, as retention may be moving the list meanwhile
+    seglog_segment_t *active = seglog.active;
+    uint64_t size = atomic_load_explicit(&active->size, memory_order_relaxed);
+    uint64_t line_end = atomic_load_explicit(&seglog.line_end, memory_order_relaxed);
+    bool at_line_start = line_end == active->base_offset + size;
+    if (size > 0 && size + total > seglog.segment_size && (at_line_start || size >= seglog.segment_size)) {
+        if (seglog_roll() == -1) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Error rolling segment. (errno %d)", errno);
+            pthread_mutex_unlock(&seglog.append_mutex);
+            return -1;
+        }
+        active = seglog.active;
+        size = 0;
+    }
+
+    // write at the end of the segment, undoing a short write so the segment always ends on an append
+    uint64_t start = active->base_offset + size;
+    ssize_t written = pwritev(active->fd, iov, iovcnt, size);
+    if (written != (ssize_t)total) {
+        if (written >= 0) errno = ENOSPC;
+        int saved_errno = errno;
+        if (ftruncate(active->fd, size) == -1) {
+            AESD_LOG(LOG_ERR, "[SEGLOG] Error undoing a short write. (errno %d)", errno);
+        }
+        pthread_mutex_unlock(&seglog.append_mutex);
+        errno = saved_errno;
+        return -1;
+    }
+
+    // count the lines appended, indexing line starts one interval apart
+    uint64_t position = start;
+    uint64_t index_offset = segment_index_last(active)->offset;
+    if (at_line_start && start - index_offset >= SEGLOG_INDEX_INTERVAL) {
+        segment_index_add(active, seglog.end_entry, start, true);
+        index_offset = start;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        const char *data = (const char *)iov[i].iov_base;
+        for (size_t j = 0; j < iov[i].iov_len; j++, position++) {
+            if (data[j] != '\n') continue;
+            seglog.end_entry++;
+            uint64_t line_start = position + 1;
+            line_end = line_start;
+            if (line_start < start + total && line_start - index_offset >= SEGLOG_INDEX_INTERVAL) {
+                segment_index_add(active, seglog.end_entry, line_start, true);
+                index_offset = line_start;
+            }
+        }
+    }
+
+    // publish the new size to readers, after the line end so a sync never sees a size newer than it
+    active->modified = time(NULL);
+    atomic_store_explicit(&seglog.line_end, line_end, memory_order_relaxed);
+    atomic_store_explicit(&active->size, size + total, memory_order_release);
+    pthread_mutex_unlock(&seglog.append_mutex);
+
+    // acknowledge only once synced under the group policy
+    if (seglog.fsync_policy == FSYNC_GROUP) {
+        if (commit_wait(&seglog.commit, start + total) == -1) return -1;
+    } else if (seglog.fsync_policy == FSYNC_INTERVAL) {
+        commit_written(&seglog.commit, start + total);
+    }
+
+    // return
+    return total;
+}
+
+ssize_t seglog_read(char *buffer, size_t length, uint64_t offset) {
+    ssize_t bytes_read = 0;
+
+    pthread_rwlock_rdlock(&seglog.list_lock);
+    if (offset < seglog.segments[0]->base_offset) {
+        // removed by retention
+        errno = ERANGE;
+        bytes_read = -1;
+    } else {
+        // read from the segment holding offset, up to its published size
+        seglog_segment_t *segment = segment_find_offset(offset);
+        uint64_t end = segment_end(segment);
+        if (offset < end) {
+            if (length > end - offset) length = end - offset;
+            bytes_read = segment_pread(segment, buffer, length, offset - segment->base_offset);
+        }
+    }
+    pthread_rwlock_unlock(&seglog.list_lock);
+
+    // return
+    return bytes_read;
+}
+
+uint64_t seglog_start() {
+    pthread_rwlock_rdlock(&seglog.list_lock);
+    uint64_t start = seglog.segments[0]->base_offset;
+    pthread_rwlock_unlock(&seglog.list_lock);
+    return start;
+}
+
+uint64_t seglog_end() {
+    pthread_rwlock_rdlock(&seglog.list_lock);
+    uint64_t end = segment_end(seglog.segments[seglog.count - 1]);
+    pthread_rwlock_unlock(&seglog.list_lock);
+    return end;
+}
+
+int seglog_entry_range(uint64_t first, uint64_t last, uint64_t *start, uint64_t *end) {
+    // resolve both ends against the same set of segments
+    pthread_rwlock_rdlock(&seglog.list_lock);
+    *start = entry_offset(first);
+    *end = (last == UINT64_MAX) ? segment_end(seglog.segments[seglog.count - 1]) : entry_offset(last + 1);
+    pthread_rwlock_unlock(&seglog.list_lock);
+
+    // return
+    return (*start < *end) ? 0 : -1;
+}
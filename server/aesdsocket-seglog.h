@@ -0,0 +1,179 @@
+/**************************************************************************************************
+ * aesdsocket-seglog.h
+ *
+ * Segmented append log backend. The store is one byte stream split across segment files in the
+ * data_path directory, each named after the absolute offset of its first byte:
+ *      00000000000000000000.log    segment data, the bytes exactly as appended
+ *      00000000000000000000.idx    sparse index of seglog_index_entry_t pairs, in host byte order
+ *      00000000000000000000.lz     a sealed segment compressed in place of its .log, see below
+ *      committed                   uint64_t offset up to which a partial line is known to be synced
+ * Entries are lines. A segment's index starts with the entry at its first byte, then holds one pair
+ * for the first line starting at least SEGLOG_INDEX_INTERVAL bytes after the previous pair, so an
+ * entry is found with two binary searches and a scan of about one interval.
+ *
+ * Segments roll once they reach segment_size, on a line boundary, or inside a line once that line
+ * alone has filled the segment; such a segment starts with the end of a line held by the previous
+ * one. Offsets and entry numbers are absolute and never reused; retention deletes whole segments
+ * from the front of the log, by total size and by age.
+ *
+ * Durability follows the fsync policy:
+ *  - none          the page cache decides
+ *  - interval      a background thread calls fdatasync() every fsync_interval_ms
+ *  - group         seglog_append() returns once its bytes are synced, through the group commit
+ *                  coordinator in aesdsocket-commit.h
+ * Sealed segments are synced when they roll under every policy but none. A sync that ends inside a
+ * line, after a binary append without a newline, also writes and syncs its end to the committed
+ * file; closing the log writes it under every policy.
+ *
+ * With compress_segments, the maintenance thread compresses each segment once it is sealed. The
+ * data is split into SEGLOG_BLOCK_SIZE blocks compressed independently with aesdsocket-lz.h, so an
+ * offset is read by decompressing one block:
+ *      seglog_lz_header_t          in host byte order
+ *      uint64_t[block_count + 1]   file offset of each block, then of the end of the file
+ *      blocks                      stored raw where compression would not shrink them
+ * Each thread keeps the last block it decompressed, so a sequential read decompresses every block
+ * once. The .lz is complete and synced before it replaces the .log; recovery prefers a .log left
+ * beside a .lz by an interrupted switch.
+ *
+ * Opening the log recovers it: indexes are checked against their segments and rebuilt where they
+ * are missing or damaged, and the newest segment is truncated to its last complete line or to the
+ * committed mark, whichever is later, which drops an append torn by a crash but keeps a synced one.
+ **************************************************************************************************/
+#ifndef AESDSOCKET_SEGLOG_H
+#define AESDSOCKET_SEGLOG_H
+
+/**************************************************************************************************
+ * INCLUDES
+ **************************************************************************************************/
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "aesdsocket-config.h"
+
+/**************************************************************************************************
+ * CONSTANTS AND TYPES
+ **************************************************************************************************/
+
+// bytes between sparse index entries
+#define SEGLOG_INDEX_INTERVAL           4096
+
+// chunk used to scan segments for line boundaries
+#define SEGLOG_SCAN_CHUNK               16384
+
+// interval at which age retention and segment compression run
+#define SEGLOG_MAINTENANCE_MS           1000
+
+// uncompressed bytes per block of a compressed segment
+#define SEGLOG_BLOCK_SIZE               65536
+
+// first bytes of a compressed segment
+#define SEGLOG_LZ_MAGIC                 "ALZ1"
+
+/**
+ * struct seglog_index_entry_t
+ *
+ * @brief a line start recorded in a segment index
+ */
+typedef struct seglog_index_entry_t {
+    uint64_t                        entry;              // entry number of the line
+    uint64_t                        offset;             // absolute offset of its first byte
+} seglog_index_entry_t;
+
+/**
+ * struct seglog_lz_header_t
+ *
+ * @brief start of a compressed segment file
+ */
+typedef struct seglog_lz_header_t {
+    char                            magic[4];           // SEGLOG_LZ_MAGIC
+    uint32_t                        block_size;         // SEGLOG_BLOCK_SIZE when written
+    uint64_t                        size;               // uncompressed bytes in the segment
+    int64_t                         modified;           // time of the last append, for age retention
+    uint32_t                        block_count;        // blocks in the segment
+    uint32_t                        reserved;           // 0
+} seglog_lz_header_t;
+
+/**************************************************************************************************
+ * FUNCTION PROTOTYPES
+ **************************************************************************************************/
+/**
+ * seglog_open()
+ *
+ * Opens or creates the log in new_config->data_path, recovers it and starts the maintenance thread
+ * when age retention or segment compression needs it
+ *
+ * @note must be called after start_daemon(), as it creates a thread
+ *
+ * @param new_config                Configuration with the log directory, segment size, fsync policy
+ *                                  and retention settings
+ *
+ * @return 0 on success, -1 on failure
+ */
+int seglog_open(const server_config_t *new_config);
+
+/**
+ * seglog_close()
+ *
+ * Stops the maintenance thread, syncs the log unless the fsync policy is none, and closes it
+ *
+ * @return none
+ */
+void seglog_close();
+
+/**
+ * seglog_append()
+ *
+ * Appends a set of buffers as one contiguous write. Appends are serialized, so concurrent appends
+ * never interleave. Under the group policy, returns once the bytes are synced.
+ *
+ * @param iov                       Buffers to append
+ * @param iovcnt                    Number of buffers in iov
+ *
+ * @return number of bytes written, -1 on failure
+ */
+ssize_t seglog_append(const struct iovec *iov, int iovcnt);
+
+/**
+ * seglog_read()
+ *
+ * Reads from an absolute offset, stopping at the end of the segment holding it
+ *
+ * @param buffer                    Buffer to read into
+ * @param length                    Most bytes to read
+ * @param offset                    Absolute offset to read from
+ *
+ * @return bytes read, 0 at the end of the log, -1 on failure (ERANGE if retention removed offset)
+ */
+ssize_t seglog_read(char *buffer, size_t length, uint64_t offset);
+
+/**
+ * seglog_start()
+ *
+ * @return absolute offset of the oldest retained byte
+ */
+uint64_t seglog_start();
+
+/**
+ * seglog_end()
+ *
+ * @return absolute offset just past the newest byte
+ */
+uint64_t seglog_end();
+
+/**
+ * seglog_entry_range()
+ *
+ * Resolves a range of entries to absolute offsets. Entries removed by retention resolve to the
+ * oldest retained entry, and entries past the newest one to the end of the log.
+ *
+ * @param first                     First entry
+ * @param last                      Last entry, inclusive
+ * @param start                     Set to the offset of the first entry
+ * @param end                       Set to the offset just past the last entry
+ *
+ * @return 0 on success, -1 if the range holds no bytes
+ */
+int seglog_entry_range(uint64_t first, uint64_t last, uint64_t *start, uint64_t *end);
+
+#endif /* AESDSOCKET_SEGLOG_H */
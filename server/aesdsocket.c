@@ -7,337 +7,1624 @@ int main(int argc, char *argv[]) {
     // return values for functions
     int rc = 0;
 
+    // load configuration from the defaults, the config file and the command line
+    if (config_load(&config, argc, argv) == -1) exit(-1);
+    saved_argc = argc;
+    saved_argv = argv;
+
     // initialize server functions
     initialize_server();
 
-    // getaddrinfo setup - hints
-    syslog(LOG_INFO, "Retrieving server address info.");
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
+    // create, bind and listen on the server sockets
+    listener_set = create_listeners(&config, 0);
+    if (!listener_set) {
+        rc = -1;
+        goto exit_create_listeners;
+    }
+
+    // start daemon if -d flag was passed
+    start_daemon(config.daemon);
+
+    // start draining logs in the background; the drain thread must be created after fork()
+    aesd_log_start();
+
+    // open and recover the storage backend before accepting connections
+    rc = initialize_storage();
+    if (rc == -1) goto exit_initialize_storage;
+
+    // hand appends to a single storage writer, if configured
+    rc = initialize_line_queue();
+    if (rc == -1) goto exit_initialize_storage;
+
+    // start timer
+    initialize_timer(config.timer_interval_s);
+
+    // open metrics endpoint
+    open_metrics(config.metrics_port);
+
+    // accept connections on the listener threads
+    run_listeners(listener_set);
+
+    // service timers and signals - main program loop
+    run_event_loop();
+
+    // stop accepting, drain clients
+    shutdown_server();
+
+// cleanup labels; makes it easier to read code and keep track of frees/closes
+exit_create_listeners:
+    if (rc == -1) AESD_LOG(LOG_ERR, "Exiting listener creation. (errno %d)", errno);
+
+exit_initialize_storage:
+    // server cleanup
+    cleanup_server();
+
+    // return
+    return 0;
+}
+
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS - SERVER
+ **************************************************************************************************/
+void initialize_server() {
+    // open syslog through the asynchronous logger
+    aesd_log_init(config.log_level);
+
+    // block shutdown signals before any thread is created, so every thread inherits the mask and the
+    // signals are only ever consumed by the event loop through signal_fd
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    sigaddset(&signal_mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+    signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        AESD_LOG(LOG_ERR, "Creating signalfd failed. (errno %d)", errno);
+    }
+
+    // peers closing early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // create shutdown notification
+    shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_fd == -1) {
+        AESD_LOG(LOG_ERR, "Creating shutdown eventfd failed. (errno %d)", errno);
+    }
+
+    // initialize thread manager
+    SLIST_INIT(&thread_manager);
+
+    // apply connection and rate limits
+    admission_configure(&config);
+
+    // return
+    return;
+}
+
+int initialize_storage() {
+    // open the log, recovering it from the previous run
+    if (config.backend == BACKEND_SEGLOG) {
+        if (seglog_open(&config) == -1) {
+            AESD_LOG(LOG_ERR, "Opening segmented log %s failed.", config.data_path);
+            return -1;
+        }
+        return 0;
+    }
+
+    // the device is opened per connection
+    if (config.backend != BACKEND_FILE) return 0;
+
+    // map the data file for replies; reads fall back to pread() if it cannot be mapped
+    if (config.mmap_reads && filemap_open(config.data_path) == -1) {
+        AESD_LOG(LOG_WARNING, "Mapping %s failed, reading it with pread().", config.data_path);
+    }
+
+    // an unsynced data file needs nothing more
+    if (config.fsync_policy == FSYNC_NONE) return 0;
+
+    // keep the data file open for syncing
+    storage_fd = open(config.data_path, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (storage_fd == -1) {
+        AESD_LOG(LOG_ERR, "Opening %s failed. (errno %d)", config.data_path, errno);
+        return -1;
+    }
+    off_t size = lseek(storage_fd, 0, SEEK_END);
+    commit_init(&storage_commit, storage_sync, NULL, config.commit_delay_us, config.commit_batch,
+        size > 0 ? (uint64_t)size : 0);
+    storage_commit_open = true;
+    if (config.fsync_policy == FSYNC_INTERVAL && commit_start_interval(&storage_commit, config.fsync_interval_ms) == -1) {
+        AESD_LOG(LOG_ERR, "Creating sync thread failed.");
+        return -1;
+    }
+
+    // return
+    return 0;
+}
+
+int initialize_line_queue() {
+    if (!config.line_queue) return 0;
+
+    // the writer appends through its own descriptor; the segmented log needs none
+    if (config.backend != BACKEND_SEGLOG) {
+        queue_fd = open(config.data_path, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (queue_fd == -1) {
+            AESD_LOG(LOG_ERR, "Opening %s for the line queue failed. (errno %d)", config.data_path, errno);
+            return -1;
+        }
+    }
+
+    // start the writer
+    if (queue_start(&line_queue, storage_queue_write, NULL) == -1) {
+        AESD_LOG(LOG_ERR, "Creating line queue writer failed.");
+        return -1;
+    }
+    line_queue_open = true;
+    AESD_LOG(LOG_INFO, "Appends go through the line queue.");
+
+    // return
+    return 0;
+}
+
+int storage_sync(void *arg) {
+    return fdatasync(storage_fd);
+}
+
+ssize_t storage_queue_write(void *arg, const struct iovec *iov, int iovcnt) {
+    return storage_append(queue_fd, iov, iovcnt);
+}
+
+void initialize_timer(int interval_s) {
+    // the aesdchar device is not timestamped
+    if (config.backend == BACKEND_AESDCHAR) return;
+
+    // create the timerfd; it is read by the event loop, so no signal ever interrupts a client thread
+    if (timer_fd == -1) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd == -1) {
+            AESD_LOG(LOG_ERR, "Creating timer failed");
+            return;
+        }
+    }
+
+    // configure the timer's interval value; an interval of 0 disarms the timer
+    struct itimerspec timer_spec;
+    timer_spec.it_value.tv_sec = interval_s;
+    timer_spec.it_value.tv_nsec = 0;
+    timer_spec.it_interval.tv_sec = interval_s;
+    timer_spec.it_interval.tv_nsec = 0;
+
+    if (timerfd_settime(timer_fd, 0, &timer_spec, NULL) == -1) {
+        AESD_LOG(LOG_ERR, "Setting timer failed");
+        return;
+    }
+
+    // keep the data file open for the timer instead of reopening it on every expiry
+    if (config.backend == BACKEND_FILE && timestamp_fd == -1) {
+        timestamp_fd = open(config.data_path, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (timestamp_fd == -1) {
+            AESD_LOG(LOG_ERR, "[TIMER] Error opening timestamp file. (errno %d)", errno);
+        }
+    }
+
+    // success; return
+    AESD_LOG(LOG_INFO, "Timer set successfully. (interval %d s)", interval_s);
+}
+
+void run_event_loop() {
+    while (1) {
+        // gather the control file descriptors
+        struct pollfd poll_fds[2];
+        nfds_t num_fds = 0;
+        if (signal_fd != -1) {
+            poll_fds[num_fds].fd = signal_fd;
+            poll_fds[num_fds].events = POLLIN;
+            num_fds++;
+        }
+        if (timer_fd != -1) {
+            poll_fds[num_fds].fd = timer_fd;
+            poll_fds[num_fds].events = POLLIN;
+            num_fds++;
+        }
+
+        // wait for events
+        if (poll(poll_fds, num_fds, -1) == -1) {
+            if (errno == EINTR) continue;
+            AESD_LOG(LOG_ERR, "poll() failed. (errno %d)", errno);
+            return;
+        }
+
+        // dispatch events
+        for (nfds_t i = 0; i < num_fds; i++) {
+            if (!(poll_fds[i].revents & POLLIN)) continue;
+
+            if (poll_fds[i].fd == signal_fd) {
+                // signals are handled here, outside of signal context
+                struct signalfd_siginfo siginfo;
+                if (read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo) &&
+                    !handle_signal((int)siginfo.ssi_signo)) {
+                    return;
+                }
+            } else if (poll_fds[i].fd == timer_fd) {
+                // one timestamp per wakeup, even if several intervals elapsed
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    AESD_LOG(LOG_INFO, "[TIMER] Timer expired, writing to file.");
+                    append_timestamp();
+                }
+            }
+        }
+    }
+}
+
+int open_metrics(const char *port) {
+    // close the current endpoint
+    close_metrics();
+    if (!strcmp(port, "0")) return 0;
+
+    // bind to loopback only; the endpoint is for local scrapers
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *address_info = NULL;
+    if (getaddrinfo("127.0.0.1", port, &hints, &address_info) != 0) {
+        AESD_LOG(LOG_ERR, "[METRICS] getaddrinfo() failed for port %s", port);
+        return -1;
+    }
+
+    int optval = 1;
+    metrics_fd = socket(address_info->ai_family, address_info->ai_socktype | SOCK_CLOEXEC, address_info->ai_protocol);
+    if (metrics_fd == -1 ||
+        setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1 ||
+        bind(metrics_fd, address_info->ai_addr, address_info->ai_addrlen) == -1 ||
+        listen(metrics_fd, LISTEN_BACKLOG) == -1) {
+        AESD_LOG(LOG_ERR, "[METRICS] Opening metrics endpoint on port %s failed. (errno %d)", port, errno);
+        if (metrics_fd != -1) close(metrics_fd);
+        metrics_fd = -1;
+        freeaddrinfo(address_info);
+        return -1;
+    }
+
+    freeaddrinfo(address_info);
+
+    // serve it from its own thread
+    metrics_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (metrics_wake_fd == -1 || pthread_create(&metrics_thread, NULL, metrics_listener, NULL) != 0) {
+        AESD_LOG(LOG_ERR, "[METRICS] Starting metrics thread failed.");
+        if (metrics_wake_fd != -1) close(metrics_wake_fd);
+        metrics_wake_fd = -1;
+        close(metrics_fd);
+        metrics_fd = -1;
+        return -1;
+    }
+
+    // return
+    AESD_LOG(LOG_INFO, "[METRICS] Serving metrics on 127.0.0.1:%s", port);
+    return 0;
+}
+
+void close_metrics() {
+    if (metrics_fd == -1) return;
+
+    // wake the thread and wait for the scrape in progress, if any
+    uint64_t value = 1;
+    if (write(metrics_wake_fd, &value, sizeof(value)) != sizeof(value)) {
+        AESD_LOG(LOG_ERR, "[METRICS] Waking metrics thread failed. (errno %d)", errno);
+    }
+    pthread_join(metrics_thread, NULL);
+    close(metrics_wake_fd);
+    metrics_wake_fd = -1;
+    close(metrics_fd);
+    metrics_fd = -1;
+}
+
+void *metrics_listener(void *arg) {
+    struct pollfd poll_fds[2] = {
+        { .fd = metrics_wake_fd, .events = POLLIN },
+        { .fd = metrics_fd, .events = POLLIN },
+    };
+    while (1) {
+        if (poll(poll_fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            AESD_LOG(LOG_ERR, "[METRICS] poll() failed. (errno %d)", errno);
+            break;
+        }
+        if (poll_fds[0].revents & POLLIN) break;
+        if (poll_fds[1].revents & POLLIN) serve_metrics();
+    }
+    return NULL;
+}
+
+void serve_metrics() {
+    // accept the scraper
+    int scrape_fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (scrape_fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) AESD_LOG(LOG_ERR, "[METRICS] accept() failed. (errno %d)", errno);
+        return;
+    }
+
+    // consume the request, so closing the socket does not reset the connection before the reply is read
+    struct pollfd request_fd = { .fd = scrape_fd, .events = POLLIN };
+    char request[1024];
+    if (poll(&request_fd, 1, METRICS_REQUEST_TIMEOUT_MS) > 0) {
+        while (recv(scrape_fd, request, sizeof(request), 0) > 0);
+    }
+
+    // render and send the reply
+    size_t body_length = 0;
+    char *body = metrics_render(&body_length);
+    if (body != NULL) {
+        char header[128];
+        int header_length = snprintf(header, sizeof(header),
+            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+            body_length);
+        struct iovec reply[2] = {
+            { .iov_base = header, .iov_len = header_length },
+            { .iov_base = body, .iov_len = body_length },
+        };
+        struct iovec *iov = reply;
+        int iovcnt = 2;
+        request_fd.events = POLLOUT;
+        while (iovcnt > 0) {
+            struct msghdr message = { .msg_iov = iov, .msg_iovlen = iovcnt };
+            ssize_t bytes_sent = sendmsg(scrape_fd, &message, MSG_NOSIGNAL);
+            if (bytes_sent == -1) {
+                // wait a bounded time for a scraper that is slow to read
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) && poll(&request_fd, 1, METRICS_REQUEST_TIMEOUT_MS) > 0) continue;
+                if (errno == EINTR) continue;
+                AESD_LOG(LOG_ERR, "[METRICS] Sending metrics failed. (errno %d)", errno);
+                break;
+            }
+
+            // skip what was sent
+            while (iovcnt > 0 && (size_t)bytes_sent >= iov->iov_len) {
+                bytes_sent -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (char *)iov->iov_base + bytes_sent;
+                iov->iov_len -= bytes_sent;
+            }
+        }
+        free(body);
+    }
+
+    // close scrape connection
+    shutdown(scrape_fd, SHUT_WR);
+    close(scrape_fd);
+}
+
+ssize_t tmpdata_append(int fd, const struct iovec *iov, int iovcnt) {
+    // hand single buffer appends to the storage writer, which stores them with other connections'
+    if (line_queue_open && iovcnt == 1) return queue_append(&line_queue, iov->iov_base, iov->iov_len);
+    return storage_append(fd, iov, iovcnt);
+}
+
+ssize_t storage_append(int fd, const struct iovec *iov, int iovcnt) {
+    // the segmented log serializes its own appends, and may wait for them to be synced
+    if (config.backend == BACKEND_SEGLOG) return seglog_append(iov, iovcnt);
+
+    // single writev under the file mutex; O_APPEND leaves the offset at the end of this append
+    uint64_t wait_start_ns = metrics_now_ns();
+    pthread_mutex_lock(&file_mutex);
+    metrics_observe(METRIC_FILE_LOCK_WAIT, metrics_now_ns() - wait_start_ns);
+    ssize_t bytes_written = writev(fd, iov, iovcnt);
+    off_t position = ((storage_commit_open || filemap_is_open()) && bytes_written > 0) ? lseek(fd, 0, SEEK_CUR) : -1;
+
+    // let mapped readers see the append; publishing is serialized by the file mutex
+    if (position != -1 && filemap_is_open()) filemap_publish(position);
+    pthread_mutex_unlock(&file_mutex);
+
+    // sync outside the file mutex, so concurrent appends can share the sync
+    if (position != -1 && storage_commit_open) {
+        if (config.fsync_policy == FSYNC_GROUP) {
+            if (commit_wait(&storage_commit, position) == -1) return -1;
+        } else {
+            commit_written(&storage_commit, position);
+        }
+    }
+
+    // return
+    return bytes_written;
+}
+
+void cleanup_server() {
+    // clean thread manager
+    thread_entry_freeall();
+
+    // close event loop file descriptors
+    if (signal_fd != -1) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    if (shutdown_fd != -1) {
+        close(shutdown_fd);
+        shutdown_fd = -1;
+    }
+    if (timer_fd != -1) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    close_metrics();
+    if (timestamp_fd != -1) {
+        close(timestamp_fd);
+        timestamp_fd = -1;
+    }
+
+    // attempt to close listening sockets
+    close_listeners(listener_set);
+    listener_set = NULL;
+
+    // store whatever is still queued; every client thread has been joined
+    if (line_queue_open) {
+        queue_stop(&line_queue);
+        line_queue_open = false;
+    }
+    if (queue_fd != -1) {
+        close(queue_fd);
+        queue_fd = -1;
+    }
+
+    // flush a synced data file
+    if (storage_commit_open) {
+        commit_sync(&storage_commit);
+        commit_destroy(&storage_commit);
+        storage_commit_open = false;
+    }
+    if (storage_fd != -1) {
+        close(storage_fd);
+        storage_fd = -1;
+    }
+
+    // unmap the data file
+    filemap_close();
+
+    // remove tmpdata file if it is not a char driver, unless it is synced for durability; the
+    // segmented log persists across runs
+    if (config.backend == BACKEND_FILE && config.fsync_policy == FSYNC_NONE) {
+        remove(config.data_path);
+    } else if (config.backend == BACKEND_SEGLOG) {
+        seglog_close();
+    }
+
+    // release the client thread attributes
+    if (num_process_cpus > 0) {
+        pthread_attr_destroy(&client_thread_attr);
+        num_process_cpus = 0;
+    }
+
+    // flush pending log messages and close syslog
+    aesd_log_shutdown();
+}
+
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS - LISTENERS
+ **************************************************************************************************/
+listener_set_t *create_listeners(const server_config_t *listen_config, int steer_offset) {
+    // read the cpus the process may run on once, before any accept loop is pinned
+    if (num_process_cpus == 0) {
+        if (sched_getaffinity(0, sizeof(process_cpus), &process_cpus) == -1) {
+            AESD_LOG(LOG_ERR, "sched_getaffinity() failed, assuming cpu 0 only. (errno %d)", errno);
+            CPU_ZERO(&process_cpus);
+            CPU_SET(0, &process_cpus);
+        }
+        num_process_cpus = CPU_COUNT(&process_cpus);
+        pthread_attr_init(&client_thread_attr);
+        if (pthread_attr_setaffinity_np(&client_thread_attr, sizeof(process_cpus), &process_cpus) != 0) {
+            AESD_LOG(LOG_ERR, "Setting client thread affinity failed.");
+        }
+    }
+
+    // default to one listener per cpu
+    int count = listen_config->workers;
+    if (count <= 0) count = listen_config->reuseport ? num_process_cpus : 1;
+    if (!listen_config->reuseport) count = 1;
+
+    // getaddrinfo setup - hints
+    AESD_LOG(LOG_INFO, "Retrieving server address info.");
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    // get address info, storing it into address_info
+    struct addrinfo *address_info = NULL;
+    int rc = getaddrinfo(NULL, listen_config->port, &hints, &address_info);
+    if (rc != 0) {
+        AESD_LOG(LOG_ERR, "getaddrinfo() failed. (%s)", gai_strerror(rc));
+        return NULL;
+    }
+
+    // the wildcard addresses usually come back as both 0.0.0.0 and ::; when both are present each
+    // family gets its own sockets, so the IPv6 ones must not claim IPv4 through mapped addresses
+    int num_addresses = 0;
+    bool has_ipv4 = false;
+    for (struct addrinfo *address = address_info; address; address = address->ai_next) {
+        num_addresses++;
+        if (address->ai_family == AF_INET) has_ipv4 = true;
+    }
+
+    // allocate the set, its listeners, and the eventfd used to stop their accept loops
+    listener_set_t *set = (listener_set_t *)calloc(1, sizeof(listener_set_t));
+    int *cpus = (int *)calloc((size_t)count, sizeof(int));
+    if (set) set->listeners = (listener_t *)calloc((size_t)count * num_addresses, sizeof(listener_t));
+    if (!set || !set->listeners || !cpus) {
+        AESD_LOG(LOG_ERR, "Error malloc'ing listeners");
+        free(cpus);
+        if (set) free(set->listeners);
+        free(set);
+        freeaddrinfo(address_info);
+        return NULL;
+    }
+    set->group_size = count;
+    set->steer_offset = steer_offset;
+    atomic_init(&set->hand_off, false);
+    set->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (set->stop_fd == -1) goto exit_listener;
+
+    // a reuseport group of count sockets per address
+    for (struct addrinfo *address = address_info; address; address = address->ai_next) {
+        char address_string[CLIENT_ADDRESS_STRLEN];
+        format_address(address->ai_addr, address_string, sizeof(address_string));
+        int group = set->count;
+        if (listen_config->reuseport) listener_cpus(cpus, count);
+
+        for (int i = 0; i < count; i++) {
+            listener_t *listener = &set->listeners[set->count];
+            listener->set = set;
+            listener->cpu = listen_config->reuseport ? cpus[i] : -1;
+
+            // create server socket, non-blocking so a stopping accept loop can empty its queue; a
+            // family the kernel was built without is skipped
+            AESD_LOG(LOG_INFO, "Creating server socket %d for %s.", i, address_string);
+            listener->socket_fd = socket(
+                address->ai_family,
+                address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                address->ai_protocol
+            );
+            if (listener->socket_fd == -1 && errno == EAFNOSUPPORT && i == 0) {
+                AESD_LOG(LOG_WARNING, "Skipping %s, address family not supported.", address_string);
+                break;
+            }
+            if (listener->socket_fd == -1) goto exit_listener;
+            set->count++;
+
+            // SO_REUSEADDR and SO_REUSEPORT are separate options and must be set with separate calls
+            int optval = 1;
+            if (setsockopt(listener->socket_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1) {
+                AESD_LOG(LOG_ERR, "Setting SO_REUSEADDR failed. (errno %d)", errno);
+            }
+            if (listen_config->reuseport &&
+                setsockopt(listener->socket_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+                AESD_LOG(LOG_ERR, "Setting SO_REUSEPORT failed. (errno %d)", errno);
+                goto exit_listener;
+            }
+            if (address->ai_family == AF_INET6 && has_ipv4 &&
+                setsockopt(listener->socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval)) == -1) {
+                AESD_LOG(LOG_ERR, "Setting IPV6_V6ONLY failed. (errno %d)", errno);
+                goto exit_listener;
+            }
+
+            // bind name to socket; the bind order defines the socket's index in the reuseport group
+            AESD_LOG(LOG_INFO, "Binding server socket %d for %s.", i, address_string);
+            if (bind(listener->socket_fd, address->ai_addr, address->ai_addrlen) == -1) goto exit_listener;
+
+            // listen on port
+            AESD_LOG(LOG_INFO, "Socket %d listening on %s port %s (backlog %d, cpu %d)", i, address_string,
+                listen_config->port, listen_config->backlog, listener->cpu);
+            if (listen(listener->socket_fd, listen_config->backlog) == -1) goto exit_listener;
+        }
+
+        // steer connections by receiving CPU; without it the kernel falls back to hashing the 4-tuple.
+        // A running set's sockets come first in the group, so steering past them hands every new
+        // connection to this set while they are stopped
+        int group_count = set->count - group;
+        if ((USE_REUSEPORT_CBPF && group_count > 1) || (steer_offset > 0 && group_count > 0)) {
+            attach_reuseport_cbpf(set->listeners[group].socket_fd, steer_offset, group_count);
+        }
+    }
+    if (set->count == 0) {
+        AESD_LOG(LOG_ERR, "No address to listen on for port %s.", listen_config->port);
+        goto exit_listener;
+    }
+
+    // return
+    free(cpus);
+    freeaddrinfo(address_info);
+    return set;
+
+exit_listener:
+    AESD_LOG(LOG_ERR, "Creating listener failed. (errno %d)", errno);
+    free(cpus);
+    freeaddrinfo(address_info);
+    close_listeners(set);
+    return NULL;
+}
+
+int attach_reuseport_cbpf(int socket_fd, int offset, int count) {
+    // return (offset + receiving cpu % count) as the index of the socket in the reuseport group
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)count },
+        { BPF_ALU | BPF_ADD | BPF_K, 0, 0, (uint32_t)offset },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog program = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        AESD_LOG(LOG_ERR, "Attaching reuseport CBPF program failed. (errno %d)", errno);
+        return -1;
+    }
+
+    // return
+    AESD_LOG(LOG_INFO, "Attached reuseport CBPF program across %d listeners from index %d.", count, offset);
+    return 0;
+}
+
+void settle_listeners(listener_set_t *set) {
+    if (set->steer_offset == 0) return;
+
+    // the previous set has left every group; steer across this set alone, or go back to hashing
+    for (int group = 0; group < set->count; group += set->group_size) {
+        int socket_fd = set->listeners[group].socket_fd;
+        int optval = 0;
+        if (USE_REUSEPORT_CBPF && set->group_size > 1) {
+            attach_reuseport_cbpf(socket_fd, 0, set->group_size);
+        } else if (setsockopt(socket_fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF, &optval, sizeof(optval)) == -1) {
+            AESD_LOG(LOG_ERR, "Detaching reuseport CBPF program failed. (errno %d)", errno);
+        }
+    }
+    set->steer_offset = 0;
+}
+
+void run_listeners(listener_set_t *set) {
+    // spawn an accept loop per listener
+    for (int i = 0; i < set->count; i++) {
+        if (pthread_create(&set->listeners[i].thread_id, NULL, listener_thread, &set->listeners[i]) != 0) {
+            AESD_LOG(LOG_ERR, "Error creating accept thread for listener %d", i);
+            set->listeners[i].thread_id = 0;
+        }
+    }
+}
+
+void listener_cpus(int *cpus, int count) {
+    cpu_set_t claimed;
+    CPU_ZERO(&claimed);
+
+    // a cpu steered to the listener, if the process may run on one; steered cpus never collide
+    for (int i = 0; i < count; i++) {
+        cpus[i] = -1;
+        for (int cpu = i; cpu < CPU_SETSIZE; cpu += count) {
+            if (CPU_ISSET(cpu, &process_cpus)) {
+                cpus[i] = cpu;
+                CPU_SET(cpu, &claimed);
+                break;
+            }
+        }
+    }
+
+    // the rest take the unclaimed cpus, then the allowed cpus in turn
+    int next = 0, shared = -1;
+    for (int i = 0; i < count; i++) {
+        if (cpus[i] != -1) continue;
+        while (next < CPU_SETSIZE && (!CPU_ISSET(next, &process_cpus) || CPU_ISSET(next, &claimed))) next++;
+        if (next < CPU_SETSIZE) {
+            cpus[i] = next++;
+            continue;
+        }
+        do {
+            shared = (shared + 1) % CPU_SETSIZE;
+        } while (!CPU_ISSET(shared, &process_cpus));
+        cpus[i] = shared;
+    }
+}
+
+void stop_listeners(listener_set_t *set, bool hand_off) {
+    if (!set) return;
+
+    // wake every accept loop
+    atomic_store(&set->hand_off, hand_off);
+    uint64_t notify = 1;
+    if (set->stop_fd != -1 && write(set->stop_fd, &notify, sizeof(notify)) != sizeof(notify)) {
+        AESD_LOG(LOG_ERR, "Stopping listeners failed. (errno %d)", errno);
+    }
+
+    // wait for them to return
+    for (int i = 0; i < set->count; i++) {
+        if (set->listeners[i].thread_id != 0) {
+            pthread_join(set->listeners[i].thread_id, NULL);
+            set->listeners[i].thread_id = 0;
+        }
+    }
+}
+
+void close_listeners(listener_set_t *set) {
+    if (!set) return;
+
+    // close every socket that was created
+    for (int i = 0; i < set->count; i++) {
+        close(set->listeners[i].socket_fd);
+    }
+    if (set->stop_fd != -1) close(set->stop_fd);
+
+    // free listeners
+    free(set->listeners);
+    free(set);
+}
+
+void *listener_thread(void *arg) {
+    listener_t *listener = (listener_t *)arg;
+
+    // pin the accept loop to the listener's cpu
+    if (listener->cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(listener->cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            AESD_LOG(LOG_ERR, "Pinning accept loop to cpu %d failed.", listener->cpu);
+        }
+    }
+
+    // run accept loop
+    accept_connections(listener);
+    return NULL;
+}
+
+void accept_connections(listener_t *listener) {
+    listener_set_t *set = listener->set;
+    while (1) {
+        // wait for a connection, or for the listeners to be stopped
+        struct pollfd poll_fds[2] = {
+            { .fd = listener->socket_fd, .events = POLLIN },
+            { .fd = set->stop_fd, .events = POLLIN },
+        };
+        if (poll(poll_fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            AESD_LOG(LOG_ERR, "poll() failed. (errno %d)", errno);
+            return;
+        }
+        if (poll_fds[1].revents & POLLIN) {
+            // a set being replaced takes what is still queued, so closing its socket resets nothing
+            if (atomic_load(&set->hand_off)) {
+                int handed_off = 0;
+                while (accept_connection(listener) == 0) handed_off++;
+                if (handed_off > 0) AESD_LOG(LOG_INFO, "Listener took %d queued connections before stopping.", handed_off);
+            }
+            AESD_LOG(LOG_INFO, "Listener stopped accepting connections.");
+            return;
+        }
+        if (poll_fds[0].revents & POLLIN) accept_connection(listener);
+    }
+}
+
+int accept_connection(listener_t *listener) {
+    // client address, large enough for either family; only formatted if it is logged
+    struct sockaddr_storage client_address;
+    socklen_t client_address_length = sizeof(client_address);
+    char client_ip[CLIENT_ADDRESS_STRLEN];
+
+    // create client address info struct; the socket is non-blocking, so an empty queue returns
+    int client_fd = accept(listener->socket_fd, (struct sockaddr *)&client_address, &client_address_length);
+    if (client_fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) AESD_LOG(LOG_ERR, "accept() failed. (errno %d)", errno);
+        return -1;
+    }
+
+    // refuse connections over the limit before spending a thread on them
+    admission_client_t *admission = admission_accept((struct sockaddr *)&client_address);
+    if (!admission) {
+        AESD_LOG(LOG_WARNING, "Refusing connection from %s, too many connections.",
+            format_address((struct sockaddr *)&client_address, client_ip, sizeof(client_ip)));
+        close(client_fd);
+        return 0;
+    }
+    AESD_LOG(LOG_INFO, "Accepted connection from %s",
+        format_address((struct sockaddr *)&client_address, client_ip, sizeof(client_ip)));
+
+    // open file; the segmented log is shared by every connection
+    int tmpdata_client_fd = -1;
+    if (config.backend != BACKEND_SEGLOG) {
+        tmpdata_client_fd = open(config.data_path, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    }
+    if (tmpdata_client_fd == -1 && config.backend != BACKEND_SEGLOG) {
+        AESD_LOG(LOG_ERR, "Failed to open %s", config.data_path);
+        admission_close(admission);
+        close(client_fd);
+        return 0;
+    }
+
+    // create a new entry
+    thread_entry_t *new_connection = thread_entry_create(0, (struct sockaddr *)&client_address, client_address_length,
+        client_fd, tmpdata_client_fd);
+    if (new_connection == NULL) {
+        AESD_LOG(LOG_ERR, "Error malloc'ing memory for new thread entry");
+        admission_close(admission);
+        if (tmpdata_client_fd != -1) close(tmpdata_client_fd);
+        close(client_fd);
+        return 0;
+    }
+    new_connection->admission = admission;
+
+    // create a new pthread
+    if (pthread_create(&new_connection->thread_id, &client_thread_attr, client_handler, new_connection) != 0 ) {
+        admission_close(admission);
+        if (tmpdata_client_fd != -1) close(tmpdata_client_fd);
+        close(client_fd);
+        thread_entry_free(new_connection);
+        return 0;
+    } else {
+        // add thread to thread manager
+        thread_entry_add(new_connection);
+        metrics_count(METRIC_CONNECTIONS_ACCEPTED, 1);
+    }
+
+    // dumping the thread manager holds manager_mutex, so skip it entirely unless it will be logged
+    if (AESD_LOG_ENABLED(LOG_DEBUG)) {
+        thread_entry_printall();
+    }
+
+    // check if any of the current threads need to be joined
+    thread_entry_reapall();
+
+    // return
+    return 0;
+}
+
+void *client_handler(void *arg) {
+    // define the client fd
+    thread_entry_t *connection = (thread_entry_t *)arg;
+
+    // print
+    AESD_LOG(LOG_DEBUG, "New connection:");
+    if (AESD_LOG_ENABLED(LOG_DEBUG)) {
+        thread_entry_print(connection);
+    }
+
+    // per connection state; a reload only affects connections accepted after it
+    client_t client;
+    memset(&client, 0, sizeof(client));
+    client.connection = connection;
+    client.client_fd = connection->client_fd;
+    client.tmpdata_fd = connection->tmpdata_fd;
+    client.protocol = PROTOCOL_UNKNOWN;
+    config_snapshot(&client.config);
+
+    // read_buffer to store incoming data, file_content to stage replies, write_buffer to store the
+    // line or frames being assembled, grown on demand up to max_line_size
+    client.read_buffer = (char *)malloc(client.config.buffer_size);
+    client.file_content = (char *)malloc(client.config.buffer_size);
+    if (!client.read_buffer || !client.file_content ||
+        line_buffer_reserve(&client.write_buffer, &client.write_buffer_size, LINE_BUFFER_INITIAL_SIZE) == -1) {
+        AESD_LOG(LOG_ERR, "Error malloc'ing client buffers");
+        goto exit_client;
+    }
+
+    // set once shutdown begins; the connection is then closed as soon as no partial line is pending
+    bool draining = false;
+
+    // infinite loop to process incoming data while connection is open
+    while (1) {
+        // while admission control holds the connection back, leave its data in the socket and only
+        // watch for shutdown; a draining connection finishes its line without waiting
+        int delay_ms = draining ? 0 : admission_recv_delay(connection->admission);
+        if (delay_ms > 0) {
+            struct pollfd shutdown_poll = { .fd = shutdown_fd, .events = POLLIN };
+            if (poll(&shutdown_poll, 1, delay_ms) > 0 && (shutdown_poll.revents & POLLIN)) {
+                AESD_LOG(LOG_DEBUG, "Draining client connection.");
+                draining = true;
+            }
+            continue;
+        }
+
+        // wait for data, or for shutdown to begin
+        struct pollfd poll_fds[2] = {
+            { .fd = client.client_fd, .events = POLLIN },
+            { .fd = shutdown_fd, .events = POLLIN },
+        };
+        if (poll(poll_fds, draining ? 1 : 2, draining ? SHUTDOWN_POLL_MS : -1) == -1) {
+            if (errno == EINTR) continue;
+            AESD_LOG(LOG_ERR, "poll() failed. (errno %d)", errno);
+            break;
+        }
+        if (!draining && (poll_fds[1].revents & POLLIN)) {
+            AESD_LOG(LOG_DEBUG, "Draining client connection.");
+            draining = true;
+        }
+        if (!(poll_fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            // nothing to read; a draining connection closes between lines
+            if (draining && client.write_buffer_index == 0) break;
+            continue;
+        }
+
+        // receive data from socket, no more than the address's rate allows; frames are received
+        // straight into the frame buffer
+        ssize_t bytes_received;
+        if (client.protocol == PROTOCOL_BINARY) {
+            bytes_received = recv(client.client_fd, client.write_buffer + client.write_buffer_index,
+                admission_recv_limit(connection->admission, client.write_buffer_size - client.write_buffer_index), 0);
+        } else {
+            bytes_received = recv(client.client_fd, client.read_buffer,
+                admission_recv_limit(connection->admission, client.config.buffer_size), 0);
+        }
+
+        // note when the data arrived, for the recv-to-persist latency of lines completed by it
+        client.recv_ns = metrics_now_ns();
+
+        // client connection closed
+        if (bytes_received <= 0) {
+            char client_ip[CLIENT_ADDRESS_STRLEN];
+            AESD_LOG(LOG_INFO, "Closed client connection from %s.",
+                format_address((struct sockaddr *)&connection->client_address, client_ip, sizeof(client_ip)));
+            break;
+        }
+        metrics_count(METRIC_BYTES_RECEIVED, bytes_received);
+        client.bytes_received += bytes_received;
+        admission_received(connection->admission, bytes_received);
+
+        // process the data according to the connection's protocol
+        int rc;
+        switch (client.protocol) {
+            case PROTOCOL_BINARY:
+                client.write_buffer_index += bytes_received;
+                rc = client_process_binary(&client);
+                break;
+            case PROTOCOL_TEXT:
+                rc = client_process_text(&client, client.read_buffer, bytes_received);
+                break;
+            default:
+                rc = client_detect_protocol(&client, bytes_received);
+                break;
+        }
+        admission_handled(bytes_received);
+        if (rc == -1) break;
+    }
 
-    // get address info, storing it into server_address_info
-    rc = getaddrinfo(NULL, PORT, &hints, &server_address_info);
-    if (rc != 0) goto exit_free_addrinfo_struct;
-
-    // create server socket
-    syslog(LOG_INFO, "Creating server socket.");
-    rc = socket(
-        server_address_info->ai_family,
-        server_address_info->ai_socktype,
-        server_address_info->ai_protocol
-    );
-    if (rc == -1) goto exit_socket_creation;
-    server_socket_fd = rc;
-
-    // set up bind options for better debugging
-    int optval = 1;
-    setsockopt(server_socket_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &optval, sizeof(optval));
+exit_client:
+    // release the connection's admission
+    admission_close(connection->admission);
 
-    // bind name to socket
-    syslog(LOG_INFO, "Binding server socket.");
-    rc = bind(server_socket_fd, server_address_info->ai_addr, server_address_info->ai_addrlen);
-    if (rc == -1) goto exit_socket_bind;
+    // mark thread as complete, through its own entry, which may not be in the thread manager yet
+    thread_entry_markcomplete(connection);
+    metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
 
-    // listen on port
-    syslog(LOG_INFO, "Socket listening on port %s", PORT);
-    rc = listen(server_socket_fd, NUM_CONNECTIONS);
-    if (rc == -1) goto exit_socket_listen;
+    // cleanup
+    AESD_LOG(LOG_DEBUG, "[CLEAN] Cleaning client connection.");
+    free(client.read_buffer);
+    free(client.file_content);
+    free(client.compress_buffer);
+    free(client.write_buffer);
+    close(client.client_fd);
+    return NULL;
+}
 
-    // start daemon if -d flag was passed
-    start_daemon(argc, argv);
+int line_buffer_reserve(char **buffer, size_t *size, size_t new_size) {
+    // buffers only grow
+    if (new_size <= *size) return 0;
 
-    // start timer
-    #if !USE_AESD_CHAR_DEVICE
-    initialize_timer();
-    #endif
+    // reallocate, leaving the buffer untouched on failure
+    char *new_buffer = (char *)realloc(*buffer, new_size);
+    if (!new_buffer) return -1;
+    *buffer = new_buffer;
+    *size = new_size;
+    return 0;
+}
 
-    // accept connections - main program loop
-    accept_connections();
+/**************************************************************************************************
+ * FUNCTION DEFINITIONS - CLIENTS
+ **************************************************************************************************/
+int client_detect_protocol(client_t *client, size_t length) {
+    // a text client never starts with a NUL byte, so text is detected on the first byte; without
+    // binary framing every connection is text
+    if (!client->config.binary_framing || (client->write_buffer_index == 0 && client->read_buffer[0] != '\0')) {
+        client->protocol = PROTOCOL_TEXT;
+        return client_process_text(client, client->read_buffer, length);
+    }
 
-// cleanup labels; makes it easier to read code and keep track of frees/closes
-exit_socket_listen:
-    if (rc == -1) syslog(LOG_ERR, "Exiting socket listen. (errno %d)", errno);
-exit_socket_bind:
-    if (rc == -1) syslog(LOG_ERR, "Exiting socket bind. (errno %d)", errno);
-    close(server_socket_fd);
-exit_socket_creation:
-    if (rc == -1) syslog(LOG_ERR, "Exiting socket creation. (errno %d)", errno); 
-exit_free_addrinfo_struct:
-    freeaddrinfo(server_address_info);
+    // collect bytes until they either differ from the preamble, which a newline always does, or complete it
+    if (line_buffer_reserve(&client->write_buffer, &client->write_buffer_size,
+        client->write_buffer_index + length) == -1) return -1;
+    memcpy(client->write_buffer + client->write_buffer_index, client->read_buffer, length);
+    client->write_buffer_index += length;
+    size_t compared = client->write_buffer_index < AESD_BINARY_PREAMBLE_SIZE ?
+        client->write_buffer_index : AESD_BINARY_PREAMBLE_SIZE;
+    bool preamble = !memcmp(client->write_buffer, AESD_BINARY_PREAMBLE, compared);
+    if (preamble && compared < AESD_BINARY_PREAMBLE_SIZE) return 0;
+
+    if (!preamble) {
+        // not the preamble; hand everything collected to the text protocol, which builds its lines
+        // in a fresh write_buffer
+        char *collected = client->write_buffer;
+        size_t collected_length = client->write_buffer_index;
+        client->write_buffer = NULL;
+        client->write_buffer_size = 0;
+        client->write_buffer_index = 0;
+        if (line_buffer_reserve(&client->write_buffer, &client->write_buffer_size, LINE_BUFFER_INITIAL_SIZE) == -1) {
+            free(collected);
+            return -1;
+        }
+        client->protocol = PROTOCOL_TEXT;
+        int rc = client_process_text(client, collected, collected_length);
+        free(collected);
+        return rc;
+    }
 
-    // server cleanup
-    cleanup_server();
+    // switch to binary framing; anything after the preamble is the start of the first frame
+    AESD_LOG(LOG_DEBUG, "Client switched to binary framing.");
+    client->protocol = PROTOCOL_BINARY;
+    client->write_buffer_index -= AESD_BINARY_PREAMBLE_SIZE;
+    memmove(client->write_buffer, client->write_buffer + AESD_BINARY_PREAMBLE_SIZE, client->write_buffer_index);
+    return client_process_binary(client);
+}
+
+int client_process_text(client_t *client, const char *data, size_t length) {
+    // for loop to process a single sub-buffer
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == '\n') {
+            // drop lines that did not fit
+            if (client->line_too_long) {
+                AESD_LOG(LOG_ERR, "Dropping line longer than %zu bytes.", client->config.max_line_size);
+                client->line_too_long = false;
+                client->write_buffer_index = client->batch_length;
+                continue;
+            }
+
+            // packet completed; the line starts after any lines already batched
+            char *line = client->write_buffer + client->batch_length;
+            size_t line_length = client->write_buffer_index - client->batch_length;
+            line[line_length] = '\0';
+            AESD_LOG(LOG_DEBUG, "Packet complete. Data: %s", line);
+            metrics_count(METRIC_LINES_RECEIVED, 1);
+
+            if (client->config.pipelining && !client_is_command(client, line)) {
+                // keep the line and its newline in the batch
+                client->write_buffer[client->write_buffer_index++] = '\n';
+                client->batch_length = client->write_buffer_index;
+                continue;
+            }
+
+            // a command ends the batch, so lines sent before it are stored before it runs; the
+            // command is moved to the start of the buffer with the partial line
+            if (client->batch_length > 0) {
+                if (client_persist_batch(client) == -1 && client_send_text(client, AESD_READ_ERROR) == -1) return -1;
+                line = client->write_buffer;
+                line[line_length] = '\0';
+            }
+            client->write_buffer_index = 0;
+            if (client_handle_line(client, line, line_length) == -1) return -1;
+        } else if (!client->line_too_long) {
+            // grow the line up to max_line_size, keeping room for the terminator
+            size_t line_limit = client->batch_length + client->config.max_line_size + 1;
+            if (client->write_buffer_index + 1 >= line_limit) {
+                client->line_too_long = true;
+                continue;
+            }
+            if (client->write_buffer_index + 1 >= client->write_buffer_size) {
+                size_t new_size = client->write_buffer_size * 2;
+                if (new_size > line_limit) new_size = line_limit;
+                if (line_buffer_reserve(&client->write_buffer, &client->write_buffer_size, new_size) == -1) {
+                    client->line_too_long = true;
+                    continue;
+                }
+            }
+            client->write_buffer[client->write_buffer_index++] = data[i];
+        }
+    }
+
+    // store every line completed by this chunk with one append, and reply once; a batch that was not
+    // stored is answered with an error instead
+    if (client->batch_length > 0) {
+        int rc = (client_persist_batch(client) == 0) ? client_reply(client, 0, SIZE_MAX) :
+            client_send_text(client, AESD_READ_ERROR);
+        if (rc == -1) return -1;
+    }
 
     // return
     return 0;
 }
 
+bool client_is_command(client_t *client, const char *line) {
+    // read commands work on every backend; seek commands only mean something to the aesdchar device
+    return !strncmp(line, AESD_READ_RANGE, sizeof(AESD_READ_RANGE) - 1) ||
+        !strncmp(line, AESD_READ_ENTRIES, sizeof(AESD_READ_ENTRIES) - 1) ||
+        (client->config.backend == BACKEND_AESDCHAR && strstr(line, AESD_IOCTL_SEEKTO) != NULL);
+}
 
-/**************************************************************************************************
- * FUNCTION DEFINITIONS - SERVER
- **************************************************************************************************/
-void initialize_server() {
-    // open syslog
-    openlog(NULL, LOG_PID | LOG_CONS | LOG_NDELAY, LOG_USER);
+int client_persist_batch(client_t *client) {
+    // write the batched lines in one append
+    struct iovec iov = { .iov_base = client->write_buffer, .iov_len = client->batch_length };
+    int rc = 0;
+    if (tmpdata_append(client->tmpdata_fd, &iov, 1) != (ssize_t)iov.iov_len) {
+        AESD_LOG(LOG_ERR, "Error writing batch to client.");
+        rc = -1;
+    }
 
-    // initialize thread manager
-    SLIST_INIT(&thread_manager);
+    // keep the partial line that follows the batch
+    memmove(client->write_buffer, client->write_buffer + client->batch_length,
+        client->write_buffer_index - client->batch_length);
+    client->write_buffer_index -= client->batch_length;
+    client->batch_length = 0;
 
     // return
-    return;
+    return rc;
 }
 
-void initialize_timer() {
-    // create the signal event for the interval timer
-    struct sigevent timer_sig_event;
-    memset(&timer_sig_event, 0, sizeof(timer_sig_event));
-    timer_sig_event.sigev_notify = SIGEV_SIGNAL;
-    timer_sig_event.sigev_signo = SIGALRM;
-    timer_sig_event.sigev_value.sival_ptr = &timer_id;
-
-    if (timer_create(CLOCK_REALTIME, &timer_sig_event, &timer_id) == -1) {
-        syslog(LOG_ERR, "Creating timer failed");
-        return;
+int client_handle_line(client_t *client, char *line, size_t length) {
+    // read commands are answered without appending
+    if (!strncmp(line, AESD_READ_RANGE, sizeof(AESD_READ_RANGE) - 1) ||
+        !strncmp(line, AESD_READ_ENTRIES, sizeof(AESD_READ_ENTRIES) - 1)) {
+        return client_handle_read(client, line);
     }
 
-    // configure the timer's interval value
-    struct itimerspec timer_spec;
-    timer_spec.it_value.tv_sec = TIMER_FREQ_S;
-    timer_spec.it_value.tv_nsec = 0;
-    timer_spec.it_interval.tv_sec = TIMER_FREQ_S;
-    timer_spec.it_interval.tv_nsec = 0;
+    // switch behavior based on the presence of the IOCTL string
+    off_t reply_offset = 0;
+    if (client->config.backend == BACKEND_AESDCHAR && strstr(line, AESD_IOCTL_SEEKTO)) {
+        // handle ioctl commands
 
-    if (timer_settime(timer_id, 0, &timer_spec, NULL) == -1) {
-        syslog(LOG_ERR, "Setting timer failed");
-        return;
+        // parse the index and offset from the command
+        size_t index, offset;
+        if (sscanf(line, AESD_IOCTL_SEEKTO_PARSE, &index, &offset) != 2) {
+            // parsing unsuccessful
+            AESD_LOG(LOG_ERR, "Parsing ioctl command unsuccessful.");
+            return 0;
+        }
+
+        // send ioctl to device, then reply from the position it resolved to
+        AESD_LOG(LOG_DEBUG, "Received ioctl (index: %ld, offset: %ld)", index, offset);
+        reply_offset = tmpdata_seekto(client->tmpdata_fd, index, offset);
+        if (reply_offset == -1) {
+            AESD_LOG(LOG_ERR, "Error seeking to index %ld, offset %ld in client.", index, offset);
+            return 0;
+        }
+    } else {
+        // write the line and its newline to the file in one append; the newline takes the
+        // terminator's place, so the line stays one buffer and can go through the line queue
+        line[length] = '\n';
+        struct iovec iov = { .iov_base = line, .iov_len = length + 1 };
+        if (tmpdata_append(client->tmpdata_fd, &iov, 1) != (ssize_t)iov.iov_len) {
+            // a short write stored only part of the line; either way the client is told it was not stored
+            AESD_LOG(LOG_ERR, "Error writing buffer to client.");
+            return client_send_text(client, AESD_READ_ERROR);
+        }
     }
 
-    // success; return
-    syslog(LOG_INFO, "Timer set successfully.");
-    
-    // set up signal handler
-    // https://stackoverflow.com/questions/2485028/signal-handling-in-c
-    // https://pubs.opengroup.org/onlinepubs/009695399/functions/sigaction.html
-    sigact.sa_handler = signal_handler;
-    sigemptyset(&sigact.sa_mask);
-    sigact.sa_flags = 0;
-    sigaction(SIGALRM, &sigact, (struct sigaction *)NULL);
-    sigaction(SIGINT, &sigact, (struct sigaction *)NULL);
-    sigaction(SIGTERM, &sigact, (struct sigaction *)NULL);
+    // packet was received; send contents of file to client
+    return client_reply(client, reply_offset, SIZE_MAX);
 }
 
-void cleanup_server() {
-    // clean thread manager
-    thread_entry_freeall();
+int client_handle_read(client_t *client, const char *line) {
+    size_t offset, length;
+    unsigned int first, last;
 
-    // attempt to close files
-    close(server_socket_fd);
+    // scanf's unsigned conversions take a minus sign and wrap, so refuse negative numbers first
+    if (strchr(line, '-') != NULL) {
+        AESD_LOG(LOG_ERR, "Read command with a negative number.");
+        return client_send_text(client, AESD_READ_ERROR);
+    }
 
-    // attempt to free addrinfo struct
-    freeaddrinfo(server_address_info);
+    // resolve the command to a byte range
+    if (sscanf(line, AESD_READ_RANGE_PARSE, &offset, &length) == 2) {
+        AESD_LOG(LOG_DEBUG, "Received read (offset: %zu, length: %zu)", offset, length);
+    } else if (sscanf(line, AESD_READ_ENTRIES_PARSE, &first, &last) == 2 && first <= last) {
+        AESD_LOG(LOG_DEBUG, "Received entry read (first: %u, last: %u)", first, last);
+        off_t start, end;
+        if (tmpdata_entry_range(client, first, last, &start, &end) == -1) {
+            AESD_LOG(LOG_DEBUG, "Entries %u to %u are not stored.", first, last);
+            return client_send_text(client, AESD_READ_EMPTY);
+        }
+        offset = start;
+        length = end - start;
+    } else {
+        // parsing unsuccessful
+        AESD_LOG(LOG_ERR, "Parsing read command unsuccessful.");
+        return client_send_text(client, AESD_READ_ERROR);
+    }
 
-    // remove tmpdata file if it is not a char driver
-    #if !USE_AESD_CHAR_DEVICE
-    remove(TMPDATA_PATH);
-    #endif
+    // send the slice; one holding nothing is answered explicitly, so pollers are not left waiting
+    ssize_t reply_size = length > 0 ? client_reply_from(client, offset, length) : 0;
+    if (reply_size == -1) return -1;
+    if (reply_size == 0) return client_send_text(client, AESD_READ_EMPTY);
+    metrics_observe(METRIC_REPLY_SIZE, reply_size);
+    metrics_count(METRIC_REPLIES_SENT, 1);
 
-    // close syslog
-    closelog();
+    // return
+    return 0;
 }
 
-void accept_connections() {
-    while (1) {
-        // create client address info
-        struct sockaddr client_address_info;
-        socklen_t client_address_len = sizeof(client_address_info);
-        char client_ip[INET_ADDRSTRLEN];
-
-        // create client address info struct
-        syslog(LOG_INFO, "Accepting socket connection.");
-        int client_fd = accept(server_socket_fd, (struct sockaddr *)&client_address_info, &client_address_len);
-        if (client_fd == -1) {
-            syslog(LOG_ERR, "accept() failed. (errno %d)", errno);
-            continue;
-        }
+int client_reply(client_t *client, off_t offset, size_t length) {
+    uint64_t persist_ns = metrics_now_ns();
+    metrics_observe(METRIC_RECV_TO_PERSIST, persist_ns - client->recv_ns);
 
-        // log client connection
-        struct sockaddr_in *client = (struct sockaddr_in *)&client_address_info;
-        inet_ntop(client->sin_family, &client->sin_addr, client_ip, sizeof(client_ip));
-        syslog(LOG_INFO, "Accepted connection from %s", client_ip);
+    // send contents of file to client
+    ssize_t reply_size = client_reply_from(client, offset, length);
+    if (reply_size == -1) return -1;
+    metrics_observe(METRIC_PERSIST_TO_REPLY, metrics_now_ns() - persist_ns);
+    metrics_observe(METRIC_REPLY_SIZE, reply_size);
+    metrics_count(METRIC_REPLIES_SENT, 1);
 
-        // open file
-        int tmpdata_client_fd = open(TMPDATA_PATH, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-        if (tmpdata_client_fd == -1) {
-            syslog(LOG_ERR, "Failed to open %s", TMPDATA_PATH);
-            close(client_fd);
-            continue;
+    // return
+    return 0;
+}
+
+int client_process_binary(client_t *client) {
+    size_t start = 0;
+    struct aesd_frame_header header;
+
+    // handle every complete frame in the buffer
+    while (client->write_buffer_index - start >= sizeof(header)) {
+        memcpy(&header, client->write_buffer + start, sizeof(header));
+        size_t payload_length = ntohl(header.length);
+        if (payload_length > client->config.max_line_size) {
+            AESD_LOG(LOG_ERR, "Dropping client sending a %zu byte frame.", payload_length);
+            client_send_frame(client, header.opcode, EMSGSIZE, NULL, 0);
+            return -1;
         }
 
-        // create a new entry
-        thread_entry_t *new_connection = thread_entry_create(0, client_ip, client_fd, tmpdata_client_fd);
-        if (new_connection == NULL) {
-            syslog(LOG_ERR, "Error malloc'ing memory for new thread entry");
-            continue;
+        // wait for the rest of the frame, making room for it to be received in place
+        size_t frame_size = sizeof(header) + payload_length;
+        if (client->write_buffer_index - start < frame_size) {
+            if (frame_size > client->write_buffer_size) {
+                memmove(client->write_buffer, client->write_buffer + start, client->write_buffer_index - start);
+                client->write_buffer_index -= start;
+                start = 0;
+                if (line_buffer_reserve(&client->write_buffer, &client->write_buffer_size, frame_size) == -1) return -1;
+            }
+            break;
         }
 
-        // create a new pthread
-        if (pthread_create(&new_connection->thread_id, NULL, client_handler, new_connection) != 0 ) {
-            close(client_fd);
-            thread_entry_free(new_connection);
-            continue;
-        } else {
-            // add thread to thread manager
-            thread_entry_add(new_connection);
+        client->frames_received++;
+        metrics_count(METRIC_FRAMES_RECEIVED, 1);
+        if (client_handle_frame(client, &header, client->write_buffer + start + sizeof(header), payload_length) == -1) {
+            return -1;
         }
+        start += frame_size;
+    }
 
-        thread_entry_printall();
+    // keep the partial frame at the start of the buffer
+    memmove(client->write_buffer, client->write_buffer + start, client->write_buffer_index - start);
+    client->write_buffer_index -= start;
+    return 0;
+}
 
-        // check if any of the current threads need to be joined
-        thread_entry_t *current_entry = NULL;
-        SLIST_FOREACH(current_entry, &thread_manager, entries) {
-            if (current_entry->is_complete) {
-                // join thread for completed threads
-                pthread_join(current_entry->thread_id, NULL);
-                close(current_entry->tmpdata_fd);
-                thread_entry_remove(current_entry->thread_id);
+int client_handle_frame(client_t *client, const struct aesd_frame_header *header, char *payload, size_t length) {
+    switch (header->opcode) {
+        case AESD_OP_APPEND: {
+            // store the payload verbatim
+            struct iovec iov = { .iov_base = payload, .iov_len = length };
+            if (tmpdata_append(client->tmpdata_fd, &iov, 1) == -1) {
+                return client_send_frame(client, header->opcode, errno, NULL, 0);
+            }
+            metrics_observe(METRIC_RECV_TO_PERSIST, metrics_now_ns() - client->recv_ns);
+            uint64_t size = htobe64((uint64_t)tmpdata_size(client));
+            return client_send_frame(client, header->opcode, 0, &size, sizeof(size));
+        }
+        case AESD_OP_SEEKTO: {
+            // resolve the command/offset pair on the device
+            struct aesd_frame_seekto seekto;
+            if (client->config.backend != BACKEND_AESDCHAR) {
+                return client_send_frame(client, header->opcode, ENOTSUP, NULL, 0);
+            }
+            if (length != sizeof(seekto)) {
+                return client_send_frame(client, header->opcode, EINVAL, NULL, 0);
+            }
+            memcpy(&seekto, payload, sizeof(seekto));
+            off_t position = tmpdata_seekto(client->tmpdata_fd, ntohl(seekto.write_cmd), ntohl(seekto.write_cmd_offset));
+            if (position == -1) {
+                return client_send_frame(client, header->opcode, errno, NULL, 0);
+            }
+            uint64_t reply = htobe64((uint64_t)position);
+            return client_send_frame(client, header->opcode, 0, &reply, sizeof(reply));
+        }
+        case AESD_OP_READ: {
+            // read at most one reply buffer; clients issue further reads for the rest
+            struct aesd_frame_read request;
+            if (length != sizeof(request)) {
+                return client_send_frame(client, header->opcode, EINVAL, NULL, 0);
+            }
+            memcpy(&request, payload, sizeof(request));
+            uint64_t offset = be64toh(request.offset);
+            uint64_t wanted = be64toh(request.length);
+            if (wanted == 0 || wanted > client->config.buffer_size) wanted = client->config.buffer_size;
+            const char *data;
+            ssize_t bytes_read = tmpdata_view(client, offset, wanted, &data);
+            if (bytes_read == -1) {
+                return client_send_frame(client, header->opcode, errno, NULL, 0);
             }
+            metrics_observe(METRIC_REPLY_SIZE, bytes_read);
+            if (header->flags & AESD_FLAG_COMPRESS) {
+                return client_send_compressed(client, header->opcode, data, bytes_read);
+            }
+            return client_send_frame(client, header->opcode, 0, data, bytes_read);
+        }
+        case AESD_OP_STATS: {
+            struct aesd_frame_stats stats = {
+                .store_size = htobe64((uint64_t)tmpdata_size(client)),
+                .frames_received = htobe64(client->frames_received),
+                .bytes_received = htobe64(client->bytes_received),
+                .bytes_sent = htobe64(client->bytes_sent),
+            };
+            return client_send_frame(client, header->opcode, 0, &stats, sizeof(stats));
         }
+        default:
+            return client_send_frame(client, header->opcode, EINVAL, NULL, 0);
     }
 }
 
-void *client_handler(void *arg) {
-    // define the client fd
-    thread_entry_t *connection = (thread_entry_t *)arg;
-    pthread_t thread_id = connection->thread_id;
-    int client_fd = connection->client_fd;
-    int tmpdata_client_fd = connection->tmpdata_fd;
+int client_send_frame(client_t *client, uint8_t opcode, int status, const void *payload, size_t length) {
+    struct aesd_frame_header header = {
+        .opcode = opcode | AESD_OP_REPLY,
+        .flags = 0,
+        .status = htons((uint16_t)status),
+        .length = htonl((uint32_t)length),
+    };
+
+    // header and payload in one send
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = (void *)payload, .iov_len = length },
+    };
+    metrics_count(METRIC_REPLIES_SENT, 1);
+    return client_sendv(client, iov, length > 0 ? 2 : 1);
+}
 
-    // print
-    syslog(LOG_DEBUG, "New connection:");
-    thread_entry_print(connection);
+int client_send_compressed(client_t *client, uint8_t opcode, const char *payload, size_t length) {
+    // compress after room for the decompressed length, only keeping the result if it is smaller
+    size_t packed_length = 0;
+    if (length > sizeof(uint32_t) + 1) {
+        if (!client->compress_buffer) {
+            client->compress_buffer = (char *)malloc(sizeof(uint32_t) + lz_bound(client->config.buffer_size));
+        }
+        if (client->compress_buffer) {
+            packed_length = lz_compress(payload, length, client->compress_buffer + sizeof(uint32_t),
+                length - sizeof(uint32_t) - 1);
+        }
+    }
+    if (packed_length == 0) return client_send_frame(client, opcode, 0, payload, length);
+
+    // header and compressed payload in one send
+    uint32_t decompressed_length = htonl((uint32_t)length);
+    memcpy(client->compress_buffer, &decompressed_length, sizeof(decompressed_length));
+    struct aesd_frame_header header = {
+        .opcode = opcode | AESD_OP_REPLY,
+        .flags = AESD_FLAG_COMPRESS,
+        .status = 0,
+        .length = htonl((uint32_t)(sizeof(uint32_t) + packed_length)),
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = client->compress_buffer, .iov_len = sizeof(uint32_t) + packed_length },
+    };
+    metrics_count(METRIC_REPLIES_SENT, 1);
+    metrics_count(METRIC_COMPRESSION_SAVED, length - sizeof(uint32_t) - packed_length);
+    return client_sendv(client, iov, 2);
+}
 
-    // read_buffer to store incoming data
-    char read_buffer[BUFFER_SIZE] = {0};
+int client_send_text(client_t *client, const char *text) {
+    struct iovec iov = { .iov_base = (void *)text, .iov_len = strlen(text) };
+    metrics_count(METRIC_REPLIES_SENT, 1);
+    return client_sendv(client, &iov, 1);
+}
 
-    // write buffer to store outgoing data
-    char write_buffer[BUFFER_SIZE] = {0};
-    int write_buffer_index = 0;
+int client_sendv(client_t *client, struct iovec *iov, int iovcnt) {
+    // send everything, resuming after partial sends
+    while (iovcnt > 0) {
+        struct msghdr message = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t bytes_sent = sendmsg(client->client_fd, &message, MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EINTR) continue;
+            AESD_LOG(LOG_ERR, "Error sending to client. (errno %d)", errno);
+            return -1;
+        }
+        client->bytes_sent += bytes_sent;
+        metrics_count(METRIC_BYTES_SENT, bytes_sent);
+
+        // skip what was sent
+        while (iovcnt > 0 && (size_t)bytes_sent >= iov->iov_len) {
+            bytes_sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + bytes_sent;
+            iov->iov_len -= bytes_sent;
+        }
+    }
 
-    // infinite loop to process incoming data while connection is open
-    while (1) {
-        // receive data from socket
-        ssize_t bytes_received = recv(client_fd, read_buffer, BUFFER_SIZE, 0);
+    // return
+    return 0;
+}
 
-        // client connection closed
-        if (bytes_received <= 0) {
-            if (connection->client_ip != NULL) {
-                syslog(LOG_INFO, "Closed client connection from %s.", (char *)connection->client_ip);
-            } else {
-                syslog(LOG_INFO, "Closed client connection from unknown.");
-            }
-            break;
+ssize_t client_reply_from(client_t *client, off_t offset, size_t length) {
+    // the segmented log may have dropped the start of the store
+    if (client->config.backend == BACKEND_SEGLOG) {
+        off_t start = (off_t)seglog_start();
+        if (offset < start) {
+            size_t skipped = start - offset;
+            if (length != SIZE_MAX) length = length > skipped ? length - skipped : 0;
+            offset = start;
         }
+    }
 
-        // for loop to process a single sub-buffer
-        for (int i = 0; i < bytes_received; i++) {
-            if (read_buffer[i] == '\n') {
-                // packet completed; send to file
-                syslog(LOG_DEBUG, "Packet complete. Data: %s", write_buffer);
-
-                // lock mutex
-                syslog(LOG_DEBUG, "Locking tmpdata mutex.");
-                pthread_mutex_lock(&file_mutex);
-
-                // switch behavior based on the presence of the IOCTL string
-                if (USE_AESD_CHAR_DEVICE && strstr(write_buffer, AESD_IOCTL_SEEKTO)) {
-                    // handle ioctl commands
-
-                    // parse the index and offset from the command
-                    size_t index, offset;
-                    if (sscanf(read_buffer, AESD_IOCTL_SEEKTO_PARSE, &index, &offset) != 2) {
-                        // parsing unsuccessful
-                        syslog(LOG_ERR, "Parsing ioctl command unsuccessful.");
-                    }
-
-                    // save to struct
-                    struct aesd_seekto seekto;
-                    seekto.write_cmd = index;
-                    seekto.write_cmd_offset = offset;
-
-                    // send ioctl to device
-                    syslog(LOG_DEBUG, "Received ioctl (index: %ld, offset: %ld)", index, offset);
-                    if (ioctl(tmpdata_client_fd, AESDCHAR_IOCSEEKTO, &seekto) != 0) {
-                        syslog(LOG_ERR, "Error seeking to index %ld, offset %ld in client.", index, offset);
-                        continue;
-                    }
-                } else {
-                    // reset write buffer and write to file
-                    if (write(tmpdata_client_fd, write_buffer, write_buffer_index) == -1) {
-                        syslog(LOG_ERR, "Error writing buffer to client.");
-                        continue;
-                    }
-                    if (write(tmpdata_client_fd, "\n", 1) == -1) {
-                        syslog(LOG_ERR, "Error writing newline to client.");
-                        continue;
-                    }
-                }
+    // send the store from offset, until length bytes are sent or its end is reached; a mapped data
+    // file is sent straight from the mapping, in one piece
+    ssize_t reply_size = 0;
+    ssize_t bytes_read;
+    while (length > 0) {
+        const char *data;
+        bytes_read = tmpdata_view(client, offset, length, &data);
+        if (bytes_read <= 0) break;
+        struct iovec iov = { .iov_base = (void *)data, .iov_len = bytes_read };
+        if (client_sendv(client, &iov, 1) == -1) return -1;
+        offset += bytes_read;
+        length -= bytes_read;
+        reply_size += bytes_read;
+    }
 
-                // unlock mutex
-                syslog(LOG_DEBUG, "Unlocking manager mutex.");
-                pthread_mutex_unlock(&file_mutex);
+    // return
+    return reply_size;
+}
 
-                // reset write buffer
-                memset(write_buffer, 0, BUFFER_SIZE);
-                write_buffer_index = 0;
+off_t tmpdata_seekto(int fd, uint32_t write_cmd, uint32_t write_cmd_offset) {
+    struct aesd_seekto seekto = {
+        .write_cmd = write_cmd,
+        .write_cmd_offset = write_cmd_offset,
+    };
 
-                // packet was received; send entire contents of file to client
-                char file_content[BUFFER_SIZE];
-                size_t bytes_read;
-                while ((bytes_read = read(tmpdata_client_fd, file_content, sizeof(file_content))) > 0) {
-                    send(client_fd, file_content, bytes_read, 0);
-                }
+    // the seek is resolved against the device's current contents, so serialize it with appends
+    uint64_t wait_start_ns = metrics_now_ns();
+    pthread_mutex_lock(&file_mutex);
+    metrics_observe(METRIC_FILE_LOCK_WAIT, metrics_now_ns() - wait_start_ns);
+    off_t position = -1;
+    if (ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == 0) {
+        position = lseek(fd, 0, SEEK_CUR);
+    }
+    pthread_mutex_unlock(&file_mutex);
+
+    // return
+    return position;
+}
+
+ssize_t tmpdata_read(client_t *client, char *buffer, size_t length, off_t offset) {
+    // copy from the mapping when there is one
+    if (client->config.backend == BACKEND_FILE && filemap_is_open()) {
+        const char *data = filemap_data(offset, &length);
+        if (length > 0) memcpy(buffer, data, length);
+        return length;
+    }
+
+    // fill the buffer, stopping at the end of the store; segmented log reads stop at segment ends
+    size_t total = 0;
+    while (total < length) {
+        ssize_t bytes_read = (client->config.backend == BACKEND_SEGLOG) ?
+            seglog_read(buffer + total, length - total, offset + total) :
+            pread(client->tmpdata_fd, buffer + total, length - total, offset + total);
+        if (bytes_read == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (bytes_read == 0) break;
+        total += bytes_read;
+    }
+
+    // return
+    return total;
+}
+
+ssize_t tmpdata_view(client_t *client, off_t offset, size_t length, const char **data) {
+    // point into the mapping when there is one
+    if (client->config.backend == BACKEND_FILE && filemap_is_open()) {
+        *data = filemap_data(offset, &length);
+        return length;
+    }
+
+    // otherwise stage the bytes in the reply buffer
+    if (length > client->config.buffer_size) length = client->config.buffer_size;
+    *data = client->file_content;
+    return tmpdata_read(client, client->file_content, length, offset);
+}
+
+int tmpdata_entry_range(client_t *client, uint32_t first, uint32_t last, off_t *start, off_t *end) {
+    if (client->config.backend == BACKEND_SEGLOG) {
+        // resolved through the sparse index
+        uint64_t log_start, log_end;
+        int rc = seglog_entry_range(first, last, &log_start, &log_end);
+        *start = (off_t)log_start;
+        *end = (off_t)log_end;
+        return rc;
+    }
+
+    if (client->config.backend == BACKEND_AESDCHAR) {
+        // let the device resolve both ends, under one lock so no append moves the entries between
+        struct aesd_seekto seekto = { .write_cmd = first, .write_cmd_offset = 0 };
+        uint64_t wait_start_ns = metrics_now_ns();
+        pthread_mutex_lock(&file_mutex);
+        metrics_observe(METRIC_FILE_LOCK_WAIT, metrics_now_ns() - wait_start_ns);
+        int rc = -1;
+        if (ioctl(client->tmpdata_fd, AESDCHAR_IOCSEEKTO, &seekto) == 0) {
+            *start = lseek(client->tmpdata_fd, 0, SEEK_CUR);
+
+            // the entry after the last one starts the end of the range; past the newest entry, the
+            // range runs to the end of the device
+            seekto.write_cmd = last + 1;
+            if (last < UINT32_MAX && ioctl(client->tmpdata_fd, AESDCHAR_IOCSEEKTO, &seekto) == 0) {
+                *end = lseek(client->tmpdata_fd, 0, SEEK_CUR);
             } else {
-                write_buffer[write_buffer_index++] = read_buffer[i];
+                *end = lseek(client->tmpdata_fd, 0, SEEK_END);
             }
+            rc = (*start == -1 || *end == -1) ? -1 : 0;
         }
+        pthread_mutex_unlock(&file_mutex);
+        return rc;
     }
 
-    // mark thread as complete
-    thread_entry_markcomplete(thread_id);
+    // files have no entry index; count lines from the start
+    uint64_t entry = 0;
+    off_t offset = 0;
+    ssize_t bytes_read;
+    const char *data;
+    *start = (first == 0) ? 0 : -1;
+    *end = -1;
+    while (*end == -1 && (bytes_read = tmpdata_view(client, offset, SIZE_MAX, &data)) > 0) {
+        for (ssize_t i = 0; i < bytes_read; i++) {
+            if (data[i] != '\n') continue;
+            entry++;
+            if (entry == first) *start = offset + i + 1;
+            if (entry == (uint64_t)last + 1) {
+                *end = offset + i + 1;
+                break;
+            }
+        }
+        offset += bytes_read;
+    }
+    if (*end == -1) *end = offset;
 
-    // cleanup
-    syslog(LOG_DEBUG, "[CLEAN] Cleaning client connection.");
-    close(client_fd);
-    return NULL;
+    // return
+    return (*start == -1 || *start >= *end) ? -1 : 0;
+}
+
+off_t tmpdata_size(client_t *client) {
+    // the device reports its size through llseek; files through fstat, leaving the offset alone
+    if (client->config.backend == BACKEND_SEGLOG) {
+        return (off_t)seglog_end();
+    } else if (client->config.backend == BACKEND_AESDCHAR) {
+        return lseek(client->tmpdata_fd, 0, SEEK_END);
+    }
+    if (filemap_is_open()) return (off_t)filemap_size();
+    struct stat file_stat;
+    if (fstat(client->tmpdata_fd, &file_stat) == -1) return -1;
+    return file_stat.st_size;
 }
 
 /**************************************************************************************************
  * THREAD MANAGER - Tracks threads for entire application
  **************************************************************************************************/
-thread_entry_t *thread_entry_create(pthread_t new_thread_id, const char *new_client_ip,
-    int new_client_fd, int new_tmpdata_fd) {
+thread_entry_t *thread_entry_create(pthread_t new_thread_id, const struct sockaddr *new_client_address,
+    socklen_t new_client_address_length, int new_client_fd, int new_tmpdata_fd) {
     // allocate memory
     thread_entry_t *new_thread_entry = (thread_entry_t *)malloc(sizeof(thread_entry_t));
     if (!new_thread_entry) {
-        syslog(LOG_ERR, "Error malloc'ing thread_entry");
+        AESD_LOG(LOG_ERR, "Error malloc'ing thread_entry");
         return NULL;
     }
 
     // assign fields to new thread entry
     new_thread_entry->thread_id = new_thread_id;
-    new_thread_entry->client_ip = strdup(new_client_ip);
-    if (!new_thread_entry->client_ip) {
-        syslog(LOG_ERR, "Error malloc'ing thread_entry->client_ip");
-        free(new_thread_entry->client_ip);
-        free(new_thread_entry);
-        return NULL;
+    if (new_client_address_length > sizeof(new_thread_entry->client_address)) {
+        new_client_address_length = sizeof(new_thread_entry->client_address);
     }
+    memset(&new_thread_entry->client_address, 0, sizeof(new_thread_entry->client_address));
+    memcpy(&new_thread_entry->client_address, new_client_address, new_client_address_length);
+    new_thread_entry->client_address_length = new_client_address_length;
     new_thread_entry->client_fd = new_client_fd;
     new_thread_entry->is_complete = false;
     new_thread_entry->tmpdata_fd = new_tmpdata_fd;
+    new_thread_entry->admission = NULL;
 
     // return
     return new_thread_entry;
@@ -346,15 +1633,10 @@ thread_entry_t *thread_entry_create(pthread_t new_thread_id, const char *new_cli
 int thread_entry_free(thread_entry_t *entry) {
     // check if entry is already null
     if (!entry) {
-        syslog(LOG_ERR, "Thread being free'd is already NULL");
+        AESD_LOG(LOG_ERR, "Thread being free'd is already NULL");
         return -1;
     }
 
-    // free string in struct
-    if (entry->client_ip != NULL) {
-        free(entry->client_ip);
-    }
-
     // free struct malloc
     free(entry);
 
@@ -365,15 +1647,16 @@ int thread_entry_free(thread_entry_t *entry) {
 int thread_entry_add(thread_entry_t *entry) {
     // check if entry is valid
     if (!entry) {
-        syslog(LOG_ERR, "Thread entry to add is NULL");
+        AESD_LOG(LOG_ERR, "Thread entry to add is NULL");
         return -1;
     }
 
     // add the thread entry
-    syslog(LOG_DEBUG, "Locking manager mutex.");
+    AESD_LOG(LOG_DEBUG, "Locking manager mutex.");
     pthread_mutex_lock(&manager_mutex);
     SLIST_INSERT_HEAD(&thread_manager, entry, entries);
-    syslog(LOG_DEBUG, "Unlocking manager mutex.");
+    metrics_gauge_add(METRIC_ACTIVE_CONNECTIONS, 1);
+    AESD_LOG(LOG_DEBUG, "Unlocking manager mutex.");
     pthread_mutex_unlock(&manager_mutex);
 
     // return 
@@ -385,56 +1668,48 @@ int thread_entry_remove(pthread_t thread_id) {
     thread_entry_t *current_entry = NULL;
 
     // lock the manager
-    syslog(LOG_DEBUG, "Locking manager mutex.");
+    AESD_LOG(LOG_DEBUG, "Locking manager mutex.");
     pthread_mutex_lock(&manager_mutex);
     SLIST_FOREACH(current_entry, &thread_manager, entries) {
         if (current_entry->thread_id == thread_id) {
             // remove entry from list
             SLIST_REMOVE(&thread_manager, current_entry, thread_entry_t, entries);
+            metrics_gauge_add(METRIC_ACTIVE_CONNECTIONS, -1);
 
             // free the removed struct
             thread_entry_free(current_entry);
 
             // unlock mutex before returning
-            syslog(LOG_DEBUG, "Unlocking manager mutex.");
+            AESD_LOG(LOG_DEBUG, "Unlocking manager mutex.");
             pthread_mutex_unlock(&manager_mutex);
 
             // return
             return 0;
         }
     }
-    syslog(LOG_DEBUG, "Unlocking manager mutex.");
+    AESD_LOG(LOG_DEBUG, "Unlocking manager mutex.");
     pthread_mutex_unlock(&manager_mutex);
 
     // no thread_ids matched
     return -1;
 }
 
-int thread_entry_markcomplete(pthread_t thread_id) {
-    // malloc a current node to use for checking
-    thread_entry_t *current_entry = NULL;
+int thread_entry_markcomplete(thread_entry_t *entry) {
+    // check if entry is valid
+    if (!entry) {
+        AESD_LOG(LOG_ERR, "Thread entry to mark complete is NULL");
+        return -1;
+    }
 
-    // lock the manager
-    syslog(LOG_DEBUG, "Locking manager mutex.");
+    // set the is_complete field under the manager; an entry added after this is reaped on the next pass
+    AESD_LOG(LOG_DEBUG, "Locking manager mutex.");
     pthread_mutex_lock(&manager_mutex);
-    SLIST_FOREACH(current_entry, &thread_manager, entries) {
-        if (current_entry->thread_id == thread_id) {
-            // set the is_complete field for this thread to true
-            current_entry->is_complete = true;
-
-            // unlock mutex before returning
-            syslog(LOG_DEBUG, "Unlocking manager mutex.");
-            pthread_mutex_unlock(&manager_mutex);
-
-            // return
-            return 0;
-        }
-    }
-    syslog(LOG_DEBUG, "Unlocking manager mutex.");
+    entry->is_complete = true;
+    AESD_LOG(LOG_DEBUG, "Unlocking manager mutex.");
     pthread_mutex_unlock(&manager_mutex);
 
-    // no thread_ids matched
-    return -1;
+    // return
+    return 0;
 }
 
 void thread_entry_freeall() {
@@ -449,14 +1724,61 @@ void thread_entry_freeall() {
         pthread_join(current_entry->thread_id, NULL);
 
         // remove this from thread manager
+        if (current_entry->tmpdata_fd != -1) close(current_entry->tmpdata_fd);
         thread_entry_remove(current_entry->thread_id);
     }
 }
 
+void thread_entry_shutdownall() {
+    // create a current node to use for checking
+    thread_entry_t *current_entry = NULL;
+
+    // lock the manager; the client thread closes client_fd only after marking itself complete
+    pthread_mutex_lock(&manager_mutex);
+    SLIST_FOREACH(current_entry, &thread_manager, entries) {
+        if (!current_entry->is_complete) {
+            shutdown(current_entry->client_fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&manager_mutex);
+}
+
+void thread_entry_reapall() {
+    // entries that have completed, unlinked from the thread manager
+    SLIST_HEAD(, thread_entry_t) completed = SLIST_HEAD_INITIALIZER(completed);
+    thread_entry_t *current_entry = NULL;
+    thread_entry_t *next_entry = NULL;
+
+    // unlink completed entries while holding the manager; accept loops on other listeners reap concurrently
+    pthread_mutex_lock(&manager_mutex);
+    current_entry = SLIST_FIRST(&thread_manager);
+    while (current_entry != NULL) {
+        next_entry = SLIST_NEXT(current_entry, entries);
+        if (current_entry->is_complete) {
+            SLIST_REMOVE(&thread_manager, current_entry, thread_entry_t, entries);
+            SLIST_INSERT_HEAD(&completed, current_entry, entries);
+            metrics_gauge_add(METRIC_ACTIVE_CONNECTIONS, -1);
+        }
+        current_entry = next_entry;
+    }
+    pthread_mutex_unlock(&manager_mutex);
+
+    // join threads for completed threads outside of the lock
+    while (!SLIST_EMPTY(&completed)) {
+        current_entry = SLIST_FIRST(&completed);
+        SLIST_REMOVE_HEAD(&completed, entries);
+        pthread_join(current_entry->thread_id, NULL);
+        if (current_entry->tmpdata_fd != -1) close(current_entry->tmpdata_fd);
+        thread_entry_free(current_entry);
+    }
+}
+
 void thread_entry_print(thread_entry_t *current_entry) {
     // print info
-    syslog(LOG_DEBUG, "[CLIENT] Thread ID: %d | Client IP: %s | Client FD: %d | Client Data FD: %d | Completion Status: %s\n",
-        (int)current_entry->thread_id, current_entry->client_ip, current_entry->client_fd, current_entry->tmpdata_fd, current_entry->is_complete ? "Yes" : "No");
+    char client_ip[CLIENT_ADDRESS_STRLEN];
+    AESD_LOG(LOG_DEBUG, "[CLIENT] Thread ID: %d | Client IP: %s | Client FD: %d | Client Data FD: %d | Completion Status: %s\n",
+        (int)current_entry->thread_id,
+        format_address((struct sockaddr *)&current_entry->client_address, client_ip, sizeof(client_ip)), current_entry->client_fd, current_entry->tmpdata_fd, current_entry->is_complete ? "Yes" : "No");
 }
 
 void thread_entry_printall() {
@@ -464,113 +1786,220 @@ void thread_entry_printall() {
     thread_entry_t *current_entry = NULL;
 
     // print header
-    syslog(LOG_DEBUG, "===== [THREAD MANAGER] =====\n");
+    AESD_LOG(LOG_DEBUG, "===== [THREAD MANAGER] =====\n");
 
     // lock the manager
-    syslog(LOG_DEBUG, "Locking manager mutex.");
+    AESD_LOG(LOG_DEBUG, "Locking manager mutex.");
     pthread_mutex_lock(&manager_mutex);
     SLIST_FOREACH(current_entry, &thread_manager, entries) {
         thread_entry_print(current_entry);
     }
-    syslog(LOG_DEBUG, "Unlocking manager mutex.");
+    AESD_LOG(LOG_DEBUG, "Unlocking manager mutex.");
     pthread_mutex_unlock(&manager_mutex);
 
     // print footer
-    syslog(LOG_DEBUG, "===== [THREAD MANAGER] =====\n");
+    AESD_LOG(LOG_DEBUG, "===== [THREAD MANAGER] =====\n");
+}
+
+const char *format_address(const struct sockaddr *address, char *buffer, size_t size) {
+    // IPv4 peers reaching an IPv6 socket are printed as plain IPv4
+    const void *bytes = NULL;
+    int family = address->sa_family;
+    if (family == AF_INET) {
+        bytes = &((const struct sockaddr_in *)address)->sin_addr;
+    } else if (family == AF_INET6) {
+        const struct in6_addr *address6 = &((const struct sockaddr_in6 *)address)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(address6)) {
+            family = AF_INET;
+            bytes = &address6->s6_addr[12];
+        } else {
+            bytes = address6;
+        }
+    }
+
+    // return
+    if (!bytes || !inet_ntop(family, bytes, buffer, size)) {
+        snprintf(buffer, size, "unknown");
+    }
+    return buffer;
 }
 
 /**************************************************************************************************
  * FUNCTIONS - TIMESTAMP HANDLER
  **************************************************************************************************/
-#if USE_AESD_CHAR_DEVICE
-void append_timestamp() {
-    return;
-}
-#else
 void append_timestamp()
 {
     // set up variables
     char timestamp_buffer[64];
-    struct tm *tm_info;
+    struct tm tm_info;
     time_t current_time;
 
+    // check the data file is open
+    if (config.backend == BACKEND_FILE && timestamp_fd == -1) {
+        AESD_LOG(LOG_ERR, "[TIMER] Timestamp file is not open.");
+        return;
+    }
+
     // retrieve current time and turn it into RFC 2822 formatted timestamp
     time(&current_time);
-    tm_info = localtime(&current_time);
-    strftime(timestamp_buffer, sizeof(timestamp_buffer), "timestamp:%a, %d %b %Y %H:%M:%S %z\n", tm_info);
+    localtime_r(&current_time, &tm_info);
+    size_t timestamp_size = strftime(timestamp_buffer, sizeof(timestamp_buffer), "timestamp:%a, %d %b %Y %H:%M:%S %z\n", &tm_info);
 
-    // open file
-    int timestamp_fd = open(TMPDATA_PATH, O_APPEND | O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-    if (timestamp_fd == -1) {
-        syslog(LOG_ERR, "[TIMER] Error opening timestamp file. (errno %d)", errno);
+    // write to file through the shared append path
+    struct iovec timestamp = { .iov_base = timestamp_buffer, .iov_len = timestamp_size };
+    if (tmpdata_append(timestamp_fd, &timestamp, 1) == -1) {
+        AESD_LOG(LOG_ERR, "Error writing timestamp to file.");
+    }
+}
+
+/**************************************************************************************************
+ * FUNCTIONS - SIGNAL HANDLER
+ **************************************************************************************************/
+bool handle_signal(int sig) {
+    switch (sig) {
+        case SIGHUP:
+            reload_config();
+            return true;
+        case SIGINT:
+        case SIGTERM:
+            AESD_LOG(LOG_INFO, "Caught signal, exiting");
+            return false;
+        default:
+            return true;
+    }
+}
+
+void reload_config() {
+    // rebuild the configuration from the same layers used at startup
+    AESD_LOG(LOG_INFO, "[CONFIG] SIGHUP received, reloading configuration.");
+    server_config_t new_config;
+    if (config_load(&new_config, saved_argc, saved_argv) == -1) {
+        AESD_LOG(LOG_ERR, "[CONFIG] Reload failed, keeping current configuration.");
         return;
     }
+    if (!config_is_reloadable(&config, &new_config)) {
+        AESD_LOG(LOG_WARNING, "[CONFIG] backend, data_path and storage changes require a restart.");
+        new_config.backend = config.backend;
+        memcpy(new_config.data_path, config.data_path, sizeof(new_config.data_path));
+        new_config.segment_size = config.segment_size;
+        new_config.fsync_policy = config.fsync_policy;
+        new_config.fsync_interval_ms = config.fsync_interval_ms;
+        new_config.commit_delay_us = config.commit_delay_us;
+        new_config.commit_batch = config.commit_batch;
+        new_config.retention_bytes = config.retention_bytes;
+        new_config.retention_s = config.retention_s;
+        new_config.compress_segments = config.compress_segments;
+        new_config.mmap_reads = config.mmap_reads;
+        new_config.line_queue = config.line_queue;
+    }
+    new_config.daemon = config.daemon;
+
+    // swap in the new configuration; client threads copy it when they start
+    server_config_t old_config = config;
+    pthread_mutex_lock(&config_mutex);
+    config = new_config;
+    pthread_mutex_unlock(&config_mutex);
+
+    // apply settings owned by the event loop, and the limits checked by every connection
+    aesd_log_set_level(config.log_level);
+    admission_configure(&config);
+    if (config.timer_interval_s != old_config.timer_interval_s) {
+        initialize_timer(config.timer_interval_s);
+    }
+    if (strcmp(config.metrics_port, old_config.metrics_port)) {
+        open_metrics(config.metrics_port);
+    }
 
-    // write to file
-    syslog(LOG_DEBUG, "Locking tmpdata mutex.");
-    pthread_mutex_lock(&file_mutex);
-    if (write(timestamp_fd, timestamp_buffer, strlen(timestamp_buffer)) == -1) {
-        syslog(LOG_ERR, "Error writing timestamp to file.");
+    // rebuild listeners if the listening address or layout changed. The new set accepts before the
+    // old one stops, and the old accept loops take what is queued on their sockets before they are
+    // closed, so no connection is refused or reset; accepted connections are unaffected
+    bool rebuilt = false;
+    if (strcmp(config.port, old_config.port) || config.workers != old_config.workers ||
+        config.reuseport != old_config.reuseport) {
+        // on the same port both sets share each reuseport group, the old one's sockets first
+        int steer_offset = (listener_set && !strcmp(config.port, old_config.port) && config.reuseport &&
+            old_config.reuseport) ? listener_set->group_size : 0;
+        listener_set_t *new_set = create_listeners(&config, steer_offset);
+        if (!new_set) {
+            // a socket without SO_REUSEPORT cannot share its port, so such changes need a restart
+            AESD_LOG(LOG_ERR, "[CONFIG] Creating new listeners failed, keeping the previous listeners.");
+            pthread_mutex_lock(&config_mutex);
+            memcpy(config.port, old_config.port, sizeof(config.port));
+            config.workers = old_config.workers;
+            config.reuseport = old_config.reuseport;
+            pthread_mutex_unlock(&config_mutex);
+        } else {
+            run_listeners(new_set);
+            stop_listeners(listener_set, true);
+            close_listeners(listener_set);
+            listener_set = new_set;
+            settle_listeners(listener_set);
+            rebuilt = true;
+        }
+    }
+    if (!rebuilt && listener_set && config.backlog != old_config.backlog) {
+        // listen() on a listening socket only updates its backlog
+        for (int i = 0; i < listener_set->count; i++) {
+            listen(listener_set->listeners[i].socket_fd, config.backlog);
+        }
     }
-    syslog(LOG_DEBUG, "Unlocking tmpdata mutex.");
-    pthread_mutex_unlock(&file_mutex);
 
-    // close file
-    close(timestamp_fd);
+    AESD_LOG(LOG_INFO, "[CONFIG] Configuration reloaded.");
 }
-#endif
 
-/**************************************************************************************************
- * FUNCTIONS - SIGNAL HANDLER
- **************************************************************************************************/
-void signal_handler(int sig) {
-    if(sig == SIGALRM)
-    {
-        syslog(LOG_INFO, "[TIMER] SIGALRM received, writing to file.");
-        append_timestamp();
-    } else {
-        // log signal handler, using re-entrant write() instead of a normal printf/log
-        syslog(LOG_INFO, "Caught signal, exiting");
+void shutdown_server() {
+    // stop accepting
+    stop_listeners(listener_set, false);
 
-        // cleanup
-        cleanup_server();
+    // notify client threads
+    uint64_t notify = 1;
+    if (write(shutdown_fd, &notify, sizeof(notify)) != sizeof(notify)) {
+        AESD_LOG(LOG_ERR, "Notifying shutdown failed. (errno %d)", errno);
+    }
 
-        // exit
-        exit(1);
+    // let in-flight lines complete until the deadline
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += SHUTDOWN_DRAIN_S;
+    while (1) {
+        thread_entry_reapall();
+
+        pthread_mutex_lock(&manager_mutex);
+        bool empty = SLIST_EMPTY(&thread_manager);
+        pthread_mutex_unlock(&manager_mutex);
+        if (empty) break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec ||
+            (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            // out of time; cut off whoever is left
+            AESD_LOG(LOG_WARNING, "Drain deadline passed, closing remaining connections.");
+            thread_entry_shutdownall();
+            break;
+        }
+        poll(NULL, 0, SHUTDOWN_POLL_MS);
     }
+
+    // join whatever is left; appends are synchronous, so every acknowledged line has been written
+    thread_entry_freeall();
 }
 
 /**************************************************************************************************
  * FUNCTIONS - DAEMON
  **************************************************************************************************/
-void start_daemon(int argc, char **argv) {
-    // check command line options with getopt()
-    // https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
-    int c;
-    bool is_daemon = false;
-    while ((c = getopt(argc, argv, "d")) != -1) {
-        switch(c) {
-            case 'd':
-                is_daemon = true;
-                break;
-            case '?':
-                printf("Unknown option `-%c'.\n", optopt);
-                exit(-1);
-        }
-    }
-
+void start_daemon(bool is_daemon) {
     // start socket daemon, assuming user passed -d as a flag
     // https://stackoverflow.com/questions/17078947/daemon-socket-server-in-c
     // read the above post for classic steps on making a daemon from an executed process
     if (is_daemon) {
         // indicate we are in daemon mode
-        syslog(LOG_INFO, "[DAEMON] Starting daemon...");
+        AESD_LOG(LOG_INFO, "[DAEMON] Starting daemon...");
 
         // create first child (child A)
         pid_t pid;
         if ((pid = fork()) < 0) {
             // error creating child process
-            syslog(LOG_ERR, "[DAEMON] Creating first child process fails.");
+            AESD_LOG(LOG_ERR, "[DAEMON] Creating first child process fails.");
             cleanup_server();
             exit(1);
         } else if (pid != 0) {
@@ -584,7 +2013,7 @@ void start_daemon(int argc, char **argv) {
         // create second child (child B)
         if ((pid = fork()) < 0) {
             // error creating child process
-            syslog(LOG_ERR, "[DAEMON] Creating second child process fails.");
+            AESD_LOG(LOG_ERR, "[DAEMON] Creating second child process fails.");
             cleanup_server();
             exit(1);
         } else if (pid != 0) {
@@ -595,6 +2024,6 @@ void start_daemon(int argc, char **argv) {
         // child B returns to original program
         return;
     } else {
-        syslog(LOG_INFO, "[DAEMON] Starting in normal mode.");
+        AESD_LOG(LOG_INFO, "[DAEMON] Starting in normal mode.");
     }
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
  * INCLUDES
  **************************************************************************************************/
 
+// GNU extensions (CPU affinity, SO_REUSEPORT helpers)
+#define _GNU_SOURCE
+
 // include standard libraries
 #include <stdlib.h>
 #include <stdio.h>
@@ -16,54 +19,135 @@
 
 // include network libraries
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <endian.h>
+#include <linux/filter.h>
 
 // queue
 #include <sys/queue.h>
 
 // multithreading
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 // aesd
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-config.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-protocol.h"
+#include "aesdsocket-seglog.h"
+#include "aesdsocket-commit.h"
+#include "aesdsocket-filemap.h"
+#include "aesdsocket-lz.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-queue.h"
 
 /**************************************************************************************************
  * CONSTANTS AND GLOBALS
  **************************************************************************************************/
 
-// build switch - either use a char device or a file in filesystem
-#define USE_AESD_CHAR_DEVICE 1
-#if USE_AESD_CHAR_DEVICE
-    #define TMPDATA_PATH        "/dev/aesdchar"
-#else
-    #define TMPDATA_PATH        "/var/tmp/aesdsocketdata"
-#endif
+// client line buffers start small and grow up to the configured max_line_size
+#define LINE_BUFFER_INITIAL_SIZE    4096
+
+// room for any formatted client address, IPv4 or IPv6
+#define CLIENT_ADDRESS_STRLEN       INET6_ADDRSTRLEN
 
-// define constants
-#define PORT                "9000"
-#define NUM_CONNECTIONS     10
-#define BUFFER_SIZE         1024 * 1024
-#define TIMER_FREQ_S        10
+// shutdown
+#define SHUTDOWN_DRAIN_S    5           // time given to clients to finish the line in flight
+#define SHUTDOWN_POLL_MS    50          // interval at which draining clients are reaped
 
 // ioctl handling
 #define AESD_IOCTL_SEEKTO           "AESDCHAR_IOCSEEKTO:"
 #define AESD_IOCTL_SEEKTO_PARSE     AESD_IOCTL_SEEKTO "%ld,%ld"
 
-// server details
-static int server_socket_fd;
-struct addrinfo *server_address_info;
+// read commands; answered with a slice of the data file without appending anything
+#define AESD_READ_RANGE             "AESD_READ:"
+#define AESD_READ_RANGE_PARSE       AESD_READ_RANGE "%zu,%zu"           // byte offset, byte count
+#define AESD_READ_ENTRIES           "AESD_ENTRIES:"
+#define AESD_READ_ENTRIES_PARSE     AESD_READ_ENTRIES "%u,%u"           // first and last entry, inclusive
+#define AESD_READ_EMPTY             "AESD_EMPTY\n"                      // reply to a read naming no stored data
+#define AESD_READ_ERROR             "AESD_ERROR\n"                      // reply to a read that does not parse, or a line not stored
+
+// command line, re-applied when the configuration is reloaded
+static int saved_argc;
+static char **saved_argv;
+
+/**
+ * struct listener_t
+ * 
+ * @brief holds a single listening socket and the accept loop serving it
+ */
+typedef struct listener_t {
+    int                             socket_fd;          // listening socket fd, non-blocking
+    int                             cpu;                // cpu the accept loop is pinned to, -1 if unpinned
+    pthread_t                       thread_id;          // accept loop thread
+    struct listener_set_t *         set;                // set the listener belongs to
+} listener_t;
+
+/**
+ * struct listener_set_t
+ * 
+ * @brief the listeners created from one configuration, and the eventfd that stops their accept
+ * loops; a reload builds a new set before the old one is stopped
+ */
+typedef struct listener_set_t {
+    listener_t *                    listeners;
+    int                             count;              // listeners created
+    int                             group_size;         // listeners per address, sharing a reuseport group
+    int                             steer_offset;       // sockets of a previous set ahead of this one in each group
+    int                             stop_fd;            // eventfd that stops the accept loops
+    _Atomic bool                    hand_off;           // accept what is queued on each socket before stopping
+} listener_set_t;
+
+// active listeners
+static listener_set_t *listener_set = NULL;
+
+// cpus the process may run on, read before any accept loop is pinned; client threads are created
+// with all of them rather than inheriting the accept loop's single cpu
+static cpu_set_t process_cpus;
+static int num_process_cpus = 0;
+static pthread_attr_t client_thread_attr;
 
 // tmpdata file mutex
 pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// timestamps
-timer_t timer_id;
+// file backend durability - a descriptor kept open for syncing, and the group commit coordinator
+static int storage_fd = -1;
+static commit_group_t storage_commit;
+static bool storage_commit_open = false;
+
+// line queue - client appends handed to a single storage writer, with its own data descriptor
+static line_queue_t line_queue;
+static bool line_queue_open = false;
+static int queue_fd = -1;
+
+// timestamps - a timerfd serviced by the main thread's event loop
+static int timer_fd = -1;
+static int timestamp_fd = -1;
+
+// signals - SIGINT and SIGTERM are blocked in every thread and read from a signalfd by the event loop
+static int signal_fd = -1;
+
+// shutdown notification - an eventfd that becomes readable, and stays readable, once shutdown begins
+static int shutdown_fd = -1;
 
-// signal actions
-struct sigaction sigact;
+// metrics endpoint - a loopback listening socket served by its own thread, so a slow scraper never
+// holds up the event loop
+static int metrics_fd = -1;
+static int metrics_wake_fd = -1;    // eventfd that stops the metrics thread
+static pthread_t metrics_thread;
+#define METRICS_REQUEST_TIMEOUT_MS  100     // time allowed for a scraper to send its request, and to take the reply
 
 /**************************************************************************************************
  * FUNCTION PROTOTYPES
@@ -77,14 +161,147 @@ struct sigaction sigact;
  */
 void initialize_server();
 
+/**
+ * initialize_storage()
+ * 
+ * Opens the storage backend shared by every connection: the segmented log is opened and recovered,
+ * the data file is mapped for reading, and a synced data file gets its group commit coordinator.
+ * The aesdchar device and the data file are otherwise opened per connection. With line_queue, the
+ * storage writer is started last.
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int initialize_storage();
+
+/**
+ * initialize_line_queue()
+ * 
+ * Starts the line queue's storage writer when line_queue is set, with its own descriptor of the
+ * aesdchar device or data file
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int initialize_line_queue();
+
+/**
+ * storage_sync()
+ * 
+ * Syncs the data file; the sync function of the file backend's group commit coordinator
+ * 
+ * @param arg                       Unused
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int storage_sync(void *arg);
+
+/**
+ * storage_queue_write()
+ * 
+ * Stores a batch of appends on the storage writer's own descriptor; the write function of the
+ * line queue
+ * 
+ * @param arg                       Unused
+ * @param iov                       Appends to store
+ * @param iovcnt                    Number of appends in iov
+ * 
+ * @return number of bytes written, -1 on failure
+ */
+ssize_t storage_queue_write(void *arg, const struct iovec *iov, int iovcnt);
+
 /**
  * initialize_timer()
  * 
- * Initializes timer for SIGALRM
+ * Initializes or re-arms the timestamp timerfd, which is serviced by run_event_loop() rather than
+ * interrupting other threads with a signal. The file and segmented log backends are timestamped.
+ * 
+ * @param interval_s                Timestamp interval in seconds, 0 to disarm the timer
+ * 
+ * @return none
+ */
+void initialize_timer(int interval_s);
+
+/**
+ * run_event_loop()
+ * 
+ * Main thread loop that polls the server's control file descriptors (timestamp timer, signals)
+ * and dispatches their events
+ * 
+ * @return none, once a shutdown signal has been received
+ */
+void run_event_loop();
+
+/**
+ * open_metrics()
+ * 
+ * Opens the loopback metrics endpoint on the given port and starts the thread serving it,
+ * replacing any open endpoint
+ * 
+ * @param port                      Port to listen on, "0" to disable the endpoint
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int open_metrics(const char *port);
+
+/**
+ * close_metrics()
+ * 
+ * Stops the metrics thread and closes the endpoint, if open
  * 
  * @return none
  */
-void initialize_timer();
+void close_metrics();
+
+/**
+ * metrics_listener()
+ * 
+ * Metrics thread; serves scrapes one at a time until metrics_wake_fd is signalled
+ * 
+ * @param arg                       Unused
+ * 
+ * @return NULL
+ */
+void *metrics_listener(void *arg);
+
+/**
+ * serve_metrics()
+ * 
+ * Accepts a single scrape on the metrics endpoint and replies with every metric in Prometheus
+ * text format over HTTP/1.0. The scrape socket is non-blocking; a scraper gets
+ * METRICS_REQUEST_TIMEOUT_MS to send its request and as long again for each part of the reply.
+ * 
+ * @return none
+ */
+void serve_metrics();
+
+/**
+ * tmpdata_append()
+ * 
+ * Appends a set of buffers to the data file as a single write while holding file_mutex. This is
+ * the only path used to append to the data file, so that timestamps and client lines never
+ * interleave. The segmented log serializes its own appends and ignores fd. Under the group fsync
+ * policy, returns once the append is synced. With line_queue, a single buffer is handed to the
+ * storage writer instead, and written with the appends queued alongside it.
+ * 
+ * @param fd                        Data file descriptor
+ * @param iov                       Buffers to append
+ * @param iovcnt                    Number of buffers in iov
+ * 
+ * @return number of bytes written, -1 on failure
+ */
+ssize_t tmpdata_append(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * storage_append()
+ * 
+ * Appends a set of buffers to the data file, as tmpdata_append() does without a line queue
+ * 
+ * @param fd                        Data file descriptor
+ * @param iov                       Buffers to append
+ * @param iovcnt                    Number of buffers in iov
+ * 
+ * @return number of bytes written, -1 on failure
+ */
+ssize_t storage_append(int fd, const struct iovec *iov, int iovcnt);
 
 /**
  * cleanup_server()
@@ -95,14 +312,130 @@ void initialize_timer();
  */
 void cleanup_server();
 
+/**
+ * create_listeners()
+ * 
+ * Creates, binds and starts listening on a set of server sockets. With reuseport, one
+ * SO_REUSEPORT socket is created per worker so each accept loop has its own accept queue.
+ * 
+ * @param listen_config             Configuration providing the port, backlog and worker layout
+ * @param steer_offset              Sockets of a running set that share each reuseport group and
+ *                                  come first in it; new connections are steered past them
+ * 
+ * @return the set on success, NULL on failure
+ */
+listener_set_t *create_listeners(const server_config_t *listen_config, int steer_offset);
+
+/**
+ * attach_reuseport_cbpf()
+ * 
+ * Attaches a classic BPF program to the reuseport group that selects the listener at index
+ * (offset + CPU the connection arrived on % count), keeping a connection's softirq and accept on
+ * the same core; see listener_cpus()
+ * 
+ * @param socket_fd                 Any socket in the reuseport group
+ * @param offset                    Index of the first socket to steer to
+ * @param count                     Number of sockets to steer to
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int attach_reuseport_cbpf(int socket_fd, int offset, int count);
+
+/**
+ * settle_listeners()
+ * 
+ * Steers each reuseport group across a new set alone once the set it replaced has closed, or
+ * returns it to hashing without the CBPF program
+ * 
+ * @note the kernel fills the places of closed sockets with the last ones in the group, so after a
+ * rebuild on the same port, connections are still spread over every listener but not always to
+ * the one pinned to the receiving CPU
+ * 
+ * @param set                       Listeners that replaced a set on the same port
+ * 
+ * @return none
+ */
+void settle_listeners(listener_set_t *set);
+
+/**
+ * run_listeners()
+ * 
+ * Spawns one accept loop thread per listener of a set
+ * 
+ * @param set                       Listeners to run
+ * 
+ * @return none
+ */
+void run_listeners(listener_set_t *set);
+
+/**
+ * listener_cpus()
+ * 
+ * Picks the CPUs the accept loops of a reuseport group are pinned to, from the CPUs the process
+ * may run on. Each listener prefers a CPU the reuseport CBPF program steers to it; CPUs need not
+ * be numbered from 0, so the rest take the allowed CPUs no listener has claimed, then share them.
+ * 
+ * @param cpus                      Set to the CPU of each listener
+ * @param count                     Number of listeners in the group
+ * 
+ * @return none
+ */
+void listener_cpus(int *cpus, int count);
+
+/**
+ * stop_listeners()
+ * 
+ * Stops every accept loop of a set and waits for it to return; the sockets stay open
+ * 
+ * @param set                       Listeners to stop, may be NULL
+ * @param hand_off                  Accept the connections queued on each socket first, so closing
+ *                                  it afterwards resets none of them
+ * 
+ * @return none
+ */
+void stop_listeners(listener_set_t *set, bool hand_off);
+
+/**
+ * close_listeners()
+ * 
+ * Closes every listening socket of a set and frees it
+ * 
+ * @param set                       Listeners to close, may be NULL
+ * 
+ * @return none
+ */
+void close_listeners(listener_set_t *set);
+
+/**
+ * listener_thread()
+ * 
+ * Threading function that pins itself to the listener's CPU and runs its accept loop
+ */
+void *listener_thread(void *arg);
+
 /**
  * accept_connections()
  * 
- * Main program loop that accepts connections and spawns client threads
+ * Accept loop for a single listener that accepts connections until its set is stopped
+ * 
+ * @param listener                  Listener to accept connections on
  * 
  * @return none
  */
-void accept_connections();
+void accept_connections(listener_t *listener);
+
+/**
+ * accept_connection()
+ * 
+ * Accepts a single queued connection and spawns its client thread, or refuses it
+ * 
+ * @note client threads run on every CPU of the process, not the accept loop's pinned CPU
+ * 
+ * @param listener                  Listener to accept a connection on
+ * 
+ * @return 0 if a connection was taken off the queue, -1 if none was queued or accept() failed
+ */
+int accept_connection(listener_t *listener);
 
 /**
  * client_handler()
@@ -111,36 +444,70 @@ void accept_connections();
  */
 void *client_handler(void *arg);
 
+/**
+ * line_buffer_reserve()
+ * 
+ * Grows a client line buffer
+ * 
+ * @param buffer                    Buffer to grow, reallocated in place
+ * @param size                      Current size of the buffer, updated on success
+ * @param new_size                  Size to grow the buffer to
+ * 
+ * @return 0 on success, -1 on failure, leaving the buffer unchanged
+ */
+int line_buffer_reserve(char **buffer, size_t *size, size_t new_size);
+
 /**
  * append_timestamp
  * 
- * Writes timestamp to a file
+ * Writes timestamp to a file; called from the event loop when the timer expires
  * 
  * @return none
  */
 void append_timestamp();
 
 /**
- * signal_handler()
+ * handle_signal()
+ * 
+ * Handles a signal read from signal_fd by the event loop
  * 
- * Handles signals such as SIGINT or SIGTERM to gracefully shut down socket server
+ * @param sig                       Signal number
+ * 
+ * @return true if the server should keep running, false if it should shut down
+ */
+bool handle_signal(int sig);
+
+/**
+ * reload_config()
+ * 
+ * Reloads the configuration on SIGHUP and applies it without dropping connections: the log level
+ * and timer are updated in place, the listeners are rebuilt if the port or worker layout changed,
+ * and buffer sizes apply to new connections
+ * 
+ * @return none
+ */
+void reload_config();
+
+/**
+ * shutdown_server()
+ * 
+ * Gracefully shuts down the server: stops accepting, lets clients finish the line in flight for up
+ * to SHUTDOWN_DRAIN_S, then closes the remaining connections and joins every client thread
  * 
  * @return none
  */
-void signal_handler(int sig);
+void shutdown_server();
 
 /**
  * start_daemon()
  * 
- * Checks command line arguments to see if a "-d" flag was passed, and if so, starts
- * the socket server in daemon mode
+ * Starts the socket server in daemon mode if a "-d" flag was passed
  * 
- * @param argc      Number of command line arguments, passed through main()
- * @param argv      String array of command line arguments, passed through main()
+ * @param is_daemon                 Whether to fork into the background
  * 
  * @return none
  */
-void start_daemon(int argc, char **argv);
+void start_daemon(bool is_daemon);
 
 
 /**************************************************************************************************
@@ -154,11 +521,13 @@ void start_daemon(int argc, char **argv);
  */
 typedef struct thread_entry_t {
     pthread_t                       thread_id;          // thread ID
-    char *                          client_ip;          // client IP address
+    struct sockaddr_storage         client_address;     // client address, formatted only when logged
+    socklen_t                       client_address_length;
     int                             client_fd;          // client connection fd
     bool                            is_complete;        // thread completion boolean
     SLIST_ENTRY(thread_entry_t)     entries;            // next thread entry
     int                             tmpdata_fd;         // data file descriptor
+    admission_client_t *            admission;          // rate state of the client address
 } thread_entry_t;
 
 // define a single head of the linked list, called thread_manager
@@ -173,14 +542,15 @@ pthread_mutex_t manager_mutex = PTHREAD_MUTEX_INITIALIZER;
  * Creates a new thread entry that will be used to track the threads and corresponding client info
  * 
  * @param new_thread_id             Thread ID
- * @param new_client_ip             Client's IP address
+ * @param new_client_address        Client's address, copied into the entry
+ * @param new_client_address_length Length of new_client_address
  * @param new_client_fd             File descriptor to access client connection
  * @param new_tmpdata_fd            File descriptor to access client's data file
  * 
  * @return new thread entry
  */
-thread_entry_t *thread_entry_create(pthread_t new_thread_id, const char *new_client_ip,
-    int new_client_fd, int new_tmpdata_fd);
+thread_entry_t *thread_entry_create(pthread_t new_thread_id, const struct sockaddr *new_client_address,
+    socklen_t new_client_address_length, int new_client_fd, int new_tmpdata_fd);
 
 /**
  * thread_entry_copy()
@@ -231,13 +601,14 @@ int thread_entry_remove(pthread_t thread_id);
 /**
  * thread_entry_markcomplete()
  * 
- * Marks a thread in the thread manager as complete
+ * Marks a thread's entry as complete. The entry need not be in the thread manager yet: a client
+ * can finish before the accepting thread adds it, and it is then reaped on the next pass.
  * 
- * @param thread_id                 The entry containing the thread_id to remove
+ * @param entry                     The entry of the calling thread
  * 
  * @return 0 on success, -1 on failure
  */
-int thread_entry_markcomplete(pthread_t thread_id);
+int thread_entry_markcomplete(thread_entry_t *entry);
 
 /**
  * thread_entry_freeall()
@@ -248,6 +619,25 @@ int thread_entry_markcomplete(pthread_t thread_id);
  */
 void thread_entry_freeall();
 
+/**
+ * thread_entry_reapall()
+ * 
+ * Joins and removes all threads in the thread manager that have been marked as complete
+ * 
+ * @return none
+ */
+void thread_entry_reapall();
+
+/**
+ * thread_entry_shutdownall()
+ * 
+ * Shuts down the client connection of every thread in the thread manager that is still running,
+ * waking any thread blocked in recv() or send()
+ * 
+ * @return none
+ */
+void thread_entry_shutdownall();
+
 /**
  * thread_entry_print()
  * 
@@ -266,4 +656,326 @@ void thread_entry_print(thread_entry_t *current_entry);
  * 
  * @return none
  */
-void thread_entry_printall();
\ No newline at end of file
+void thread_entry_printall();
+
+/**
+ * format_address()
+ * 
+ * Formats the IP of a socket address, for logging
+ * 
+ * @param address                   IPv4 or IPv6 socket address
+ * @param buffer                    Buffer for the string, CLIENT_ADDRESS_STRLEN bytes fits any address
+ * @param size                      Size of buffer
+ * 
+ * @return buffer
+ */
+const char *format_address(const struct sockaddr *address, char *buffer, size_t size);
+
+
+/**************************************************************************************************
+ * CLIENTS - Per connection protocol state
+ **************************************************************************************************/
+
+/**
+ * enum client_protocol_t
+ * 
+ * @brief protocol spoken on a connection, decided by its first bytes
+ */
+typedef enum client_protocol_t {
+    PROTOCOL_UNKNOWN,                                   // waiting for enough bytes to decide
+    PROTOCOL_TEXT,                                      // newline terminated lines
+    PROTOCOL_BINARY,                                    // length prefixed frames, see aesdsocket-protocol.h
+} client_protocol_t;
+
+/**
+ * struct client_t
+ * 
+ * @brief state of a single client connection, owned by its client_handler() thread
+ */
+typedef struct client_t {
+    thread_entry_t *                connection;         // thread manager entry
+    int                             client_fd;          // client socket
+    int                             tmpdata_fd;         // data file, opened for this connection
+    server_config_t                 config;             // configuration at accept time
+    client_protocol_t               protocol;           // protocol spoken on the connection
+    char *                          read_buffer;        // text data received from the socket
+    char *                          file_content;       // reply staging buffer
+    char *                          compress_buffer;    // compressed reply staging, allocated on first use
+    char *                          write_buffer;       // line or frames being assembled
+    size_t                          write_buffer_size;  // allocated size of write_buffer
+    size_t                          write_buffer_index; // bytes used in write_buffer
+    size_t                          batch_length;       // complete lines at the start of write_buffer
+    bool                            line_too_long;      // current line is being dropped
+    uint64_t                        recv_ns;            // when the last chunk was received
+    uint64_t                        frames_received;    // frames handled on this connection
+    uint64_t                        bytes_received;     // bytes received on this connection
+    uint64_t                        bytes_sent;         // bytes sent on this connection
+} client_t;
+
+/**
+ * client_detect_protocol()
+ * 
+ * Decides the protocol of a new connection from its first bytes, then processes them. With
+ * binary_framing, a leading NUL byte may start the binary preamble, and the connection is text as
+ * soon as a byte differs from it; anything else, and every connection without binary_framing, is text.
+ * 
+ * @param client                    Client connection
+ * @param length                    Bytes received into read_buffer
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_detect_protocol(client_t *client, size_t length);
+
+/**
+ * client_process_text()
+ * 
+ * Splits received data into newline terminated lines, handling each completed line. With
+ * pipelining enabled, the lines completed by a chunk are batched instead:
+ *  - the batch is stored with a single append, so its lines stay contiguous and in order
+ *  - one reply is sent once the whole batch is stored, replacing the per line replies
+ *  - a seek command ends the batch; the lines before it are stored first, and the command is
+ *    answered with its own reply from the seek position
+ * Lines from one client are always stored in the order they were sent; lines from other clients
+ * may fall between two batches, but never inside one.
+ * 
+ * @param client                    Client connection
+ * @param data                      Received data
+ * @param length                    Bytes in data
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_process_text(client_t *client, const char *data, size_t length);
+
+/**
+ * client_is_command()
+ * 
+ * Checks whether a line is a read command, or a seek command for the aesdchar device, rather than
+ * data to append
+ * 
+ * @param client                    Client connection
+ * @param line                      NUL terminated line, whose terminator may be overwritten
+ * 
+ * @return true if the line is a command
+ */
+bool client_is_command(client_t *client, const char *line);
+
+/**
+ * client_persist_batch()
+ * 
+ * Appends the batched lines at the start of write_buffer to the data file in one write, then
+ * moves the partial line that follows them to the start of the buffer, whether or not they were stored
+ * 
+ * @param client                    Client connection
+ * 
+ * @return 0 once the batch is stored, -1 if the append failed or was short
+ */
+int client_persist_batch(client_t *client);
+
+/**
+ * client_handle_line()
+ * 
+ * Appends a completed line, or runs the seek command it holds, then replies with the data file; a
+ * line that could not be stored in full is answered with AESD_READ_ERROR instead
+ * 
+ * @param client                    Client connection
+ * @param line                      NUL terminated line, whose terminator may be overwritten
+ * @param length                    Length of the line
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_handle_line(client_t *client, char *line, size_t length);
+
+/**
+ * client_handle_read()
+ * 
+ * Replies to a read command with the slice of the data file it names, without appending:
+ *  - AESD_READ:<offset>,<length>       length bytes from a byte offset
+ *  - AESD_ENTRIES:<first>,<last>       entries first to last inclusive, zero referenced; entries are
+ *                                      the device's write commands, or lines for the file backend
+ * Every read is answered: a slice holding nothing with AESD_READ_EMPTY, a command that does not
+ * parse, or has a negative number, with AESD_READ_ERROR.
+ * 
+ * @param client                    Client connection
+ * @param line                      NUL terminated command
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_handle_read(client_t *client, const char *line);
+
+/**
+ * client_reply()
+ * 
+ * Replies to a text client with the data file from an offset, recording reply metrics
+ * 
+ * @param client                    Client connection
+ * @param offset                    Byte offset to start from
+ * @param length                    Most bytes to send, SIZE_MAX to send to the end
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_reply(client_t *client, off_t offset, size_t length);
+
+/**
+ * client_process_binary()
+ * 
+ * Handles every complete frame in write_buffer, keeping a trailing partial frame and growing the
+ * buffer so the rest of it can be received in place
+ * 
+ * @param client                    Client connection
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_process_binary(client_t *client);
+
+/**
+ * client_handle_frame()
+ * 
+ * Runs a single request frame and sends its reply frame
+ * 
+ * @param client                    Client connection
+ * @param header                    Frame header, in network byte order
+ * @param payload                   Frame payload
+ * @param length                    Bytes in payload
+ * 
+ * @return 0 on success, -1 if the connection should be closed
+ */
+int client_handle_frame(client_t *client, const struct aesd_frame_header *header, char *payload, size_t length);
+
+/**
+ * client_send_frame()
+ * 
+ * Sends a reply frame
+ * 
+ * @param client                    Client connection
+ * @param opcode                    Request opcode being replied to
+ * @param status                    0 on success, errno value otherwise
+ * @param payload                   Reply payload, may be NULL if length is 0
+ * @param length                    Bytes in payload
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int client_send_frame(client_t *client, uint8_t opcode, int status, const void *payload, size_t length);
+
+/**
+ * client_send_compressed()
+ * 
+ * Sends a successful reply frame with its payload compressed, or as is if that is not smaller
+ * 
+ * @param client                    Client connection
+ * @param opcode                    Request opcode being replied to
+ * @param payload                   Reply payload, at most buffer_size bytes
+ * @param length                    Bytes in payload
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int client_send_compressed(client_t *client, uint8_t opcode, const char *payload, size_t length);
+
+/**
+ * client_send_text()
+ * 
+ * Sends a NUL terminated reply line to a text client
+ * 
+ * @param client                    Client connection
+ * @param text                      Reply, including its newline
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int client_send_text(client_t *client, const char *text);
+
+/**
+ * client_sendv()
+ * 
+ * Sends a set of buffers to a client, resuming after partial sends
+ * 
+ * @note iov is modified
+ * 
+ * @param client                    Client connection
+ * @param iov                       Buffers to send
+ * @param iovcnt                    Number of buffers in iov
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int client_sendv(client_t *client, struct iovec *iov, int iovcnt);
+
+/**
+ * client_reply_from()
+ * 
+ * Sends the data file from an offset, stopping at its end. Reads are positional, so the reply does
+ * not depend on the descriptor's offset, which O_APPEND moves to the end after every write.
+ * 
+ * @param client                    Client connection
+ * @param offset                    Byte offset to start from
+ * @param length                    Most bytes to send, SIZE_MAX to send to the end
+ * 
+ * @return bytes sent, -1 on failure
+ */
+ssize_t client_reply_from(client_t *client, off_t offset, size_t length);
+
+/**
+ * tmpdata_seekto()
+ * 
+ * Seeks the data device to a write command and offset within it while holding file_mutex
+ * 
+ * @param fd                        Data device descriptor
+ * @param write_cmd                 Zero referenced write command
+ * @param write_cmd_offset          Zero referenced offset within the command
+ * 
+ * @return the resulting byte offset, -1 on failure
+ */
+off_t tmpdata_seekto(int fd, uint32_t write_cmd, uint32_t write_cmd_offset);
+
+/**
+ * tmpdata_read()
+ * 
+ * Reads from the data file at an offset, stopping early only at its end
+ * 
+ * @param client                    Client connection
+ * @param buffer                    Buffer to read into
+ * @param length                    Bytes to read
+ * @param offset                    Byte offset to read from
+ * 
+ * @return bytes read, -1 on failure
+ */
+ssize_t tmpdata_read(client_t *client, char *buffer, size_t length, off_t offset);
+
+/**
+ * tmpdata_view()
+ * 
+ * Gets the bytes of the data file at an offset without copying them when the file is mapped;
+ * otherwise they are read into file_content, at most buffer_size of them
+ * 
+ * @param client                    Client connection
+ * @param offset                    Byte offset to read from
+ * @param length                    Most bytes wanted
+ * @param data                      Set to the bytes read
+ * 
+ * @return bytes available at data, 0 at the end of the store, -1 on failure
+ */
+ssize_t tmpdata_view(client_t *client, off_t offset, size_t length, const char **data);
+
+/**
+ * tmpdata_entry_range()
+ * 
+ * Resolves a range of entries to byte offsets. The aesdchar device resolves them with
+ * AESDCHAR_IOCSEEKTO, the segmented log with its sparse index; files are scanned for newlines.
+ * 
+ * @param client                    Client connection
+ * @param first                     First entry, zero referenced
+ * @param last                      Last entry, inclusive; clamped to the newest entry
+ * @param start                     Set to the byte offset of the first entry
+ * @param end                       Set to the byte offset just past the last entry
+ * 
+ * @return 0 on success, -1 if the first entry does not exist
+ */
+int tmpdata_entry_range(client_t *client, uint32_t first, uint32_t last, off_t *start, off_t *end);
+
+/**
+ * tmpdata_size()
+ * 
+ * Gets the size of the data file
+ * 
+ * @param client                    Client connection
+ * 
+ * @return size in bytes, -1 on failure
+ */
+off_t tmpdata_size(client_t *client);